@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/socket.h>
+#include "dbg_guv.h"
+#include "textio.h"
+
+//Micro-benchmark for read_fpga_connection. We make up a stream of receipts
+//and logs, cut it at random places (like a real socket would), and time
+//each call to read_fpga_connection as it picks up the pieces from a
+//socketpair.
+//
+//Allocations are counted by linking with -Wl,--wrap (see the Makefile), so
+//any malloc that sneaks into the hot path shows up in the report.
+
+//Some of the code we link against writes errors here
+msg_win *err_log = NULL;
+
+static unsigned long num_allocs = 0;
+
+void *__real_malloc(size_t sz);
+void *__real_calloc(size_t n, size_t sz);
+void *__real_realloc(void *p, size_t sz);
+char *__real_strdup(char const *s);
+
+void *__wrap_malloc(size_t sz) {
+    num_allocs++;
+    return __real_malloc(sz);
+}
+
+void *__wrap_calloc(size_t n, size_t sz) {
+    num_allocs++;
+    return __real_calloc(n, sz);
+}
+
+void *__wrap_realloc(void *p, size_t sz) {
+    num_allocs++;
+    return __real_realloc(p, sz);
+}
+
+char *__wrap_strdup(char const *s) {
+    num_allocs++;
+    return __real_strdup(s);
+}
+
+//Cheap and deterministic, so every run sees the same stream
+static uint32_t rng_state = 0x12345678;
+static uint32_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//Which TID/TDEST encodings show up in the stream
+typedef enum _width_mix {
+    WIDTHS_NONE,    //No TID or TDEST
+    WIDTHS_SINGLE,  //Both packed into one word
+    WIDTHS_SPLIT,   //One word each
+    WIDTHS_MIX      //All of the above
+} width_mix;
+
+#define BENCH_NUM_GUVS 4 //Packets are spread over this many addresses
+
+//Appends one made-up packet to buf and returns its size in words
+static int gen_packet(uint32_t *buf, int receipt_pct, width_mix mix) {
+    int addr = rng() % BENCH_NUM_GUVS;
+
+    if (rng() % 100 < receipt_pct) {
+        //Random flags and dout_not_rdy_cnt
+        buf[0] = addr | (1 << DBG_GUV_ADDR_WIDTH) | (rng() & ~0x1FFFu);
+        return 1;
+    }
+
+    static int const single[][2] = {{4, 4}, {0, 8}, {16, 16}, {8, 0}};
+    static int const split[][2] = {{32, 32}, {20, 20}, {32, 1}};
+    int TID_width = 0, TDEST_width = 0;
+    int which = (mix == WIDTHS_MIX) ? rng() % 3 : mix;
+    if (which == WIDTHS_SINGLE) {
+        int i = rng() % 4;
+        TID_width = single[i][0];
+        TDEST_width = single[i][1];
+    } else if (which == WIDTHS_SPLIT) {
+        int i = rng() % 3;
+        TID_width = split[i][0];
+        TDEST_width = split[i][1];
+    }
+
+    int len = 1 + rng() % DBG_LOG_MAX_TDATA_BYTES;
+    int words = 0;
+    buf[words++] = addr | ((len - 1) << 13) | ((rng() & 1) << 19) | (TID_width << 20) | (TDEST_width << 26);
+
+    int sum = TID_width + TDEST_width;
+    if (sum > 32) {
+        buf[words++] = rng();
+        buf[words++] = rng();
+    } else if (sum > 0) {
+        buf[words++] = rng() & (sum == 32 ? ~0u : ((1u << sum) - 1));
+    }
+
+    int i;
+    for (i = 0; i < (len + 3)/4; i++) buf[words++] = rng();
+
+    return words;
+}
+
+static int cmp_double(void const *a, void const *b) {
+    double x = *(double const *)a, y = *(double const *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 5) {
+        fprintf(stderr, "Usage: bench [PACKETS] [RECEIPT_PERCENT] [MAX_READ_BYTES] [none|single|split|mix]\n");
+        return -1;
+    }
+
+    int num_packets = 1000000;
+    int receipt_pct = 20;
+    int max_read = 4096;
+    width_mix mix = WIDTHS_MIX;
+
+    if (argc >= 2 && (sscanf(argv[1], "%d", &num_packets) != 1 || num_packets < 1)) {
+        fprintf(stderr, "Could not parse packet count [%.32s]\n", argv[1]);
+        return -1;
+    }
+    if (argc >= 3 && (sscanf(argv[2], "%d", &receipt_pct) != 1 || receipt_pct < 0 || receipt_pct > 100)) {
+        fprintf(stderr, "Receipt percentage must be between 0 and 100\n");
+        return -1;
+    }
+    if (argc >= 4 && (sscanf(argv[3], "%d", &max_read) != 1 || max_read < 1 || max_read > 65536)) {
+        fprintf(stderr, "Max read size must be between 1 and 65536\n");
+        return -1;
+    }
+    if (argc >= 5) {
+        if (!strcmp(argv[4], "none")) mix = WIDTHS_NONE;
+        else if (!strcmp(argv[4], "single")) mix = WIDTHS_SINGLE;
+        else if (!strcmp(argv[4], "split")) mix = WIDTHS_SPLIT;
+        else if (!strcmp(argv[4], "mix")) mix = WIDTHS_MIX;
+        else {
+            fprintf(stderr, "Widths must be none, single, split or mix\n");
+            return -1;
+        }
+    }
+
+    //Make the whole stream up front so the generator isn't timed. Biggest
+    //packet is header + 2 TID/TDEST words + 16 TDATA words
+    uint32_t *stream = malloc(num_packets * 19 * sizeof(uint32_t));
+    if (stream == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    long stream_words = 0;
+    int i;
+    for (i = 0; i < num_packets; i++) {
+        stream_words += gen_packet(stream + stream_words, receipt_pct, mix);
+    }
+    long stream_len = stream_words * 4;
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+        perror("socketpair");
+        return -1;
+    }
+    fcntl(sv[0], F_SETFL, O_NONBLOCK);
+
+    fpga_connection_info *f = new_fpga_connection();
+    if (f == NULL) {
+        fprintf(stderr, "Could not allocate fpga_connection_info\n");
+        return -1;
+    }
+
+    //One sample per read_fpga_connection call that decoded something: the
+    //call's time divided by the packets it decoded. That's a mean over the
+    //read, not the latency of any one packet, so the percentiles we print
+    //are over reads. There can't be more samples than packets
+    int max_samples = num_packets;
+    double *samples = malloc(max_samples * sizeof(double));
+    if (samples == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    //Do the whole thing twice. The first pass creates the guvs and their
+    //log rings, which we don't want to count against the hot path
+    int pass;
+    for (pass = 0; pass < 2; pass++) {
+        unsigned long allocs_before = num_allocs;
+        unsigned long pkts_before = f->rx_receipts + f->rx_logs;
+        uint64_t total_ns = 0;
+        int num_samples = 0;
+        int num_calls = 0;
+
+        char const *p = (char const *) stream;
+        long left = stream_len;
+        while (left > 0) {
+            int amt = 1 + rng() % max_read;
+            if (amt > left) amt = left;
+            if (write(sv[1], p, amt) != amt) {
+                perror("write");
+                return -1;
+            }
+            p += amt;
+            left -= amt;
+
+            unsigned long pkts = f->rx_receipts + f->rx_logs;
+            uint64_t start = now_ns();
+            int rc = read_fpga_connection(f, sv[0]);
+            uint64_t elapsed = now_ns() - start;
+            if (rc < 0) {
+                fprintf(stderr, "read_fpga_connection: %s\n", f->error_str);
+                return -1;
+            }
+            num_calls++;
+            total_ns += elapsed;
+
+            pkts = f->rx_receipts + f->rx_logs - pkts;
+            if (pkts > 0 && num_samples < max_samples) {
+                samples[num_samples++] = (double) elapsed / pkts;
+            }
+        }
+
+        if (pass == 0) continue; //Warmup
+
+        unsigned long pkts = f->rx_receipts + f->rx_logs - pkts_before;
+        unsigned long allocs = num_allocs - allocs_before;
+        if (total_ns == 0) total_ns = 1;
+
+        qsort(samples, num_samples, sizeof(double), cmp_double);
+        double p50 = num_samples ? samples[num_samples/2] : 0;
+        double p99 = num_samples ? samples[(int)(num_samples*0.99)] : 0;
+
+        printf("%lu packets (%ld bytes) in %d reads of up to %d bytes\n", pkts, stream_len, num_calls, max_read);
+        printf("Throughput: %.1f MB/s, %.0f packets/s\n", stream_len*1e3/total_ns, pkts*1e9/total_ns);
+        printf("Per packet: %.1f ns mean\n", (double) total_ns/pkts);
+        printf("Per read mean ns/packet: %.1f p50, %.1f p99 (over %d reads)\n", p50, p99, num_samples);
+        printf("Allocations: %lu (%.4f per packet)\n", allocs, (double) allocs/pkts);
+    }
+
+    del_fpga_connection(f);
+    free(samples);
+    free(stream);
+    return 0;
+}
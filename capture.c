@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "capture.h"
+
+char const *const CAPTURE_SUCC = "success";
+char const *const CAPTURE_FULL = "capture file is full";
+char const *const CAPTURE_TOO_SMALL = "capture file size is too small";
+
+static uint64_t capture_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//Creates (or truncates) the file at path, preallocates size bytes and maps
+//it. Returns 0 on success, -1 on error (and sets c->error_str), or -2 if c
+//is NULL
+int init_capture(capture *c, char const *path, size_t size) {
+    if (c == NULL) return -2; //This is all we can do
+
+    c->map = NULL;
+    c->fd = -1;
+    c->pos = 0;
+    c->dropped = 0;
+    memset(c->seen, 0, sizeof(c->seen));
+
+    if (size < sizeof(capture_file_hdr) + CAPTURE_CHUNK_SZ(4)) {
+        c->error_str = CAPTURE_TOO_SMALL;
+        return -1;
+    }
+
+    c->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (c->fd < 0) {
+        c->error_str = strerror(errno);
+        return -1;
+    }
+
+    //Actually reserve the blocks now. Otherwise we could find out the disk
+    //is full by getting a SIGBUS halfway through a capture
+    int rc = posix_fallocate(c->fd, 0, size);
+    if (rc != 0) {
+        c->error_str = strerror(rc);
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+
+    //MAP_POPULATE takes the page faults up front, while the user is still
+    //waiting for the command to finish
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, c->fd, 0);
+    if (map == MAP_FAILED) {
+        c->error_str = strerror(errno);
+        close(c->fd);
+        c->fd = -1;
+        return -1;
+    }
+    c->map = map;
+    c->size = size;
+
+    capture_file_hdr *hdr = (capture_file_hdr *) c->map;
+    memset(hdr, 0, sizeof(capture_file_hdr));
+    memcpy(hdr->magic, CAPTURE_MAGIC, 8);
+    hdr->version = CAPTURE_VERSION;
+    hdr->hdr_len = sizeof(capture_file_hdr);
+    hdr->start_ns = capture_now_ns();
+    c->pos = sizeof(capture_file_hdr);
+
+    c->error_str = CAPTURE_SUCC;
+    return 0;
+}
+
+//Trims the file to the data actually written, then unmaps and closes it.
+//Returns 0 on success, -1 on error (and sets c->error_str), or -2 if c is
+//NULL. Gracefully ignores a capture that isn't open
+int deinit_capture(capture *c) {
+    if (c == NULL) return -2; //This is all we can do
+    if (c->map == NULL) return 0;
+
+    //The kernel will write back the dirty pages on its own time
+    munmap(c->map, c->size);
+    c->map = NULL;
+
+    int ret = 0;
+    if (ftruncate(c->fd, c->pos) < 0) {
+        c->error_str = strerror(errno);
+        ret = -1;
+    } else {
+        c->error_str = CAPTURE_SUCC;
+    }
+
+    close(c->fd);
+    c->fd = -1;
+    return ret;
+}
+
+//Appends one chunk holding the first len bytes described by iov, which
+//arrived at time ns (CLOCK_MONOTONIC). Returns 0 on success, or -1 if the
+//file is full (and sets c->error_str)
+int capture_write(capture *c, uint64_t ns, struct iovec const *iov, int iovcnt, int len) {
+    if (c->pos + CAPTURE_CHUNK_SZ(len) > c->size) {
+        c->dropped += len;
+        c->error_str = CAPTURE_FULL;
+        return -1;
+    }
+
+    capture_chunk_hdr *chunk = (capture_chunk_hdr *) (c->map + c->pos);
+    chunk->ns = ns;
+    chunk->len = len;
+    chunk->reserved = 0;
+
+    //Padding is already zero, since the file started out empty
+    char *dst = (char *) (chunk + 1);
+    int i;
+    for (i = 0; i < iovcnt && len > 0; i++) {
+        int amt = (iov[i].iov_len < len) ? iov[i].iov_len : len;
+        memcpy(dst, iov[i].iov_base, amt);
+        dst += amt;
+        len -= amt;
+    }
+
+    c->pos += CAPTURE_CHUNK_SZ(chunk->len);
+
+    //Keep the header current, so a capture is still readable if we crash
+    capture_file_hdr *hdr = (capture_file_hdr *) c->map;
+    hdr->data_len = c->pos - hdr->hdr_len;
+
+    return 0;
+}
+
+//Records the channel widths of the guv at addr in the file header, if it
+//isn't there already
+void capture_add_guv(capture *c, int addr, int TID_width, int TDEST_width) {
+    if (c == NULL || c->map == NULL) return;
+    if (addr < 0 || addr >= CAPTURE_MAX_ADDR) return; //Can't be a guv anyway
+    
+    uint64_t bit = 1ull << (addr % 64);
+    if (c->seen[addr/64] & bit) return;
+    c->seen[addr/64] |= bit;
+
+    capture_file_hdr *hdr = (capture_file_hdr *) c->map;
+    if (hdr->num_guvs == CAPTURE_MAX_GUVS) return; //Oh well
+
+    int i = hdr->num_guvs;
+    hdr->guvs[i].addr = addr;
+    hdr->guvs[i].TID_width = TID_width;
+    hdr->guvs[i].TDEST_width = TDEST_width;
+    hdr->num_guvs++;
+}
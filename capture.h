@@ -0,0 +1,101 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+//On-disk format for recordings of the raw FPGA->host byte stream. These
+//are what the replay tool eats, so decoder changes can be measured against
+//the exact same traffic every time.
+//
+//The file is a capture_file_hdr (followed by its guv table), then a list
+//of chunks. Each chunk is a capture_chunk_hdr followed by len bytes of
+//stream data, padded to a multiple of 8 bytes. A chunk is exactly what
+//one read() returned, so chunk boundaries don't line up with packets.
+//Everything is in host byte order, just like the stream itself.
+//
+//A file that doesn't start with CAPTURE_MAGIC is treated as a headerless
+//dump of the stream (e.g. what you'd get from netcat)
+
+#define CAPTURE_MAGIC "GUVCAP01"
+#define CAPTURE_VERSION 1
+#define CAPTURE_MAX_GUVS 64 //Size of the guv table in the file header
+#define CAPTURE_MAX_ADDR 1024 //Same as MAX_GUVS_PER_FPGA (which we can't
+                              //include from here)
+
+//Widths of the AXI Stream channels on one guv, in bits
+typedef struct _capture_guv_info {
+    uint16_t addr;
+    uint8_t TID_width;
+    uint8_t TDEST_width;
+} capture_guv_info;
+
+typedef struct _capture_file_hdr {
+    char magic[8];          //CAPTURE_MAGIC, not NUL-terminated
+    uint32_t version;       //CAPTURE_VERSION
+    uint32_t hdr_len;       //Offset of the first chunk
+    uint64_t start_ns;      //CLOCK_MONOTONIC when capture started
+    uint64_t data_len;      //Bytes of chunks that follow the header
+    uint32_t num_guvs;      //Valid entries in guvs[]
+    uint32_t reserved;
+    capture_guv_info guvs[CAPTURE_MAX_GUVS];
+} capture_file_hdr;
+
+typedef struct _capture_chunk_hdr {
+    uint64_t ns;            //CLOCK_MONOTONIC when the bytes were read
+    uint32_t len;           //Bytes of stream data (not counting padding)
+    uint32_t reserved;
+} capture_chunk_hdr;
+
+//Size of a chunk on disk, including its header and padding
+#define CAPTURE_CHUNK_SZ(len) (sizeof(capture_chunk_hdr) + (((len) + 7) & ~7u))
+
+#define CAPTURE_DEFAULT_MB 64
+
+//A capture in progress. The whole file is allocated and mapped when the
+//capture starts, so recording a chunk is just a memcpy; we never make a
+//system call (or wait for the disk) from the event loop. Once the file is
+//full, further data is counted and thrown away.
+typedef struct _capture {
+    int fd;
+    char *map;          //NULL when no capture is open
+    size_t size;        //Size of the file (and the mapping)
+    size_t pos;         //Where the next chunk goes
+    unsigned long dropped; //Bytes that didn't fit
+    
+    //Bit i is set once guv i is in the file header (or the header is full).
+    //capture_add_guv runs for every log, so this keeps it to a bit test
+    uint64_t seen[CAPTURE_MAX_ADDR/64];
+
+    //Error information
+    char const *error_str;
+} capture;
+
+//Creates (or truncates) the file at path, preallocates size bytes and maps
+//it. Returns 0 on success, -1 on error (and sets c->error_str), or -2 if c
+//is NULL
+int init_capture(capture *c, char const *path, size_t size);
+
+//Trims the file to the data actually written, then unmaps and closes it.
+//Returns 0 on success, -1 on error (and sets c->error_str), or -2 if c is
+//NULL. Gracefully ignores a capture that isn't open
+int deinit_capture(capture *c);
+
+//Appends one chunk holding the first len bytes described by iov, which
+//arrived at time ns (CLOCK_MONOTONIC). Returns 0 on success, or -1 if the
+//file is full (and sets c->error_str)
+int capture_write(capture *c, uint64_t ns, struct iovec const *iov, int iovcnt, int len);
+
+//Records the channel widths of the guv at addr in the file header, if it
+//isn't there already
+void capture_add_guv(capture *c, int addr, int TID_width, int TDEST_width);
+
+//////////////////////////////////////////////////
+//Error codes, which double as printable strings//
+//////////////////////////////////////////////////
+extern char const *const CAPTURE_SUCC; // = "success";
+extern char const *const CAPTURE_FULL; // = "capture file is full";
+extern char const *const CAPTURE_TOO_SMALL; // = "capture file size is too small";
+
+#endif
@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cellgrid.h"
+#include "textio.h"
+
+//////////////////////////////////////////////////
+//Error codes, which double as printable strings//
+//////////////////////////////////////////////////
+char const *const CELLGRID_SUCC = "success";
+char const *const CELLGRID_OOM = "out of memory";
+char const *const CELLGRID_BAD_SZ = "bad grid size";
+
+//What an empty cell looks like
+static cell const blank_cell = {
+    .ch = ' ',
+    .attr = 0,
+    .fg = CELL_DEFAULT_COLOUR,
+    .bg = CELL_DEFAULT_COLOUR
+};
+
+//Worst case for a single changed cell: the longer of a cursor move or
+//reprinting a small gap (see cellgrid_diff), plus an SGR sequence
+//("\e[0;1;4;7;37;47m") plus a 4-byte UTF-8 character
+#define CELLGRID_MAX_GAP 4
+#define CELLGRID_BYTES_PER_CELL (CELLGRID_MAX_GAP*4 + 16 + 4)
+
+static int same_attrs(cell const *a, cell const *b) {
+    return a->attr == b->attr && a->fg == b->fg && a->bg == b->bg;
+}
+
+static int same_cell(cell const *a, cell const *b) {
+    return a->ch == b->ch && same_attrs(a, b);
+}
+
+//Returns a newly allocated cellgrid covering the rect at x,y (screen
+//coordinates, 1-based) with size w,h, or NULL on error. Everything starts
+//out invalidated, so the first diff repaints the whole rect
+cellgrid* new_cellgrid(int x, int y, int w, int h) {
+    cellgrid *ret = calloc(1, sizeof(cellgrid));
+    if (ret == NULL) return NULL;
+
+    int rc = cellgrid_resize(ret, x, y, w, h);
+    if (rc < 0) {
+        del_cellgrid(ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+//Frees all memory used by g. Gracefully ignores NULL input
+void del_cellgrid(cellgrid *g) {
+    if (g == NULL) return;
+
+    if (g->front != NULL) free(g->front);
+    if (g->back != NULL) free(g->back);
+
+    free(g);
+}
+
+//Changes the area covered by g. The contents of both buffers are lost and
+//the whole grid is invalidated. Returns 0 on success, -1 on error (and sets
+//g->error_str), or -2 if g was NULL
+int cellgrid_resize(cellgrid *g, int x, int y, int w, int h) {
+    if (g == NULL) return -2; //This is all we can do
+
+    if (w < 0 || h < 0) {
+        g->error_str = CELLGRID_BAD_SZ;
+        return -1;
+    }
+
+    //Don't bother with realloc; the old contents are useless anyway
+    cell *front = malloc(w * h * sizeof(cell) + 1); //+1 so that w*h == 0
+    cell *back = malloc(w * h * sizeof(cell) + 1);  //is not a special case
+    if (front == NULL || back == NULL) {
+        if (front != NULL) free(front);
+        if (back != NULL) free(back);
+        g->error_str = CELLGRID_OOM;
+        return -1;
+    }
+
+    if (g->front != NULL) free(g->front);
+    if (g->back != NULL) free(g->back);
+    g->front = front;
+    g->back = back;
+
+    g->x = x;
+    g->y = y;
+    g->w = w;
+    g->h = h;
+
+    int i;
+    for (i = 0; i < w*h; i++) g->back[i] = blank_cell;
+    cellgrid_invalidate(g);
+
+    g->error_str = CELLGRID_SUCC;
+    return 0;
+}
+
+//Forget what the terminal is showing (e.g. because it was cleared or
+//resized behind our back). The next diff will repaint every cell.
+void cellgrid_invalidate(cellgrid *g) {
+    if (g == NULL) return;
+
+    //No real character is ever stored as 0, so this will never match
+    int i;
+    for (i = 0; i < g->w * g->h; i++) {
+        g->front[i] = blank_cell;
+        g->front[i].ch = 0;
+    }
+}
+
+//Stores ch at the cursor (if it's in the grid) and advances the cursor
+static void put_ch(cellgrid *g, uint32_t ch) {
+    if (g->cx >= 0 && g->cx < g->w && g->cy >= 0 && g->cy < g->h) {
+        cell *c = g->back + g->cy * g->w + g->cx;
+        *c = g->pen;
+        c->ch = ch;
+    }
+    g->cx++;
+}
+
+//Handles the final byte of a CSI sequence
+static void do_csi(cellgrid *g, char final) {
+    //Most sequences treat a missing or zero parameter as 1
+    int n = (g->params[0] == 0) ? 1 : g->params[0];
+
+    switch (final) {
+    case 'H':
+    case 'f': {
+        int row = (g->params[0] == 0) ? 1 : g->params[0];
+        int col = (g->num_params < 2 || g->params[1] == 0) ? 1 : g->params[1];
+        g->cy = row - g->y;
+        g->cx = col - g->x;
+        break;
+    }
+    case 'A':
+        g->cy -= n;
+        break;
+    case 'B':
+        g->cy += n;
+        break;
+    case 'C':
+        g->cx += n;
+        break;
+    case 'D':
+        g->cx -= n;
+        break;
+    case 'K': {
+        if (g->cy < 0 || g->cy >= g->h) break;
+
+        //0 is cursor to end, 1 is start to cursor, 2 is whole line
+        int from = (g->params[0] == 0) ? g->cx : 0;
+        int to = (g->params[0] == 1) ? g->cx + 1 : g->w;
+        if (from < 0) from = 0;
+        if (to > g->w) to = g->w;
+
+        //Erased cells get the background colour but nothing else
+        cell erased = blank_cell;
+        erased.bg = g->pen.bg;
+
+        int i;
+        for (i = from; i < to; i++) g->back[g->cy * g->w + i] = erased;
+        break;
+    }
+    case 'm': {
+        int i;
+        for (i = 0; i < g->num_params; i++) {
+            int p = g->params[i];
+            if (p == 0) {
+                g->pen = blank_cell;
+            } else if (p == 1) {
+                g->pen.attr |= CELL_BOLD;
+            } else if (p == 22) {
+                g->pen.attr &= ~CELL_BOLD;
+            } else if (p == 4) {
+                g->pen.attr |= CELL_UNDERLINE;
+            } else if (p == 24) {
+                g->pen.attr &= ~CELL_UNDERLINE;
+            } else if (p == 7) {
+                g->pen.attr |= CELL_REVERSE;
+            } else if (p == 27) {
+                g->pen.attr &= ~CELL_REVERSE;
+            } else if (p >= 30 && p <= 37) {
+                g->pen.fg = p - 30;
+            } else if (p == 39) {
+                g->pen.fg = CELL_DEFAULT_COLOUR;
+            } else if (p >= 40 && p <= 47) {
+                g->pen.bg = p - 40;
+            } else if (p == 49) {
+                g->pen.bg = CELL_DEFAULT_COLOUR;
+            }
+            //Anything else is ignored
+        }
+        break;
+    }
+    default:
+        //Not something our drawables use
+        break;
+    }
+}
+
+//Plays len bytes of terminal output into the back buffer. The pen and the
+//parser are reset first, so buf must be a whole frame. Writes outside the
+//grid are clipped. Returns 0 on success or -2 if g was NULL
+int cellgrid_feed(cellgrid *g, char const *buf, int len) {
+    if (g == NULL) return -2; //This is all we can do
+
+    g->pen = blank_cell;
+    g->cx = 0;
+    g->cy = 0;
+    g->state = CELLGRID_GROUND;
+
+    int i;
+    for (i = 0; i < len; i++) {
+        unsigned char c = buf[i];
+
+        switch (g->state) {
+        case CELLGRID_UTF8:
+            if ((c & 0xC0) == 0x80) {
+                g->utf8_ch |= (uint32_t) c << g->utf8_shift;
+                g->utf8_shift += 8;
+                if (--g->utf8_left == 0) {
+                    put_ch(g, g->utf8_ch);
+                    g->state = CELLGRID_GROUND;
+                }
+                break;
+            }
+            //Malformed. Drop the partial character and treat this byte
+            //as if it came in fresh
+            g->state = CELLGRID_GROUND;
+            //Fallthrough
+        case CELLGRID_GROUND:
+            if (c == '\e') {
+                g->state = CELLGRID_ESC;
+            } else if (c < 0x20 || c == 0x7F) {
+                //Control characters are not used by our drawables
+            } else if (c < 0x80) {
+                put_ch(g, c);
+            } else {
+                //Start of a multi-byte character
+                if ((c & 0xE0) == 0xC0) g->utf8_left = 1;
+                else if ((c & 0xF0) == 0xE0) g->utf8_left = 2;
+                else if ((c & 0xF8) == 0xF0) g->utf8_left = 3;
+                else break; //Stray continuation byte; ignore it
+
+                g->utf8_ch = c;
+                g->utf8_shift = 8;
+                g->state = CELLGRID_UTF8;
+            }
+            break;
+        case CELLGRID_ESC:
+            if (c == '[') {
+                g->num_params = 1;
+                g->params[0] = 0;
+                g->state = CELLGRID_CSI;
+            } else {
+                //Some other escape sequence. Ignore it
+                g->state = CELLGRID_GROUND;
+            }
+            break;
+        case CELLGRID_CSI:
+            if (c >= '0' && c <= '9') {
+                int *p = g->params + g->num_params - 1;
+                *p = *p * 10 + (c - '0');
+            } else if (c == ';') {
+                if (g->num_params < CELLGRID_MAX_PARAMS) {
+                    g->params[g->num_params++] = 0;
+                }
+            } else if (c >= 0x40 && c <= 0x7E) {
+                do_csi(g, c);
+                g->state = CELLGRID_GROUND;
+            }
+            //Private markers (like the '?' in "\e[?1049h") and
+            //intermediate bytes are ignored
+            break;
+        }
+    }
+
+    return 0;
+}
+
+//Returns how many bytes are needed (can be an upper bound) to hold the
+//output of cellgrid_diff
+int cellgrid_diff_sz(cellgrid const *g) {
+    if (g == NULL) return -1;
+
+    int changed = 0;
+    int i;
+    for (i = 0; i < g->w * g->h; i++) {
+        if (!same_cell(g->front + i, g->back + i)) changed++;
+    }
+
+    if (changed == 0) return 0;
+
+    return changed * CELLGRID_BYTES_PER_CELL + 8; //Room for final SGR reset
+}
+
+//Emits the SGR sequence that sets the terminal's attributes to match c
+static int sgr_cmd(char *buf, cell const *c) {
+    char *buf_saved = buf;
+
+    *buf++ = '\e'; *buf++ = '['; *buf++ = '0';
+    if (c->attr & CELL_BOLD) {
+        *buf++ = ';'; *buf++ = '1';
+    }
+    if (c->attr & CELL_UNDERLINE) {
+        *buf++ = ';'; *buf++ = '4';
+    }
+    if (c->attr & CELL_REVERSE) {
+        *buf++ = ';'; *buf++ = '7';
+    }
+    if (c->fg != CELL_DEFAULT_COLOUR) {
+        *buf++ = ';'; *buf++ = '3'; *buf++ = '0' + c->fg;
+    }
+    if (c->bg != CELL_DEFAULT_COLOUR) {
+        *buf++ = ';'; *buf++ = '4'; *buf++ = '0' + c->bg;
+    }
+    *buf++ = 'm';
+
+    return buf - buf_saved;
+}
+
+static int put_glyph(char *buf, uint32_t ch) {
+    int len = 0;
+    do {
+        buf[len++] = ch & 0xFF;
+        ch >>= 8;
+    } while (ch);
+
+    return len;
+}
+
+//Writes the escape sequences that take the terminal from the front buffer
+//to the back buffer into buf, then updates the front buffer to match.
+//Returns number of bytes written (which is 0 if nothing changed), -1 on
+//error (and sets g->error_str), or -2 if g was NULL
+int cellgrid_diff(cellgrid *g, char *buf) {
+    if (g == NULL) return -2; //This is all we can do
+
+    char *buf_saved = buf;
+
+    //Assume the terminal starts off with default attributes, since we
+    //always put them back when we're done
+    cell pen = blank_cell;
+
+    //Where the terminal's cursor is, in grid coordinates. At first, we
+    //have no idea
+    int cx = -1, cy = -1;
+
+    int r, c;
+    for (r = 0; r < g->h; r++) {
+        cell *front = g->front + r * g->w;
+        cell *back = g->back + r * g->w;
+
+        for (c = 0; c < g->w; c++) {
+            if (same_cell(front + c, back + c)) continue;
+
+            if (cy != r || cx != c) {
+                //If we're only a few cells behind on the same row, it's
+                //cheaper to just print over the (unchanged) cells in
+                //between than to move the cursor. This is only safe if
+                //they use the current pen
+                int gap_ok = (cy == r && cx < c && c - cx <= CELLGRID_MAX_GAP);
+                int i;
+                for (i = cx; gap_ok && i < c; i++) {
+                    if (!same_attrs(back + i, &pen)) gap_ok = 0;
+                }
+
+                if (gap_ok) {
+                    for (i = cx; i < c; i++) buf += put_glyph(buf, back[i].ch);
+                } else {
+                    buf += cursor_pos_cmd(buf, g->x + c, g->y + r);
+                }
+            }
+
+            if (!same_attrs(back + c, &pen)) {
+                buf += sgr_cmd(buf, back + c);
+                pen = back[c];
+            }
+
+            buf += put_glyph(buf, back[c].ch);
+            front[c] = back[c];
+
+            cx = c + 1;
+            cy = r;
+        }
+    }
+
+    //Leave the terminal the way we found it
+    if (!same_attrs(&pen, &blank_cell)) {
+        *buf++ = '\e'; *buf++ = '['; *buf++ = 'm';
+    }
+
+    g->error_str = CELLGRID_SUCC;
+    return buf - buf_saved;
+}
@@ -0,0 +1,104 @@
+#ifndef CELLGRID_H
+#define CELLGRID_H 1
+
+#include <stdint.h>
+
+//An off-screen copy of (part of) the terminal. Drawables still write the
+//same escape sequences as always, but instead of sending them straight to
+//the terminal we play them into the back buffer. Then we compare it to the
+//front buffer (what we think the terminal is showing) and only send the
+//cells that actually changed. Same idea as ncurses' doupdate().
+//
+//Only the handful of sequences that our drawables actually use are
+//understood:
+//  - CSI y;x H (cursor position)
+//  - CSI n A/B/C/D (cursor movement)
+//  - CSI K (erase to end of line)
+//  - CSI ... m with 0, 1, 22, 4, 24, 7, 27, 30-37, 39, 40-47, 49
+//Anything else is quietly ignored. Every UTF-8 character is assumed to be
+//one column wide (true for the box-drawing characters we use).
+
+#define CELL_BOLD       1
+#define CELL_UNDERLINE  2
+#define CELL_REVERSE    4
+
+#define CELL_DEFAULT_COLOUR 9 //Matches the SGR codes 39 and 49
+
+typedef struct _cell {
+    uint32_t ch;    //Raw UTF-8 bytes, first byte in the lowest 8 bits
+    uint8_t attr;   //OR of CELL_BOLD, CELL_UNDERLINE, CELL_REVERSE
+    uint8_t fg, bg; //0 to 7, or CELL_DEFAULT_COLOUR
+} cell;
+
+//Parser states
+typedef enum _cellgrid_state {
+    CELLGRID_GROUND,
+    CELLGRID_ESC,
+    CELLGRID_CSI,
+    CELLGRID_UTF8
+} cellgrid_state;
+
+#define CELLGRID_MAX_PARAMS 16
+typedef struct _cellgrid {
+    //Screen coordinates (1-based, like the cursor_pos_cmd ones) of the
+    //top-left cell, and size of the grid
+    int x, y, w, h;
+
+    cell *front; //What we believe the terminal is showing
+    cell *back; //What we want it to show
+
+    //Interpreter state. The pen is the attributes that will be given to the
+    //next printed character
+    int cx, cy; //Cursor position, relative to the grid
+    cell pen;
+    cellgrid_state state;
+    int params[CELLGRID_MAX_PARAMS];
+    int num_params;
+    uint32_t utf8_ch; //Partially received UTF-8 character
+    int utf8_left; //Continuation bytes still expected
+    int utf8_shift;
+
+    //Error information
+    char const *error_str;
+} cellgrid;
+
+//Returns a newly allocated cellgrid covering the rect at x,y (screen
+//coordinates, 1-based) with size w,h, or NULL on error. Everything starts
+//out invalidated, so the first diff repaints the whole rect
+cellgrid* new_cellgrid(int x, int y, int w, int h);
+
+//Frees all memory used by g. Gracefully ignores NULL input
+void del_cellgrid(cellgrid *g);
+
+//Changes the area covered by g. The contents of both buffers are lost and
+//the whole grid is invalidated. Returns 0 on success, -1 on error (and sets
+//g->error_str), or -2 if g was NULL
+int cellgrid_resize(cellgrid *g, int x, int y, int w, int h);
+
+//Forget what the terminal is showing (e.g. because it was cleared or
+//resized behind our back). The next diff will repaint every cell.
+void cellgrid_invalidate(cellgrid *g);
+
+//Plays len bytes of terminal output into the back buffer. The pen and the
+//parser are reset first, so buf must be a whole frame. Writes outside the
+//grid are clipped. Returns 0 on success or -2 if g was NULL
+int cellgrid_feed(cellgrid *g, char const *buf, int len);
+
+//Returns how many bytes are needed (can be an upper bound) to hold the
+//output of cellgrid_diff
+int cellgrid_diff_sz(cellgrid const *g);
+
+//Writes the escape sequences that take the terminal from the front buffer
+//to the back buffer into buf, then updates the front buffer to match.
+//Returns number of bytes written (which is 0 if nothing changed), -1 on
+//error (and sets g->error_str), or -2 if g was NULL
+int cellgrid_diff(cellgrid *g, char *buf);
+
+//////////////////////////////////////////////////
+//Error codes, which double as printable strings//
+//////////////////////////////////////////////////
+extern char const *const CELLGRID_SUCC; // = "success";
+extern char const *const CELLGRID_OOM; // = "out of memory";
+extern char const *const CELLGRID_BAD_SZ; // = "bad grid size";
+
+#endif
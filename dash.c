@@ -0,0 +1,385 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dash.h"
+#include "dbg_guv.h"
+#include "textio.h"
+
+char const *const DASH_SUCC = "success";
+char const *const DASH_OOM = "out of memory";
+
+//Statically initialize a guv_dash for FPGA f. Returns 0 on success, or -2
+//if s is NULL
+int init_guv_dash(guv_dash *s, struct _fpga_connection_info *f) {
+    if (s == NULL) return -2; //This is all we can do
+
+    memset(s, 0, sizeof(guv_dash));
+    s->f = f;
+    s->need_redraw = 1;
+
+    s->error_str = DASH_SUCC;
+    return 0;
+}
+
+//Frees everything the dashboard allocated. Gracefully ignores NULL input
+void deinit_guv_dash(guv_dash *s) {
+    if (s == NULL) return;
+
+    free(s->cells);
+    free(s->order);
+    free(s->dirty);
+    s->cells = NULL;
+    s->order = NULL;
+    s->dirty = NULL;
+    s->num_cells = 0;
+    s->num_dirty = 0;
+}
+
+//Sets up the per-guv arrays the first time the dashboard is drawn. Returns
+//0 on success, or -1 if out of memory (and sets s->error_str)
+static int dash_alloc(guv_dash *s) {
+    if (s->cells != NULL) return 0;
+
+    s->cells = calloc(MAX_GUVS_PER_FPGA, sizeof(dash_cell));
+    s->order = malloc(MAX_GUVS_PER_FPGA * sizeof(int));
+    s->dirty = malloc(MAX_GUVS_PER_FPGA * sizeof(int));
+    if (s->cells == NULL || s->order == NULL || s->dirty == NULL) {
+        deinit_guv_dash(s);
+        s->error_str = DASH_OOM;
+        return -1;
+    }
+
+    int i;
+    for (i = 0; i < MAX_GUVS_PER_FPGA; i++) {
+        s->cells[i].pos = -1;
+        if (s->f->guvs[i] != NULL) s->cells[i].flits_then = s->f->guvs[i]->stats.flits;
+    }
+    s->order_stale = 1;
+    s->need_redraw = 1;
+
+    return 0;
+}
+
+//Tells the dashboard that the guv at addr was just created
+void dash_guv_added(guv_dash *s, int addr) {
+    if (s == NULL || s->cells == NULL) return;
+
+    dbg_guv *g = s->f->guvs[addr];
+    s->cells[addr].flits_then = (g != NULL) ? g->stats.flits : 0;
+    s->order_stale = 1;
+    s->need_redraw = 1;
+}
+
+//Tells the dashboard that something about the guv at addr (its status, its
+//name, or its traffic) changed
+void dash_guv_changed(guv_dash *s, int addr) {
+    if (s->cells == NULL) return; //Nobody has looked at the dashboard yet
+
+    dash_cell *c = s->cells + addr;
+    if (c->dirty) return;
+    c->dirty = 1;
+    s->dirty[s->num_dirty++] = addr;
+
+    //Not every log makes its guv ask for a frame (e.g. if the filter threw
+    //it away), so ask for one ourselves
+    if (s->num_dirty == 1) twm_request_redraw();
+}
+
+//Puts the guvs that exist into the grid in address order, keeping the
+//same guv selected
+static void dash_rebuild_order(guv_dash *s) {
+    int sel_addr = (s->sel < s->num_cells) ? s->order[s->sel] : -1;
+
+    s->num_cells = 0;
+    int i;
+    for (i = 0; i < MAX_GUVS_PER_FPGA; i++) {
+        if (s->f->guvs[i] == NULL) {
+            s->cells[i].pos = -1;
+            continue;
+        }
+        if (i == sel_addr) s->sel = s->num_cells;
+        s->cells[i].pos = s->num_cells;
+        s->order[s->num_cells++] = i;
+    }
+
+    s->order_stale = 0;
+    s->need_redraw = 1;
+}
+
+//Works out the grid for a w by h pane, and scrolls so that the selected
+//cell is on screen. Anything that moves cells around means drawing
+//everything again
+static void dash_layout(guv_dash *s, int w, int h) {
+    if (s->order_stale) dash_rebuild_order(s);
+
+    int cols = (w + 1) / (DASH_CELL_W + 1);
+    if (cols < 1) cols = 1;
+    if (w != s->w || h != s->h || cols != s->cols) {
+        s->w = w;
+        s->h = h;
+        s->cols = cols;
+        s->need_redraw = 1;
+    }
+
+    if (s->sel >= s->num_cells) s->sel = s->num_cells - 1;
+    if (s->sel < 0) s->sel = 0;
+
+    int rows = h - 1; //The first line is the title bar
+    int sel_row = s->sel / cols;
+    int top = s->top;
+    if (sel_row < top) top = sel_row;
+    if (rows > 0 && sel_row >= top + rows) top = sel_row - rows + 1;
+    if (top != s->top) {
+        s->top = top;
+        s->need_redraw = 1;
+    }
+}
+
+//Works out everyone's rate over the last period, and marks the cells whose
+//rate or activity marker might have changed
+static void dash_update_rates(guv_dash *s, uint64_t now) {
+    uint64_t dt = now - s->rate_ns;
+
+    //If nothing asked for a frame in a while (because everything was
+    //quiet), this averages over however long that was. That's still the
+    //right number, and it means the flits that woke us up aren't lost
+    int first = (s->rate_ns == 0);
+
+    s->moving = 0;
+    int i;
+    for (i = 0; i < s->num_cells; i++) {
+        int addr = s->order[i];
+        dash_cell *c = s->cells + addr;
+        uint64_t flits = s->f->guvs[addr]->stats.flits;
+        double rate = first ? 0 : (flits - c->flits_then) * 1e9 / dt;
+
+        if (flits != c->flits_then || rate != c->rate) dash_guv_changed(s, addr);
+        if (flits != c->flits_then || rate != 0) s->moving = 1;
+
+        c->rate = rate;
+        c->flits_then = flits;
+    }
+
+    s->rate_ns = now;
+}
+
+//Prints x in at most 5 characters
+static void dash_fmt_rate(char *buf, double x) {
+    if (x <= 0) strcpy(buf, "-");
+    else if (x < 10) sprintf(buf, "%.1f", x);
+    else if (x < 1e3) sprintf(buf, "%.0f", x);
+    else if (x < 1e4) sprintf(buf, "%.1fk", x/1e3);
+    else if (x < 1e6) sprintf(buf, "%.0fk", x/1e3);
+    else if (x < 1e7) sprintf(buf, "%.1fM", x/1e6);
+    else if (x < 1e9) sprintf(buf, "%.0fM", x/1e6);
+    else snprintf(buf, 6, "%.1fG", x/1e9);
+}
+
+//Fills txt (which needs room for DASH_CELL_W + 1 chars) with the text of
+//the cell for the guv at addr
+static void dash_fmt_cell(guv_dash *s, int addr, char *txt) {
+    dbg_guv *g = s->f->guvs[addr];
+    dash_cell *c = s->cells + addr;
+
+    char status[8];
+    dbg_guv_status(g, status);
+    char rate[16];
+    dash_fmt_rate(rate, c->rate);
+
+    //Default names are "pointer[addr]", so if a name doesn't fit, keep the
+    //end of it
+    char name[DASH_NAME_W + 1];
+    int len = strlen(g->name);
+    if (len > DASH_NAME_W) {
+        name[0] = '~';
+        strcpy(name + 1, g->name + len - (DASH_NAME_W - 1));
+    } else {
+        strcpy(name, g->name);
+    }
+
+    sprintf(txt, "%-*s %s %5.5s%c", DASH_NAME_W, name,
+        status + 1, rate, (g->stats.flits != c->flits_then) ? '*' : ' '
+    );
+}
+
+//Puts the cell's text into buf (cw chars of it), in inverted video if it's
+//the selected one. Returns the number of bytes added
+static int dash_put_cell(guv_dash *s, int pos, int cw, char *buf) {
+    dash_cell *c = s->cells + s->order[pos];
+    char *buf_saved = buf;
+
+    int sel = (pos == s->sel);
+    if (sel) {
+        *buf++ = '\e'; *buf++ = '['; *buf++ = '7'; *buf++ = 'm';
+    }
+    memcpy(buf, c->shown, cw);
+    buf += cw;
+    if (sel) {
+        *buf++ = '\e'; *buf++ = '['; *buf++ = '2'; *buf++ = '7'; *buf++ = 'm';
+    }
+
+    c->shown_sel = sel;
+    return buf - buf_saved;
+}
+
+//Returns number of bytes added into buf, or -1 on error.
+int draw_fn_guv_dash(void *item, int x, int y, int w, int h, char *buf) {
+    guv_dash *s = (guv_dash*) item;
+    if (!s) return -1;
+
+    //draw_sz always runs first (with the same size), and it's the one that
+    //allocates everything and lays out the grid
+    if (s->cells == NULL) return 0;
+    if (!s->need_redraw && s->num_dirty == 0) return 0; //Nothing to draw!
+
+    char *buf_saved = buf;
+    int rows = h - 1;
+    int cw = (w < DASH_CELL_W) ? w : DASH_CELL_W;
+    int i;
+
+    if (s->need_redraw) {
+        //Title bar, in inverted video
+        buf += cursor_pos_cmd(buf, x, y);
+        *buf++ = '\e'; *buf++ = '['; *buf++ = '7'; *buf++ = 'm';
+        char title[80];
+        snprintf(title, sizeof(title), "%s dashboard (%d guvs)",
+            s->f->name ? s->f->name : "", s->num_cells
+        );
+        int incr;
+        sprintf(buf, "%-*.*s%n", w, w, title, &incr);
+        buf += incr;
+        *buf++ = '\e'; *buf++ = '['; *buf++ = '2'; *buf++ = '7'; *buf++ = 'm';
+
+        //Then every row of the grid that fits, with blanks after the last
+        //cell
+        for (i = 0; i < rows; i++) {
+            buf += cursor_pos_cmd(buf, x, y + 1 + i);
+            int left = w;
+            int col;
+            for (col = 0; col < s->cols; col++) {
+                int pos = (s->top + i) * s->cols + col;
+                if (pos >= s->num_cells) break;
+
+                dash_fmt_cell(s, s->order[pos], s->cells[s->order[pos]].shown);
+                buf += dash_put_cell(s, pos, cw, buf);
+                left -= cw;
+                if (left > 0) {
+                    *buf++ = ' ';
+                    left--;
+                }
+            }
+            memset(buf, ' ', left);
+            buf += left;
+        }
+
+        //That took care of anything that was dirty
+        for (i = 0; i < s->num_dirty; i++) s->cells[s->dirty[i]].dirty = 0;
+        s->num_dirty = 0;
+        s->need_redraw = 0;
+
+        return buf - buf_saved;
+    }
+
+    //Otherwise, only send the cells whose text actually changed
+    for (i = 0; i < s->num_dirty; i++) {
+        int addr = s->dirty[i];
+        dash_cell *c = s->cells + addr;
+        c->dirty = 0;
+
+        int pos = c->pos;
+        if (pos < 0) continue; //Not in the grid yet
+        int row = pos / s->cols - s->top;
+        if (row < 0 || row >= rows) continue; //Scrolled off
+
+        char txt[DASH_CELL_W + 1];
+        dash_fmt_cell(s, addr, txt);
+        if (!strcmp(txt, c->shown) && c->shown_sel == (pos == s->sel)) continue;
+        strcpy(c->shown, txt);
+
+        int col = pos % s->cols;
+        buf += cursor_pos_cmd(buf, x + col * (DASH_CELL_W + 1), y + 1 + row);
+        buf += dash_put_cell(s, pos, cw, buf);
+    }
+    s->num_dirty = 0;
+
+    return buf - buf_saved;
+}
+
+//Returns how many bytes are needed (can be an upper bound) to draw the
+//dashboard given the size. This is also where rates get updated
+int draw_sz_guv_dash(void *item, int w, int h) {
+    guv_dash *s = (guv_dash*) item;
+    if (!s) return -1;
+
+    if (dash_alloc(s) < 0) return -1;
+
+    //Nobody polls us, so ask to be woken up for the next rate update. Once
+    //all the rates have gone back to zero, we can sleep
+    uint64_t now = dbg_log_now_ns();
+    if (s->num_dirty > 0) s->moving = 1; //Something happened since then
+    if (now - s->rate_ns >= DASH_PERIOD_NS) dash_update_rates(s, now);
+    if (s->moving) twm_request_redraw_in(s->rate_ns + DASH_PERIOD_NS - now);
+
+    dash_layout(s, w, h);
+
+    int cell_sz = 10 + DASH_CELL_W + 9; //Cursor, text, and inverting it
+    if (s->need_redraw) {
+        return 10 + 9 + w + (h - 1) * (10 + w + 9);
+    }
+    return s->num_dirty * cell_sz;
+}
+
+//Tells us that we should redraw, probably because we moved to another
+//area of the screen
+void trigger_redraw_guv_dash(void *item) {
+    guv_dash *s = (guv_dash*) item;
+    if (!s) return;
+
+    s->need_redraw = 1;
+}
+
+//Moves the selection by amount cells (TWM_LEFT/TWM_RIGHT) or rows
+//(TWM_UP/TWM_DOWN). Gracefully ignores NULL input
+void dash_move_sel(guv_dash *s, twm_dir dir, int amount) {
+    if (s == NULL || s->num_cells == 0) return;
+
+    int sel = s->sel;
+    switch (dir) {
+    case TWM_UP:
+        sel -= amount * s->cols;
+        break;
+    case TWM_DOWN:
+        sel += amount * s->cols;
+        break;
+    case TWM_LEFT:
+        sel -= amount;
+        break;
+    case TWM_RIGHT:
+        sel += amount;
+        break;
+    default:
+        return;
+    }
+    if (sel >= s->num_cells) sel = s->num_cells - 1;
+    if (sel < 0) sel = 0;
+    if (sel == s->sel) return;
+
+    //Both cells change colour
+    dash_guv_changed(s, s->order[s->sel]);
+    dash_guv_changed(s, s->order[sel]);
+    s->sel = sel;
+    twm_request_redraw();
+}
+
+//Returns the selected guv, or NULL if there isn't one
+struct _dbg_guv *dash_selected(guv_dash *s) {
+    if (s == NULL || s->num_cells == 0) return NULL;
+    return s->f->guvs[s->order[s->sel]];
+}
+
+draw_operations const guv_dash_draw_ops = {
+    draw_fn_guv_dash,
+    draw_sz_guv_dash,
+    trigger_redraw_guv_dash,
+    NULL //No exit function needed
+};
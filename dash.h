@@ -0,0 +1,106 @@
+#ifndef DASH_H
+#define DASH_H 1
+
+#include <stdint.h>
+#include "twm.h"
+
+//A dashboard shows every guv on one FPGA as a little cell in a grid:
+//
+//    name       F0PLDV  1.2k*
+//
+//That's the guv's name (or the end of it, if it's too long), the same
+//status icons as in its title bar, how many flits per second it logged
+//over the last period, and a '*' if it logged anything since then. One
+//pane like this goes a lot further than a full dbg_guv pane per address.
+//
+//Receipts and logs only mark the guv's cell as dirty (which is a couple of
+//compares once it's already dirty), and a frame only looks at the dirty
+//cells. Each cell remembers what it last put on the screen, so a cell is
+//only sent again if its text actually changed. Nothing is allocated until
+//the dashboard is first drawn, so FPGAs without one don't pay anything.
+
+#define DASH_NAME_W 10
+#define DASH_CELL_W 24 //Name, space, 6 status icons, space, 5-char rate, '*'
+#define DASH_PERIOD_NS 1000000000ull //How often rates are worked out
+
+//Same circular definition trick as in dbg_guv.h
+struct _fpga_connection_info;
+struct _dbg_guv;
+
+typedef struct _dash_cell {
+    int pos;    //Where this guv is in the grid, or -1 if it doesn't exist
+    int dirty;  //Already on the dirty list
+    char shown[DASH_CELL_W + 1]; //What's on the screen right now
+    int shown_sel; //Whether it was drawn as the selected cell
+    uint64_t flits_then; //The guv's flit count at the last rate update
+    double rate; //Flits per second over the last period
+} dash_cell;
+
+typedef struct _guv_dash {
+    struct _fpga_connection_info *f;
+
+    //These are all NULL until the first draw. cells is indexed by guv
+    //address, order has the addresses of the guvs in the grid (in order),
+    //and dirty lists the addresses of the cells that need another look
+    dash_cell *cells;
+    int *order;
+    int num_cells;
+    int *dirty;
+    int num_dirty;
+    int order_stale; //A guv was created, so order has to be rebuilt
+
+    //Display information
+    int need_redraw; //Everything, not just the dirty cells
+    int sel; //Position of the selected cell
+    int top; //First row of the grid that's on screen
+    int w, h, cols; //Size at the last draw
+
+    //Rates
+    uint64_t rate_ns; //When they were last worked out
+    int moving; //Some rate is (or is about to stop being) nonzero
+
+    //Error information
+    char const *error_str;
+} guv_dash;
+
+//Statically initialize a guv_dash for FPGA f. Returns 0 on success, or -2
+//if s is NULL
+int init_guv_dash(guv_dash *s, struct _fpga_connection_info *f);
+
+//Frees everything the dashboard allocated. Gracefully ignores NULL input
+void deinit_guv_dash(guv_dash *s);
+
+//Tells the dashboard that the guv at addr was just created
+void dash_guv_added(guv_dash *s, int addr);
+
+//Tells the dashboard that something about the guv at addr (its status, its
+//name, or its traffic) changed
+void dash_guv_changed(guv_dash *s, int addr);
+
+//Moves the selection by amount cells (TWM_LEFT/TWM_RIGHT) or rows
+//(TWM_UP/TWM_DOWN). Gracefully ignores NULL input
+void dash_move_sel(guv_dash *s, twm_dir dir, int amount);
+
+//Returns the selected guv, or NULL if there isn't one
+struct _dbg_guv *dash_selected(guv_dash *s);
+
+//Returns number of bytes added into buf, or -1 on error.
+int draw_fn_guv_dash(void *item, int x, int y, int w, int h, char *buf);
+
+//Returns how many bytes are needed (can be an upper bound) to draw the
+//dashboard given the size. This is also where rates get updated
+int draw_sz_guv_dash(void *item, int w, int h);
+
+//Tells us that we should redraw, probably because we moved to another
+//area of the screen
+void trigger_redraw_guv_dash(void *item);
+
+extern draw_operations const guv_dash_draw_ops;
+
+//////////////////////////////////////////////////
+//Error codes, which double as printable strings//
+//////////////////////////////////////////////////
+extern char const *const DASH_SUCC; // = "success";
+extern char const *const DASH_OOM; // = "out of memory";
+
+#endif
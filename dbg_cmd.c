@@ -488,6 +488,554 @@ static int parse_name_cmd(dbg_cmd *dest, char const *str) {
     return num_read;
 }
 
+static int parse_txlimit_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    //Try reading a string into dest->id
+    int rc = parse_strn(dest->id, MAX_STR_PARAM_SIZE, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_TXLIMIT_USAGE;
+        return -1;
+    }
+    int num_read = rc;
+    str += rc;
+    
+    rc = parse_param(dest, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_TXLIMIT_USAGE;
+        return -1;
+    }
+    num_read += rc;
+    str += rc;
+    
+    rc = parse_eos(dest, str);
+    if (rc < 0) {
+        return -1; //dest->error_str already set
+    }
+    num_read += rc;
+    
+    dest->type = CMD_TXLIMIT;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+static int parse_capture_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    //Read the FPGA name
+    int rc = parse_strn(dest->id, MAX_STR_PARAM_SIZE, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_CAPTURE_USAGE;
+        return -1;
+    }
+    int num_read = rc;
+    str += rc;
+    
+    //Read the filename (or "off")
+    rc = parse_strn(dest->path, MAX_STR_PARAM_SIZE, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_CAPTURE_USAGE;
+        return -1;
+    }
+    num_read += rc;
+    str += rc;
+    
+    //Size is optional
+    dest->has_param = 0;
+    while (isspace(*str)) {
+        str++;
+        num_read++;
+    }
+    if (*str != '\0') {
+        rc = parse_param(dest, str);
+        if (rc < 0) {
+            dest->error_str = DBG_CMD_CAPTURE_USAGE;
+            return -1;
+        }
+        dest->has_param = 1;
+        num_read += rc;
+        str += rc;
+    }
+    
+    rc = parse_eos(dest, str);
+    if (rc < 0) {
+        return -1; //dest->error_str already set
+    }
+    num_read += rc;
+    
+    dest->type = CMD_CAPTURE;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+static int parse_iothread_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    //Read the FPGA name
+    int rc = parse_strn(dest->id, MAX_STR_PARAM_SIZE, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_IOTHREAD_USAGE;
+        return -1;
+    }
+    int num_read = rc;
+    str += rc;
+    
+    //Read "on" or "off" into param
+    char onoff[8];
+    rc = parse_strn(onoff, sizeof(onoff) - 1, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_IOTHREAD_USAGE;
+        return -1;
+    }
+    if (!strcmp(onoff, "on")) {
+        dest->param = 1;
+    } else if (!strcmp(onoff, "off")) {
+        dest->param = 0;
+    } else {
+        dest->error_str = DBG_CMD_IOTHREAD_USAGE;
+        return -1;
+    }
+    num_read += rc;
+    str += rc;
+    
+    rc = parse_eos(dest, str);
+    if (rc < 0) {
+        return -1; //dest->error_str already set
+    }
+    num_read += rc;
+    
+    dest->type = CMD_IOTHREAD;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+static int parse_time_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    //Read the mode into param
+    char mode[8];
+    int rc = parse_strn(mode, sizeof(mode) - 1, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_TIME_USAGE;
+        return -1;
+    }
+    if (!strcmp(mode, "abs")) {
+        dest->param = DBG_LOG_TIME_ABS;
+    } else if (!strcmp(mode, "rel")) {
+        dest->param = DBG_LOG_TIME_REL;
+    } else if (!strcmp(mode, "delta")) {
+        dest->param = DBG_LOG_TIME_DELTA;
+    } else {
+        dest->error_str = DBG_CMD_TIME_USAGE;
+        return -1;
+    }
+    int num_read = rc;
+    str += rc;
+    
+    rc = parse_eos(dest, str);
+    if (rc < 0) {
+        return -1; //dest->error_str already set
+    }
+    num_read += rc;
+    
+    dest->type = CMD_TIME;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+//The filter expression itself is compiled by the filter code, so all we
+//do here is hang on to it
+static int parse_filter_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    int num_read = 0;
+    while (isspace(*str)) {
+        str++;
+        num_read++;
+    }
+    if (*str == '\0') {
+        dest->error_str = DBG_CMD_FILTER_USAGE;
+        return -1;
+    }
+    
+    dest->rest = str;
+    num_read += strlen(str);
+    
+    dest->type = CMD_FILTER;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+static int parse_scrollback_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    int rc = parse_param(dest, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_SCROLLBACK_USAGE;
+        return -1;
+    }
+    int num_read = rc;
+    str += rc;
+    
+    rc = parse_eos(dest, str);
+    if (rc < 0) {
+        return -1; //dest->error_str already set
+    }
+    num_read += rc;
+    
+    dest->type = CMD_SCROLLBACK;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+static int parse_history_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    //Read "on" or "off" into param
+    char onoff[8];
+    int rc = parse_strn(onoff, sizeof(onoff) - 1, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_HISTORY_USAGE;
+        return -1;
+    }
+    if (!strcmp(onoff, "on")) {
+        dest->param = 1;
+    } else if (!strcmp(onoff, "off")) {
+        dest->param = 0;
+    } else {
+        dest->error_str = DBG_CMD_HISTORY_USAGE;
+        return -1;
+    }
+    int num_read = rc;
+    str += rc;
+    
+    rc = parse_eos(dest, str);
+    if (rc < 0) {
+        return -1; //dest->error_str already set
+    }
+    num_read += rc;
+    
+    dest->type = CMD_HISTORY;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+static int parse_view_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    //Read the view into param
+    char view[8];
+    int rc = parse_strn(view, sizeof(view) - 1, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_VIEW_USAGE;
+        return -1;
+    }
+    if (!strcmp(view, "flits")) {
+        dest->param = DBG_GUV_VIEW_FLITS;
+    } else if (!strcmp(view, "packets")) {
+        dest->param = DBG_GUV_VIEW_PACKETS;
+    } else {
+        dest->error_str = DBG_CMD_VIEW_USAGE;
+        return -1;
+    }
+    int num_read = rc;
+    str += rc;
+    
+    rc = parse_eos(dest, str);
+    if (rc < 0) {
+        return -1; //dest->error_str already set
+    }
+    num_read += rc;
+    
+    dest->type = CMD_VIEW;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+//param is 1 for "on", 0 for "off", and 2 for "dump" (in which case the
+//filename is in path)
+static int parse_trace_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    char word[8];
+    int rc = parse_strn(word, sizeof(word) - 1, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_TRACE_USAGE;
+        return -1;
+    }
+    int num_read = rc;
+    str += rc;
+    
+    if (!strcmp(word, "on")) {
+        dest->param = 1;
+    } else if (!strcmp(word, "off")) {
+        dest->param = 0;
+    } else if (!strcmp(word, "dump")) {
+        dest->param = 2;
+        rc = parse_strn(dest->path, MAX_STR_PARAM_SIZE, str);
+        if (rc < 0) {
+            dest->error_str = DBG_CMD_TRACE_USAGE;
+            return -1;
+        }
+        num_read += rc;
+        str += rc;
+    } else {
+        dest->error_str = DBG_CMD_TRACE_USAGE;
+        return -1;
+    }
+    
+    rc = parse_eos(dest, str);
+    if (rc < 0) {
+        return -1; //dest->error_str already set
+    }
+    num_read += rc;
+    
+    dest->type = CMD_TRACE;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+//With no argument, this prints the latency percentiles (param = 0). With
+//"reset", it clears them (param = 1)
+static int parse_lat_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    int num_read = 0;
+    int rc = parse_eos(dest, str);
+    if (rc >= 0) {
+        dest->param = 0;
+        num_read = rc;
+    } else {
+        char word[8];
+        rc = parse_strn(word, sizeof(word) - 1, str);
+        if (rc < 0 || strcmp(word, "reset")) {
+            dest->error_str = DBG_CMD_LAT_USAGE;
+            return -1;
+        }
+        dest->param = 1;
+        num_read = rc;
+        str += rc;
+        
+        rc = parse_eos(dest, str);
+        if (rc < 0) {
+            return -1; //dest->error_str already set
+        }
+        num_read += rc;
+    }
+    
+    dest->type = CMD_LAT;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+//With no argument, this just reports the frame rate cap. In that case 
+//param is set to 0
+static int parse_fps_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    int num_read = 0;
+    int rc = parse_eos(dest, str);
+    if (rc >= 0) {
+        dest->param = 0;
+        num_read = rc;
+    } else {
+        rc = parse_param(dest, str);
+        if (rc < 0 || dest->param < 1 || dest->param > 1000) {
+            dest->error_str = DBG_CMD_FPS_USAGE;
+            return -1;
+        }
+        num_read = rc;
+        str += rc;
+        
+        rc = parse_eos(dest, str);
+        if (rc < 0) {
+            return -1; //dest->error_str already set
+        }
+        num_read += rc;
+    }
+    
+    dest->type = CMD_FPS;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+//The weight goes in param and the minimum size (0 if not given) in param2
+static int parse_weight_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    int rc = parse_param(dest, str);
+    if (rc < 0 || dest->param < 1 || dest->param > 1000) {
+        dest->error_str = DBG_CMD_WEIGHT_USAGE;
+        return -1;
+    }
+    unsigned weight = dest->param;
+    int num_read = rc;
+    str += rc;
+    
+    rc = parse_eos(dest, str);
+    if (rc >= 0) {
+        dest->param2 = 0;
+    } else {
+        rc = parse_param(dest, str);
+        if (rc < 0 || dest->param > 1000) {
+            dest->error_str = DBG_CMD_WEIGHT_USAGE;
+            return -1;
+        }
+        dest->param2 = dest->param;
+        num_read += rc;
+        str += rc;
+        
+        rc = parse_eos(dest, str);
+        if (rc < 0) {
+            return -1; //dest->error_str already set
+        }
+    }
+    num_read += rc;
+    
+    dest->param = weight;
+    dest->type = CMD_WEIGHT;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+static int parse_dash_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    //Try reading a string into dest->id
+    int rc = parse_strn(dest->id, MAX_STR_PARAM_SIZE, str);
+    if (rc < 0) {
+        dest->error_str = DBG_CMD_DASH_USAGE;
+        return -1;
+    }
+    int num_read = rc;
+    str += rc;
+    
+    rc = parse_eos(dest, str);
+    if (rc < 0) {
+        return -1; //dest->error_str already set
+    }
+    num_read += rc;
+    
+    dest->type = CMD_DASH;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
+//With no argument, this just reports how much memory the logs are using.
+//In that case param is set to 0
+static int parse_logmem_cmd(dbg_cmd *dest, char const *str) {
+    //Sanity check on inputs
+    if (dest == NULL) {
+        return -2; //This is all we can do
+    } else if (str == NULL) {
+        dest->error_str = DBG_CMD_NULL_PTR;
+        return -1;
+    } 
+    
+    int num_read = 0;
+    int rc = parse_eos(dest, str);
+    if (rc >= 0) {
+        dest->param = 0;
+        num_read = rc;
+    } else {
+        rc = parse_param(dest, str);
+        if (rc < 0 || dest->param < 1) {
+            dest->error_str = DBG_CMD_LOGMEM_USAGE;
+            return -1;
+        }
+        num_read = rc;
+        str += rc;
+        
+        rc = parse_eos(dest, str);
+        if (rc < 0) {
+            return -1; //dest->error_str already set
+        }
+        num_read += rc;
+    }
+    
+    dest->type = CMD_LOGMEM;
+    dest->error_str = DBG_CMD_SUCCESS;
+    return num_read;
+}
+
 int parse_dbg_reg_cmd(dbg_cmd *dest, char const *str) {
     //Sanity check on inputs
     if (dest == NULL) {
@@ -535,6 +1083,7 @@ struct dbg_cmd_unused##CMD {}
 make_simple_parse_fn(CMD_DUMMY);
 make_simple_parse_fn(CMD_MSG);
 make_simple_parse_fn(CMD_QUIT);
+make_simple_parse_fn(CMD_STATS);
 
 //Just for syntax
 typedef struct _cmd_info {
@@ -553,6 +1102,21 @@ static cmd_info builtin_cmds[] = {
     {"msg",	    parse_CMD_MSG},	       //Focus message window
     {"quit",    parse_CMD_QUIT},       //End timonerie session
     {"exit",    parse_CMD_QUIT},       //End timonerie session
+    {"txlimit", parse_txlimit_cmd},    //Set max queued bytes for an FPGA
+    {"capture", parse_capture_cmd},    //Record raw stream from an FPGA
+    {"iothread", parse_iothread_cmd},  //Decode an FPGA on its own thread
+    {"time", parse_time_cmd},          //How log arrival times are shown
+    {"filter", parse_filter_cmd},      //Only keep some logs
+    {"scrollback", parse_scrollback_cmd}, //How many logs the active guv keeps
+    {"logmem", parse_logmem_cmd},      //Memory budget for all logs
+    {"history", parse_history_cmd},    //Compressed history for the active guv
+    {"view", parse_view_cmd},          //Show flits or whole packets
+    {"stats", parse_CMD_STATS},        //Traffic numbers for the active guv
+    {"lat", parse_lat_cmd},            //Where the time goes
+    {"trace", parse_trace_cmd},        //Record event loop activity
+    {"fps", parse_fps_cmd},            //Cap on how often the screen is redrawn
+    {"weight", parse_weight_cmd},      //Share of the screen for the focused window
+    {"dash", parse_dash_cmd},          //Grid of every guv on an FPGA
     //Command for deleting a name?
 };
 #define num_builtin_cmds (sizeof(builtin_cmds)/sizeof(*builtin_cmds))
@@ -616,5 +1180,19 @@ char const *const DBG_CMD_BAD_CMD          = "No such command";
 char const *const DBG_CMD_OPEN_USAGE         = "Usage: open fpga_name hostname port";
 char const *const DBG_CMD_CLOSE_USAGE  = "Usage: close fpga_name";
 char const *const DBG_CMD_SEL_USAGE      = "Usage: sel (fpga_name[guv_addr] | guv_name)";
-char const *const DBG_CMD_MGR_USAGE      = "Usage: mgr (int | fio)";
+char const *const DBG_CMD_MGR_USAGE      = "Usage: mgr (int | fio | trig)";
 char const *const DBG_CMD_NAME_USAGE          = "Usage: name guv_name";
+char const *const DBG_CMD_TXLIMIT_USAGE       = "Usage: txlimit fpga_name bytes";
+char const *const DBG_CMD_IOTHREAD_USAGE      = "Usage: iothread fpga_name (on | off)";
+char const *const DBG_CMD_TIME_USAGE          = "Usage: time (abs | rel | delta)";
+char const *const DBG_CMD_FILTER_USAGE        = "Usage: filter (expression | off)";
+char const *const DBG_CMD_SCROLLBACK_USAGE    = "Usage: scrollback num_logs";
+char const *const DBG_CMD_LOGMEM_USAGE        = "Usage: logmem [megabytes]";
+char const *const DBG_CMD_HISTORY_USAGE       = "Usage: history (on | off)";
+char const *const DBG_CMD_VIEW_USAGE          = "Usage: view (flits | packets)";
+char const *const DBG_CMD_LAT_USAGE           = "Usage: lat [reset]";
+char const *const DBG_CMD_TRACE_USAGE         = "Usage: trace (on | off | dump filename)";
+char const *const DBG_CMD_FPS_USAGE           = "Usage: fps [max_frames_per_second]";
+char const *const DBG_CMD_WEIGHT_USAGE        = "Usage: weight n [min_size]";
+char const *const DBG_CMD_DASH_USAGE          = "Usage: dash fpga_name";
+char const *const DBG_CMD_CAPTURE_USAGE       = "Usage: capture fpga_name (filename [megabytes] | off)";
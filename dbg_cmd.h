@@ -13,6 +13,21 @@
     X(CMD_DBG_REG),\
     X(CMD_MSG),\
     X(CMD_QUIT),\
+    X(CMD_TXLIMIT),\
+    X(CMD_CAPTURE),\
+    X(CMD_IOTHREAD),\
+    X(CMD_TIME),\
+    X(CMD_FILTER),\
+    X(CMD_SCROLLBACK),\
+    X(CMD_LOGMEM),\
+    X(CMD_HISTORY),\
+    X(CMD_VIEW),\
+    X(CMD_STATS),\
+    X(CMD_LAT),\
+    X(CMD_TRACE),\
+    X(CMD_FPS),\
+    X(CMD_WEIGHT),\
+    X(CMD_DASH),\
     X(CMD_HANDLED)
 
 #define X(x) x
@@ -35,8 +50,12 @@ typedef struct _dbg_cmd {
     int has_guv_addr; //The "sel" command can be fore an FPGA or a dbg_guv
     int has_param; //Some dbg_guv register commadns have a parameter, and some don't
     unsigned param;
+    unsigned param2; //For the few commands that take two numbers
     char node[MAX_STR_PARAM_SIZE + 1]; //The hostname...
     char serv[MAX_STR_PARAM_SIZE + 1]; //...and port (service) number for opening connections
+    char path[MAX_STR_PARAM_SIZE + 1]; //File name (or "off") for captures
+    char const *rest; //Rest of the line, for commands that take arbitrary
+                      //text. Points into the string that was parsed!
     
     //Error information
     char const *error_str;
@@ -91,7 +110,21 @@ extern char const *const DBG_CMD_BAD_CMD        ; //    = "No such command";
 extern char const *const DBG_CMD_OPEN_USAGE        ; //    = "Usage: open fpga_name hostname port";
 extern char const *const DBG_CMD_CLOSE_USAGE        ; //    = "Usage: close fpga_name";
 extern char const *const DBG_CMD_SEL_USAGE        ; //    = "Usage: sel (fpga_name[guv_addr] | guv_name)";
-extern char const *const DBG_CMD_MGR_USAGE        ; //    = "Usage: mgr (int | fio)";
+extern char const *const DBG_CMD_MGR_USAGE        ; //    = "Usage: mgr (int | fio | trig)";
 extern char const *const DBG_CMD_NAME_USAGE        ; //    = "Usage: name guv_name";
+extern char const *const DBG_CMD_TXLIMIT_USAGE        ; //    = "Usage: txlimit fpga_name bytes";
+extern char const *const DBG_CMD_IOTHREAD_USAGE        ; //    = "Usage: iothread fpga_name (on | off)";
+extern char const *const DBG_CMD_TIME_USAGE        ; //    = "Usage: time (abs | rel | delta)";
+extern char const *const DBG_CMD_FILTER_USAGE        ; //    = "Usage: filter (expression | off)";
+extern char const *const DBG_CMD_SCROLLBACK_USAGE    ; //    = "Usage: scrollback num_logs";
+extern char const *const DBG_CMD_LOGMEM_USAGE        ; //    = "Usage: logmem [megabytes]";
+extern char const *const DBG_CMD_HISTORY_USAGE        ; //    = "Usage: history (on | off)";
+extern char const *const DBG_CMD_VIEW_USAGE        ; //    = "Usage: view (flits | packets)";
+extern char const *const DBG_CMD_LAT_USAGE        ; //    = "Usage: lat [reset]";
+extern char const *const DBG_CMD_TRACE_USAGE        ; //    = "Usage: trace (on | off | dump filename)";
+extern char const *const DBG_CMD_FPS_USAGE        ; //    = "Usage: fps [max_frames_per_second]";
+extern char const *const DBG_CMD_WEIGHT_USAGE        ; //    = "Usage: weight n [min_size]";
+extern char const *const DBG_CMD_DASH_USAGE        ; //    = "Usage: dash fpga_name";
+extern char const *const DBG_CMD_CAPTURE_USAGE        ; //    = "Usage: capture fpga_name (filename [megabytes] | off)";
 
 #endif
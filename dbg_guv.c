@@ -3,14 +3,19 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sched.h>
 #include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 #include "dbg_guv.h"
 #include "textio.h"
 #include "timonier.h"
+#include "lat.h"
+#include "trace.h"
 
 
 #define X(x) #x
@@ -29,20 +34,36 @@ char const *const DBG_GUV_BAD_ADDRESS = "could not resolve address";
 char const *const DBG_GUV_OOM = "out of memory";
 char const *const DBG_GUV_NOT_ENOUGH_SPACE = "not enough room in buffer";
 char const *const DBG_GUV_INCOMPLETE_WORD = "received non-multiple-of-4 number of bytes";
+char const *const DBG_GUV_ADDR_RANGE = "dbg_guv address out of range";
+char const *const DBG_GUV_TXN_FULL = "too many commands in transaction";
+char const *const DBG_GUV_WRONG_FPGA = "dbg_guv is not on this transaction's FPGA";
+char const *const DBG_GUV_BAD_LIMIT = "TX limit must be at least one segment";
+char const *const DBG_GUV_IO_THREAD_RUNNING = "not allowed while the I/O thread is running";
+char const *const DBG_GUV_BAD_SCROLLBACK = "scrollback must be between 1 and 50000000 logs";
+char const *const DBG_GUV_BAD_VIEW = "no such view";
 
 
 //////////////////////////////
 //Static functions/variables//
 //////////////////////////////
 
-static void init_dbg_guv(dbg_guv *d, fpga_connection_info *f, int addr) {
-    memset(d, 0, sizeof(dbg_guv));
+//Returns a newly allocated dbg_guv, or NULL on error
+static dbg_guv* new_dbg_guv(fpga_connection_info *f, int addr) {
+    dbg_guv *d = calloc(1, sizeof(dbg_guv));
+    if (!d) return NULL;
     
-    init_linebuf(&d->logs, DBG_GUV_SCROLLBACK);
+    init_dbg_log(&d->logs, DBG_GUV_SCROLLBACK);
+    dbg_log_enable_history(&d->logs); //Not the end of the world if this fails
+    init_reasm(&d->pkts);
     
     char line[80];
     sprintf(line, "%p[%d]", f, addr);
     d->name = strdup(line);
+    if (!d->name) {
+        free(d);
+        return NULL;
+    }
+    init_guv_stats(&d->stats, d->name);
     
     d->need_redraw = 1; //Need to draw when first added in
     d->values_unknown = 1;
@@ -50,14 +71,73 @@ static void init_dbg_guv(dbg_guv *d, fpga_connection_info *f, int addr) {
     d->addr = addr;
     
     d->ops = default_guv_ops;
+    
+    return d;
 } 
 
-static void deinit_dbg_guv(dbg_guv *d) {
+//Wide values are shifted into these registers one word at a time, so two
+//writes are not the same as one
+static int reg_is_shifted(dbg_reg_type reg) {
+    switch (reg) {
+    case INJ_TDATA:
+    case INJ_TKEEP:
+    case INJ_TDEST:
+    case INJ_TID:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+//These are the registers whose values are reported in command receipts,
+//so they are the only ones we trust the shadow registers for
+static int reg_in_receipt(dbg_reg_type reg) {
+    switch (reg) {
+    case KEEP_PAUSING:
+    case KEEP_LOGGING:
+    case KEEP_DROPPING:
+    case INJ_TVALID:
+    case DUT_RESET:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+//Returns an empty TX segment, or NULL if out of memory
+static fci_tx_seg* get_tx_seg(fpga_connection_info *f) {
+    fci_tx_seg *seg = f->tx_spare;
+    if (seg != NULL) {
+        f->tx_spare = NULL;
+    } else {
+        seg = malloc(sizeof(fci_tx_seg));
+        if (seg == NULL) return NULL;
+    }
+    
+    seg->next = NULL;
+    seg->rd = 0;
+    seg->wr = 0;
+    return seg;
+}
+
+//Done with this segment
+static void put_tx_seg(fpga_connection_info *f, fci_tx_seg *seg) {
+    if (f->tx_spare == NULL) {
+        f->tx_spare = seg;
+    } else {
+        free(seg);
+    }
+}
+
+static void del_dbg_guv(dbg_guv *d) {
     if (!d) return; //I guess we'll do this?
-    free_linebuf_logs(&d->logs);
-    deinit_linebuf(&d->logs);
+    deinit_dbg_log(&d->logs);
+    deinit_reasm(&d->pkts);
     
+    if (d->filt) free(d->filt);
     if (d->name) free(d->name); //Valgrind found this one. 
+    
+    free(d);
 }
 
 ///////////////////////////////////////////
@@ -68,13 +148,14 @@ static void deinit_dbg_guv(dbg_guv *d) {
 //or NULL on error
 //TODO: make dbg_guv widths parameters to this function?
 fpga_connection_info* new_fpga_connection() {
+    //All the guv pointers start off as NULL; they are filled in lazily by
+    //fpga_get_guv
     fpga_connection_info *ret = calloc(1, sizeof(fpga_connection_info));
     if (!ret) return NULL;
     
-    int i;
-    for (i = 0; i < MAX_GUVS_PER_FPGA; i++) {
-        init_dbg_guv(ret->guvs + i, ret, i);
-    }
+    //The TX queue starts off empty (thanks, calloc)
+    ret->tx_limit = FCI_TX_DEFAULT_LIMIT;
+    init_guv_dash(&ret->dash, ret);
     
     return ret;
 }
@@ -85,358 +166,1129 @@ void del_fpga_connection(fpga_connection_info *f) {
     if (f == NULL) return;
 
 	//TODO: remove events?
+    
+    //The io thread decodes into the guvs, and stopping it delivers whatever
+    //it left in the queue, so this has to happen before we free any of them
+    fpga_stop_io_thread(f); //Ignores a thread that isn't running
+    if (f->rxq != NULL) free(f->rxq);
 
     int i;
     for (i = 0; i < MAX_GUVS_PER_FPGA; i++) {        
-        //Slow as hell... there must be a better way...
-        //Also, I've gotten into trouble here. The append_log function
-        //specifically does not malloc or free or copy anything. However, 
-        //this fpga_connection_info cleanup assumes that non-NULL strings
-        //should be freed. This is inconsistent. I should fix this 
-        deinit_dbg_guv(&f->guvs[i]);
+        del_dbg_guv(f->guvs[i]); //Ignores NULL entries
+    }
+    
+    while (f->tx_head != NULL) {
+        fci_tx_seg *next = f->tx_head->next;
+        free(f->tx_head);
+        f->tx_head = next;
     }
+    if (f->tx_spare != NULL) free(f->tx_spare);
+    free(f->tx_park);
+    
+    deinit_capture(&f->cap); //Ignores a capture that isn't open
+    deinit_guv_dash(&f->dash);
     
     if (f->name) free(f->name);
     
     free(f);
 }
 
-//Returns string which was displaced by new log. This can be NULL. NOTE: 
-//do NOT call this function if you are holding a mutex! By the way, does NOT
-//make an internal copy of the string; you must copy it yourself if this is
-//desired
-char *append_log(dbg_guv *d, char *log) {
-    linebuf *l = &d->logs;
-    char *ret = linebuf_append(l, log);
+//Returns the dbg_guv at addr, creating it if this is the first time anyone
+//has asked for it. Returns NULL on error (and sets f->error_str)
+dbg_guv* fpga_get_guv(fpga_connection_info *f, int addr) {
+    if (f == NULL) return NULL; //This is all we can do
     
-    d->need_redraw = 1;
+    if (addr < 0 || addr >= MAX_GUVS_PER_FPGA) {
+        f->error_str = DBG_GUV_ADDR_RANGE;
+        return NULL;
+    }
     
-    return ret;
+    if (f->guvs[addr] != NULL) return f->guvs[addr];
+    
+    dbg_guv *d = new_dbg_guv(f, addr);
+    if (d == NULL) {
+        f->error_str = DBG_GUV_OOM;
+        return NULL;
+    }
+    
+    f->guvs[addr] = d;
+    f->num_guvs++;
+    dash_guv_added(&f->dash, addr);
+    return d;
 }
 
 //Enqueues the given data, which will be sent when the socket becomes 
-//ready next. Returns -1 and sets f->error_str on error, or 0 on success.
-//(Returns -2 if f was NULL)
-//TODO: usher this function into the modern era now that everything is
-//handled in 32-bit words?
+//ready next. Either all of the data is queued or none of it is. Returns -1 
+//and sets f->error_str on error, or 0 on success. (Returns -2 if f was NULL)
 int fpga_enqueue_tx(fpga_connection_info *f, char const *buf, int len) {
 	if (f == NULL) {
 		return -2; //This is all we can do
 	}
 	
-	if(FCI_BUF_SIZE - f->out_buf_len < len) {
+	if (f->tx_len + len > f->tx_limit) {
 		f->error_str = DBG_GUV_NOT_ENOUGH_SPACE;
 		return -1;
 	}
 	
-	//There may be an elegant solution to this, but for now I have to
-	//deal with a few ugly cases:
-	//
-	//Case 1 (no wraparound, wr > rd):
-	//  [ | | | | | |x|x|x|x| | | | | | | | ]
-	//               ^rd     ^wr   ^wr+len
-	//
-	//Case 2 (wraparound, wr > rd)
-	//  [ | | | | | |x|x|x|x| | | | | | | | ]
-	//     ^wr+len   ^rd     ^wr  
-	//
-	//Case 3 (no wraparound, wr < rd):
-	//  [x| | | | | | | | | | |x|x|x|x|x|x|x]
-	//     ^wr       ^wr+len   ^rd          
-	//
-	//Cases 1 and 3 are handled identically, so we just need to
-	//distinguish case 2 specifically
-	
-	int wr_pos = (f->out_buf_pos + f->out_buf_len) % FCI_BUF_SIZE;
-	if (wr_pos + len > FCI_BUF_SIZE) {
-		//Case 2: need to split into first and second halves
-		int first_half_len = FCI_BUF_SIZE - wr_pos - 1; //OBOE?
-		memcpy(f->out_buf + wr_pos, buf, first_half_len);
-		
-		int second_half_len = len - first_half_len;
-		memcpy(f->out_buf + 0, buf + first_half_len, second_half_len);
+	//Whatever doesn't fit in the last segment goes into new ones. Get all
+	//of those first so that running out of memory doesn't leave half a
+	//command in the queue
+	int tail_room = (f->tx_tail == NULL) ? 0 : FCI_TX_SEG_SIZE - f->tx_tail->wr;
+	fci_tx_seg *new_head = NULL, *new_tail = NULL;
+	int need;
+	for (need = len - tail_room; need > 0; need -= FCI_TX_SEG_SIZE) {
+		fci_tx_seg *seg = get_tx_seg(f);
+		if (seg == NULL) {
+			while (new_head != NULL) {
+				fci_tx_seg *next = new_head->next;
+				put_tx_seg(f, new_head);
+				new_head = next;
+			}
+			f->error_str = DBG_GUV_OOM;
+			return -1;
+		}
 		
-	} else {
-		//Case 1 or case 3: we can just directly copy in
-		memcpy(f->out_buf + wr_pos, buf, len);
+		if (new_tail == NULL) new_head = seg;
+		else new_tail->next = seg;
+		new_tail = seg;
+	}
+	
+	f->tx_len += len;
+	
+	//Top up the current last segment...
+	int n = (len < tail_room) ? len : tail_room;
+	if (n > 0) {
+		memcpy(f->tx_tail->data + f->tx_tail->wr, buf, n);
+		f->tx_tail->wr += n;
+		buf += n;
+		len -= n;
+	}
+	
+	//...then fill in the new ones
+	if (new_head != NULL) {
+		if (f->tx_tail == NULL) f->tx_head = new_head;
+		else f->tx_tail->next = new_head;
+		f->tx_tail = new_tail;
+	}
+	fci_tx_seg *seg;
+	for (seg = new_head; seg != NULL; seg = seg->next) {
+		n = (len < FCI_TX_SEG_SIZE) ? len : FCI_TX_SEG_SIZE;
+		memcpy(seg->data, buf, n);
+		seg->wr = n;
+		buf += n;
+		len -= n;
 	}
 	
-	f->out_buf_len += len;
 	f->error_str = DBG_GUV_SUCC;
 	#warning Error code not checked
 	event_add(f->wr_ev, NULL); //Now that there is data to send, send it!
 	return 0;
 }
 
-//TODO: remove hardcoded widths
-//Constructs a dbg_guv commadn and queues it for output by calling
-//fpga_enequeue_tx
-int dbg_guv_send_cmd(dbg_guv *d, dbg_reg_type reg, uint32_t param) {
-	fpga_connection_info *f = d->parent;
-	int dbg_guv_addr = d->addr;
+//Returns the number of bytes that can still be queued before 
+//fpga_enqueue_tx starts refusing data
+int fpga_tx_room(fpga_connection_info const *f) {
+    return f->tx_limit - f->tx_len - f->tx_park_len * (int) sizeof(uint32_t);
+}
+
+//Sets aside a transaction that didn't fit in the TX queue. Returns 0 on
+//success or -1 on error (and sets f->error_str)
+static int fpga_park_tx(fpga_connection_info *f, uint32_t const *words, int num_words) {
+    int need = f->tx_park_len + 1 + num_words;
+    if (need * sizeof(uint32_t) > FCI_TX_PARK_MAX) {
+        f->error_str = DBG_GUV_NOT_ENOUGH_SPACE;
+        return -1;
+    }
     
-	uint32_t cmd_addr = (dbg_guv_addr << 4) | reg;
-	
-	int rc = fpga_enqueue_tx(f, (char*) &cmd_addr, sizeof(cmd_addr));
-	if (rc == 0 && reg != LATCH) {
-		rc = fpga_enqueue_tx(f, (char*) &param, sizeof(param));
-	}
-	
-	return rc;
+    if (need > f->tx_park_cap) {
+        int cap = f->tx_park_cap ? f->tx_park_cap : 64;
+        while (cap < need) cap *= 2;
+        uint32_t *park = realloc(f->tx_park, cap * sizeof(uint32_t));
+        if (park == NULL) {
+            f->error_str = DBG_GUV_OOM;
+            return -1;
+        }
+        f->tx_park = park;
+        f->tx_park_cap = cap;
+    }
+    
+    f->tx_park[f->tx_park_len++] = num_words;
+    memcpy(f->tx_park + f->tx_park_len, words, num_words * sizeof(uint32_t));
+    f->tx_park_len += num_words;
+    
+    f->error_str = DBG_GUV_SUCC;
+    return 0;
 }
 
-#warning This function has a million unchecked malloc calls
-int read_fpga_connection(fpga_connection_info *f, int fd) {
+//Moves as many parked transactions into the TX queue as will fit, oldest
+//first
+static void fpga_unpark_tx(fpga_connection_info *f) {
+    int pos = 0;
+    while (pos < f->tx_park_len) {
+        int n = f->tx_park[pos];
+        int rc = fpga_enqueue_tx(f, (char*) (f->tx_park + pos + 1), n * sizeof(uint32_t));
+        if (rc < 0) break; //Try again after the next write
+        pos += 1 + n;
+    }
+    
+    memmove(f->tx_park, f->tx_park + pos, (f->tx_park_len - pos) * sizeof(uint32_t));
+    f->tx_park_len -= pos;
+}
+
+//Asks for d->ops.tx_ready to be called once the TX queue has drained to
+//half of its limit. This is how producers like the fio manager back off
+//instead of erroring out when the network can't keep up
+void fpga_tx_wait(fpga_connection_info *f, dbg_guv *d) {
+    if (d->tx_blocked) return; //Already waiting
+    
+    d->tx_blocked = 1;
+    f->tx_blocked++;
+}
+
+//Changes the most bytes that can be queued for sending. Returns 0 on 
+//success, -1 on error (and sets f->error_str), or -2 if f was NULL
+int fpga_set_tx_limit(fpga_connection_info *f, int limit) {
     if (f == NULL) {
         return -2; //This is all we can do
     }
-    //Read from fd into local buffer
     
-    //Try reading as many bytes as we have space for. Note: this
-    //is kind of ugly, but because we might only read part of a 
-    //message, we need to save partial messages in a buffer
-    int num_read = read(fd, f->in_buf + f->in_buf_pos, FCI_BUF_SIZE - f->in_buf_pos);
-    if (num_read < 0) {
-        f->error_str = strerror(errno);
+    if (limit < FCI_TX_SEG_SIZE) {
+        f->error_str = DBG_GUV_BAD_LIMIT;
         return -1;
-    } else if (num_read == 0) {
-        f->error_str = DBG_GUV_CNX_CLOSED;
+    }
+    
+    //If there's already more than this queued, that's fine; we just won't
+    //take any more until it drains
+    f->tx_limit = limit;
+    
+    f->error_str = DBG_GUV_SUCC;
+    return 0;
+}
+
+//Starts an empty transaction for guvs on f
+void dbg_guv_txn_begin(dbg_guv_txn *txn, fpga_connection_info *f) {
+    txn->f = f;
+    txn->num_cmds = 0;
+    txn->use_shadows = 1;
+    txn->error_str = DBG_GUV_SUCC;
+}
+
+//Stages a register write (or a LATCH, in which case param is ignored). 
+//Returns 0 on success, -1 on error (and sets txn->error_str), or -2 if txn
+//was NULL
+int dbg_guv_txn_write(dbg_guv_txn *txn, dbg_guv *d, dbg_reg_type reg, uint32_t param) {
+    if (txn == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    if (d == NULL) {
+        txn->error_str = DBG_GUV_NULL_ARG;
         return -1;
-    } else if (num_read % 4 != 0) {
-        f->error_str = DBG_GUV_INCOMPLETE_WORD;
     }
-    f->in_buf_pos += num_read/4;
     
-    //For each complete receipt/log in the buffer, dispatch to correct guv
+    if (d->parent != txn->f) {
+        txn->error_str = DBG_GUV_WRONG_FPGA;
+        return -1;
+    }
     
-    #warning Be careful about endianness
-    uint32_t *rd_pos = f->in_buf; //TODO: manage endianness
-    int words_to_treat = f->in_buf_pos;
-    
-    //In principle, f->in_buf_pos should go back to 0. There is one (ugly)
-    //exception to this rule which is dealt with in the following while loop
-    //(i.e. the case when only a partial packet was read)
-    f->in_buf_pos = 0;
-    
-    //Iterate through all the complete messages in the read buffer
-    while (words_to_treat > 0) {      
-        //Keep track of beginning of this packet, for the sake of the log
-        //function in the guv ops
-        uint32_t *beginning = rd_pos;
+    if (reg != LATCH && !reg_is_shifted(reg)) {
+        //Look back through this transaction for an earlier write to the 
+        //same register. If there's no LATCH for this guv in between, we
+        //can just replace it
+        int can_replace = 1;
+        int known = 0;
+        uint32_t cur = 0;
+        int i;
+        for (i = txn->num_cmds - 1; i >= 0; i--) {
+            if (txn->cmds[i].d != d) continue;
+            if (txn->cmds[i].reg == LATCH) {
+                can_replace = 0;
+            } else if (txn->cmds[i].reg == reg) {
+                if (can_replace) {
+                    txn->cmds[i].param = param;
+                    txn->error_str = DBG_GUV_SUCC;
+                    return 0;
+                }
+                //Otherwise, this is the value the scratch register will
+                //have by the time our write gets there
+                known = 1;
+                cur = txn->cmds[i].param;
+                break;
+            }
+        }
+        if (!known && txn->use_shadows && (d->shadow_valid & (1 << reg))) {
+            known = 1;
+            cur = d->shadow[reg];
+        }
+        
+        //If the scratch register already holds this value, there's no 
+        //point sending it
+        if (known && cur == param) {
+            txn->error_str = DBG_GUV_SUCC;
+            return 0;
+        }
+    }
+    
+    if (txn->num_cmds == DBG_GUV_TXN_MAX_CMDS) {
+        txn->error_str = DBG_GUV_TXN_FULL;
+        return -1;
+    }
+    
+    txn->cmds[txn->num_cmds].d = d;
+    txn->cmds[txn->num_cmds].reg = reg;
+    txn->cmds[txn->num_cmds].param = param;
+    txn->num_cmds++;
+    
+    txn->error_str = DBG_GUV_SUCC;
+    return 0;
+}
+
+//Queues everything staged in txn for output in one go. On error, nothing
+//is queued. Returns 0 on success, -1 on error (and sets txn->error_str), 
+//or -2 if txn was NULL
+int dbg_guv_txn_commit(dbg_guv_txn *txn) {
+    if (txn == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    if (txn->num_cmds == 0) {
+        //Everything got combined away
+        txn->error_str = DBG_GUV_SUCC;
+        return 0;
+    }
+    
+    //Build the whole thing up on the stack so it can go into the ring with
+    //a single fpga_enqueue_tx (which checks the space for us)
+    uint32_t words[2*DBG_GUV_TXN_MAX_CMDS];
+    int num_words = 0;
+    
+    int i;
+    for (i = 0; i < txn->num_cmds; i++) {
+        dbg_reg_type reg = txn->cmds[i].reg;
+        words[num_words++] = (txn->cmds[i].d->addr << 4) | reg;
+        if (reg != LATCH) {
+            words[num_words++] = txn->cmds[i].param;
+        }
+    }
+    
+    //If the TX queue is full, park the transaction instead of failing. It
+    //can't overtake anything that's already parked, either
+    fpga_connection_info *f = txn->f;
+    int rc = -1;
+    if (f->tx_park_len == 0) {
+        rc = fpga_enqueue_tx(f, (char*) words, num_words * sizeof(uint32_t));
+    }
+    if (rc < 0 && (f->tx_park_len > 0 || f->error_str == DBG_GUV_NOT_ENOUGH_SPACE)) {
+        rc = fpga_park_tx(f, words, num_words);
+    }
+    if (rc < 0) {
+        txn->error_str = f->error_str;
+        return -1;
+    }
+    
+    //Now that it's actually going out, remember what we told the hardware
+    for (i = 0; i < txn->num_cmds; i++) {
+        dbg_guv *d = txn->cmds[i].d;
+        dbg_reg_type reg = txn->cmds[i].reg;
+        if (reg == LATCH) {
+            d->latches_in_flight++;
+            d->shadow_written = 0;
+            continue;
+        }
+        if (!reg_in_receipt(reg)) continue;
+        d->shadow[reg] = txn->cmds[i].param;
+        d->shadow_valid |= (1 << reg);
+        d->shadow_written |= (1 << reg);
+    }
+    
+    txn->num_cmds = 0;
+    txn->error_str = DBG_GUV_SUCC;
+    return 0;
+}
+
+//TODO: remove hardcoded widths
+//Shorthand for a transaction with a single command in it. Returns 0 on
+//success or -1 on error (and sets d->parent->error_str)
+int dbg_guv_send_cmd(dbg_guv *d, dbg_reg_type reg, uint32_t param) {
+    dbg_guv_txn txn;
+    dbg_guv_txn_begin(&txn, d->parent);
+    txn.use_shadows = 0;
+    
+    int rc = dbg_guv_txn_write(&txn, d, reg, param);
+    if (rc == 0) {
+        rc = dbg_guv_txn_commit(&txn);
+    }
+    
+    if (rc < 0) {
+        d->parent->error_str = txn.error_str;
+        return -1;
+    }
+    
+    return 0;
+}
+
+//Updates the guv at addr with the contents of a command receipt
+static void deliver_receipt(fpga_connection_info *f, int addr, uint32_t word) {
+    f->rx_receipts++;
+    
+    dbg_guv *d = fpga_get_guv(f, addr);
+    if (d == NULL) {
+        //ignore this message (f->error_str already set)
+        return;
+    }
+    
+    d->keep_pausing     = (word>>13) & 1;
+    d->keep_logging     = (word>>14) & 1;
+    d->keep_dropping    = (word>>15) & 1;
+    if (d->log_cnt == 0 || ((word>>16) & 1) == 0) {
+        d->log_cnt      = (word>>16) & 1;
+    }
+    if (d->drop_cnt == 0 || ((word>>17) & 1) == 0) {
+        d->drop_cnt     = (word>>17) & 1;
+    }
+    d->inj_TVALID       = (word>>18) & 1;
+    d->dut_reset        = (word>>19) & 1;
+    d->inj_failed       = (word>>20) & 1;
+    d->dout_not_rdy_cnt = (word>>21);
+    stats_add_receipt(&d->stats, d->inj_failed, d->dout_not_rdy_cnt);
+    
+    //Receipts tell us what the scratch registers hold (at least, the ones
+    //they report on). If some of our LATCHes haven't been answered yet, 
+    //this receipt is already out of date, so wait for the last one. This
+    //also fixes the shadows up if something else wrote to the hardware
+    if (d->latches_in_flight > 0) d->latches_in_flight--;
+    if (d->latches_in_flight == 0) {
+        uint32_t vals[] = {
+            [KEEP_PAUSING] = d->keep_pausing,
+            [KEEP_LOGGING] = d->keep_logging,
+            [KEEP_DROPPING] = d->keep_dropping,
+            [INJ_TVALID] = d->inj_TVALID,
+            [DUT_RESET] = d->dut_reset
+        };
+        int i;
+        for (i = 0; i < sizeof(vals)/sizeof(*vals); i++) {
+            if (!reg_in_receipt(i)) continue;
+            if (d->shadow_written & (1 << i)) continue;
+            d->shadow[i] = vals[i];
+            d->shadow_valid |= (1 << i);
+        }
+    }
+    
+    d->values_unknown = 0;
+    d->need_redraw = 1;
+    dash_guv_changed(&f->dash, addr);
+    
+    if (d->ops.cmd_receipt != NULL) {
+        //TODO: check error code?
+        #warning Error code is not checked
+        d->ops.cmd_receipt(d, word);
+    }
+    
+    twm_request_redraw();
+}
+
+//Makes a decoded log visible. If in_ring is nonzero, rec is the spare slot
+//in d's log ring and gets committed (as long as it gets past the filter).
+//Otherwise it's some other buffer
+static void deliver_log(dbg_guv *d, dbg_log_rec *rec, int in_ring) {
+    //rec->seq is only set once it's committed, but the packet view wants
+    //to point at the first flit, so work out what it will be. (If the
+    //filter throws this one away, that's the seq of the next one kept)
+    rec->seq = d->logs.next_seq;
+    stats_add_flit(&d->stats, rec);
+    dash_guv_changed(&d->parent->dash, d->addr);
+    if (reasm_add_flit(&d->pkts, rec) == 0 && d->view == DBG_GUV_VIEW_PACKETS) {
+        d->need_redraw = 1;
+    }
+    
+    if (d->filt != NULL && !filter_match(d->filt, rec)) {
+        in_ring = 0;
+        //Nothing new is kept, but the counters changed. Ask for a frame
+        //when they're due (draw_sz_dbg_guv takes it from there)
+        if (!d->filt_stale) {
+            d->filt_stale = 1;
+            uint64_t now = dbg_log_now_ns();
+            uint64_t due = d->filt_drawn_ns + DBG_GUV_FILT_PERIOD_NS;
+            twm_request_redraw_in(due > now ? due - now : 0);
+        }
+    }
+    
+    if (in_ring) {
+        dbg_log_commit(&d->logs);
+        d->need_redraw = 1;
+    }
+    
+    //Finally, if the guv manager has hooked up a log callback, call it. 
+    if (d->ops.log != NULL) {
+        //TODO: check error code
+        #warning Error code is not checked
+        d->ops.log(d, rec);
+    }
+    
+    //The manager may also have asked for a redraw
+    if (d->need_redraw) twm_request_redraw();
+}
+
+//Fills rec with the log whose header word is hdr and whose remaining words
+//start at ring position pos
+static void decode_log(fpga_connection_info *f, uint32_t hdr, unsigned pos, uint64_t now, dbg_log_rec *rec) {
+    //Figure out sizes of AXI Stream channels (in bits)
+    int TID_width = ((hdr>>20) & 0x3F);
+    int TDEST_width = ((hdr>>26) & 0x3F);
+    int TID_TDEST_sum = TID_width + TDEST_width;
+    //Size of TDATA in bytes
+    int log_len = ((hdr>>13) & 0x3F) + 1;
+    int tdata_words = (log_len + 3)/4;
+    
+    //Replay needs to know the channel widths, so note them in the capture
+    //header
+    if (f->cap.map != NULL) {
+        int addr = hdr & ((1 << DBG_GUV_ADDR_WIDTH) - 1);
+        capture_add_guv(&f->cap, addr, TID_width, TDEST_width);
+    }
+    
+    rec->ns = now;
+    rec->seq = 0; //Filled in if it's committed
+    rec->TLAST = (hdr>>19) & 1;
+    rec->TID_width = TID_width;
+    rec->TDEST_width = TDEST_width;
+    rec->len = log_len;
+    rec->TID = 0;
+    rec->TDEST = 0;
+    
+    //This is the ugly business of how TDEST and TID are encoded in the
+    //packet. 
+    if (TID_TDEST_sum > 0 && TID_TDEST_sum <= 32) {
+        //TDEST and TID are in a single word
+        uint32_t word = FCI_RX_WORD(f, pos);
+        pos += 4;
         
-        //"Peek" at the next word in the read buffer to figure out if it's
-        //a command receipt or a log
-        uint32_t word = *rd_pos;
+        //Careful: shifting by 32 is undefined
+        rec->TID = (TDEST_width < 32) ? word>>TDEST_width : 0;
+        rec->TDEST = (TDEST_width < 32) ? word & ((1u << TDEST_width) - 1) : word;
+    } else if (TID_TDEST_sum > 32) {
+        //TDEST and TID are in separate words
+        rec->TID = FCI_RX_WORD(f, pos);
+        pos += 4;
         
+        rec->TDEST = FCI_RX_WORD(f, pos);
+        pos += 4;
+    }
+    
+    //Now copy out TDATA. Formatting it into text is left until someone
+    //actually draws it
+    int i;
+    for (i = 0; i < tdata_words; i++) {
+        rec->TDATA[i] = FCI_RX_WORD(f, pos);
+        pos += 4;
+    }
+    
+    //The last word is right-padded, so right-shift it to the proper place
+    //value
+    if (log_len % 4 != 0) {
+        rec->TDATA[tdata_words - 1] >>= 8*(4 - log_len%4);
+    }
+}
+
+//Returns the next free slot in the I/O thread's queue, or NULL if the UI
+//thread has fallen behind. Only called from the I/O thread
+static fci_rx_evt *rxq_slot(fci_rx_queue *q) {
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (tail - head == FCI_RX_QUEUE_SIZE) return NULL;
+    return q->evts + (tail % FCI_RX_QUEUE_SIZE);
+}
+
+//Hands the slot from rxq_slot over to the UI thread
+static void rxq_push(fci_rx_queue *q) {
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+}
+
+//Decodes every complete receipt/log waiting in f->in_ring. Normally, they
+//are dispatched to the correct guv right away. If the I/O thread is doing
+//the decoding, they are pushed into f->rxq instead (and if that fills up,
+//the rest are left in the ring until there's room). A partial packet at 
+//the end is left where it is
+static void decode_fpga_connection(fpga_connection_info *f, uint64_t now) {
+    #warning Be careful about endianness
+    fci_rx_queue *q = f->io_running ? f->rxq : NULL;
+    int nstored = 0; //For latency stats
+    
+    //Iterate through all the complete messages in the ring
+    while (f->in_wr - f->in_rd >= 4) {
+        //"Peek" at the next word in the ring to figure out if it's a 
+        //command receipt or a log
+        uint32_t word = FCI_RX_WORD(f, f->in_rd);
         
         int dbg_guv_addr = word & ((1 << DBG_GUV_ADDR_WIDTH) - 1);
         int is_receipt = (word >> DBG_GUV_ADDR_WIDTH) & 1;
 #ifdef DEBUG_ON        
-        fprintf(stderr, "Read %08x from %ld (words_to_treat = %d) [%s@%d]\n", 
+        fprintf(stderr, "Read %08x from %u (bytes left = %u) [%s@%d]\n", 
             word, 
-            rd_pos-f->in_buf, 
-            words_to_treat,
+            f->in_rd % FCI_RX_RING_SIZE, 
+            f->in_wr - f->in_rd,
             is_receipt ? "RX" : "LOG",
             dbg_guv_addr
         );
 #endif        
         if (is_receipt) {
-            //We have used this word
-            rd_pos++;
-            words_to_treat--;
-            
-            if (dbg_guv_addr >= MAX_GUVS_PER_FPGA) {
-                //ignore this message
-                continue;
-            }
-            
-            dbg_guv *d = f->guvs + dbg_guv_addr;
-            
-            d->keep_pausing     = (word>>13) & 1;
-            d->keep_logging     = (word>>14) & 1;
-            d->keep_dropping    = (word>>15) & 1;
-            if (d->log_cnt == 0 || ((word>>16) & 1) == 0) {
-                d->log_cnt      = (word>>16) & 1;
-            }
-            if (d->drop_cnt == 0 || ((word>>17) & 1) == 0) {
-                d->drop_cnt     = (word>>17) & 1;
-            }
-            d->inj_TVALID       = (word>>18) & 1;
-            d->dut_reset        = (word>>19) & 1;
-            d->inj_failed       = (word>>20) & 1;
-            d->dout_not_rdy_cnt = (word>>21);
-            
-            d->values_unknown = 0;
-            d->need_redraw = 1;
-            
-            if (d->ops.cmd_receipt != NULL) {
-                //TODO: check error code?
-                #warning Error code is not checked
-                d->ops.cmd_receipt(d, word);
+            if (q != NULL) {
+                fci_rx_evt *evt = rxq_slot(q);
+                if (evt == NULL) break; //Try again later
+                evt->is_receipt = 1;
+                evt->addr = dbg_guv_addr;
+                evt->receipt = word;
+                rxq_push(q);
+                f->in_rd += 4;
+            } else {
+                f->in_rd += 4;
+                deliver_receipt(f, dbg_guv_addr, word);
             }
+            continue;
+        }
+        
+        //This is a log. We first need to figure out how many words it
+        //occupies
+        int TID_TDEST_sum = ((word>>20) & 0x3F) + ((word>>26) & 0x3F);
+        int tdata_words = (((word>>13) & 0x3F) + 1 + 3)/4;
+        int packet_words = 1 + tdata_words; //Include header word
+        if (TID_TDEST_sum > 0) packet_words++;
+        if (TID_TDEST_sum > 32) packet_words++;
+        
+        //Check if we have the entire flit yet. If not, leave it in the ring
+        //and wait for the next read
+        if (f->in_wr - f->in_rd < 4*packet_words) {
+            break;
+        }
+        
+        //The rest of the packet starts just past the header
+        unsigned pos = f->in_rd + 4;
+        
+        if (q != NULL) {
+            fci_rx_evt *evt = rxq_slot(q);
+            if (evt == NULL) break; //Try again later
+            evt->is_receipt = 0;
+            evt->addr = dbg_guv_addr;
+            decode_log(f, word, pos, now, &evt->rec);
+            rxq_push(q);
+            f->in_rd += 4*packet_words;
+            continue;
+        }
+        
+        f->in_rd += 4*packet_words;
+        f->rx_logs++;
+        
+        dbg_guv *d = fpga_get_guv(f, dbg_guv_addr);
+        if (d == NULL) {
+            //ignore this message (f->error_str already set)
+            continue;
+        }
+        
+        //Decode straight into the free slot of the guv's log ring. If we 
+        //can't get one, we still have to consume the packet
+        dbg_log_rec scratch;
+        dbg_log_rec *rec = dbg_log_reserve(&d->logs);
+        if (rec == NULL) {
+            f->error_str = d->logs.error_str;
+            rec = &scratch;
+        }
+        
+        decode_log(f, word, pos, now, rec);
+        deliver_log(d, rec, rec != &scratch);
+        nstored++;
+    }
+    
+    //One clock read per batch is plenty. The I/O thread never gets here,
+    //since it only queues logs
+    if (nstored > 0) lat_stored(now, dbg_log_now_ns(), nstored);
+}
+
+//Reads as much as we can (up to FCI_RX_MAX_READS times) from fd into the
+//ring, decoding as we go. Returns 0 on success, or -1 on error (and sets
+//*error_str)
+static int fill_fpga_connection(fpga_connection_info *f, int fd, char const **error_str) {
+    //Keep reading until the socket is empty (or we've had our fair share)
+    char *ring = (char *) f->in_ring;
+    int i;
+    for (i = 0; i < FCI_RX_MAX_READS; i++) {
+        //Read into all the free space in the ring, which might be in two
+        //pieces. This can only be zero when the I/O thread's queue is full
+        unsigned room = FCI_RX_RING_SIZE - (f->in_wr - f->in_rd);
+        if (room == 0) break;
+        unsigned wr = f->in_wr % FCI_RX_RING_SIZE;
+        
+        struct iovec iov[2];
+        int iovcnt = 1;
+        iov[0].iov_base = ring + wr;
+        if (wr + room > FCI_RX_RING_SIZE) {
+            iov[0].iov_len = FCI_RX_RING_SIZE - wr;
+            iov[1].iov_base = ring;
+            iov[1].iov_len = room - iov[0].iov_len;
+            iovcnt = 2;
         } else {
-            //This is a log. We first need to figure out how many words it
-            //occupies
-            
-            //Figure out sizes of AXI Stream channels (in bits)
-            int TID_width = ((word>>20) & 0x3F);
-            int TDEST_width = ((word>>26) & 0x3F);
-            int TID_TDEST_sum = TID_width + TDEST_width;
-            //Size of TDATA in bytes
-            int log_len = ((word>>13) & 0x3F) + 1;
-            int tdata_words = (log_len + 3)/4;
-            
-            //Add it all up
-            int packet_words = 1 + tdata_words; //Include header word
-            if (TID_TDEST_sum > 0) packet_words++;
-            if (TID_TDEST_sum > 32) packet_words++;
-            
-            if (dbg_guv_addr >= MAX_GUVS_PER_FPGA) {
-                //ignore this message
-                rd_pos += packet_words;
-                words_to_treat -= packet_words;
-                continue;
+            iov[0].iov_len = room;
+        }
+        
+        int num_read = readv(fd, iov, iovcnt);
+        if (num_read < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break; //All done
+            *error_str = strerror(errno);
+            return -1;
+        } else if (num_read == 0) {
+            *error_str = DBG_GUV_CNX_CLOSED;
+            return -1;
+        }
+        
+        //All packets from this read get the same timestamp. No sense 
+        //asking for the time once per packet
+        uint64_t now = dbg_log_now_ns();
+        
+        //Record the raw bytes before we decode anything. If the capture
+        //file is full, the bytes are just counted in f->cap.dropped
+        if (f->cap.map != NULL) {
+            capture_write(&f->cap, now, iov, iovcnt, num_read);
+        }
+        
+        //Reads don't have to be a multiple of 4 bytes. Any leftover bytes
+        //just wait in the ring until the rest of their word shows up
+        f->in_wr += num_read;
+        decode_fpga_connection(f, now);
+        
+        //A short read means the socket is empty, so don't waste a system
+        //call just to get EAGAIN
+        if (num_read < room) break;
+    }
+    
+    return 0;
+}
+
+int read_fpga_connection(fpga_connection_info *f, int fd) {
+    if (f == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    return fill_fpga_connection(f, fd, &f->error_str);
+}
+
+//Tells the UI thread there's something in the queue. To save on system 
+//calls, only the first push after the UI thread has started draining does
+//this
+static void io_thread_notify(fpga_connection_info *f) {
+    if (atomic_exchange(&f->rxq->notify_pending, 1) == 0) {
+        uint64_t one = 1;
+        write(f->wake_fd, &one, sizeof(one));
+    }
+}
+
+//This is the whole life of the I/O thread: wait for data (or for the UI 
+//thread to tell us to quit), read it, decode it, and hand it off
+static void *fpga_io_thread(void *arg) {
+    fpga_connection_info *f = arg;
+    fci_rx_queue *q = f->rxq;
+    
+    char name[32];
+    snprintf(name, sizeof(name), "io %s", f->name ? f->name : "?");
+    trace_thread_name(name);
+    
+    struct pollfd pfds[2] = {
+        {.fd = f->stop_fd, .events = POLLIN},
+        {.fd = f->io_fd, .events = POLLIN}
+    };
+    
+    while (1) {
+        //If the UI thread isn't keeping up, stop reading from the socket
+        //and just keep trying to empty our own ring into the queue. It's 
+        //a poor man's condition variable, but this should be rare
+        int backed_up = (rxq_slot(q) == NULL);
+        int rc = poll(pfds, backed_up ? 1 : 2, backed_up ? 1 : -1);
+        if (rc < 0 && errno != EINTR) {
+            f->io_error_str = strerror(errno);
+            break;
+        }
+        if (pfds[0].revents & POLLIN) break; //Asked to quit
+        
+        if (backed_up) {
+            unsigned old_tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+            decode_fpga_connection(f, dbg_log_now_ns());
+            if (atomic_load_explicit(&q->tail, memory_order_relaxed) != old_tail) {
+                io_thread_notify(f);
             }
-            
-            //By the way, grab the value of TLAST from the header before we
-            //discard it
-            uint32_t TLAST = (word>>19) & 1;
-            
-            //Check if we have enough words left in the buffer to treat this
-            //entire flit. If not, then we'll shift the "straggler" words 
-            //down to the beginning of the read buffer, and break from the
-            //loop
-            if (words_to_treat < packet_words) {
-                //Shift these entries down in the buffer. Ugly, but it works
-                int i;
-                for (i = 0; i < words_to_treat; i++) {
-                    f->in_buf[i] = *rd_pos++;
+            continue;
+        }
+        
+        if (pfds[1].revents == 0) continue;
+        
+        unsigned old_tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        char const *err = NULL;
+        TRACE(TR_IO_READ, TRACE_BEGIN, f->io_fd);
+        rc = fill_fpga_connection(f, f->io_fd, &err);
+        TRACE(TR_IO_READ, TRACE_END, f->io_fd);
+        if (atomic_load_explicit(&q->tail, memory_order_relaxed) != old_tail) {
+            io_thread_notify(f);
+        }
+        if (rc < 0) {
+            f->io_error_str = err;
+            break;
+        }
+    }
+    
+    //Let the UI thread know if we died on our own
+    if (f->io_error_str != NULL) {
+        atomic_store_explicit(&q->dead, 1, memory_order_release);
+        uint64_t one = 1;
+        write(f->wake_fd, &one, sizeof(one));
+    }
+    
+    return NULL;
+}
+
+int fpga_start_io_thread(fpga_connection_info *f, int fd) {
+    if (f == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    if (f->io_running) {
+        f->error_str = DBG_GUV_IO_THREAD_RUNNING;
+        return -1;
+    }
+    
+    //Only allocate the queue once. It's big, and most people won't ever
+    //turn this on
+    if (f->rxq == NULL) {
+        f->rxq = malloc(sizeof(fci_rx_queue));
+        if (f->rxq == NULL) {
+            f->error_str = DBG_GUV_OOM;
+            return -1;
+        }
+    }
+    atomic_init(&f->rxq->head, 0);
+    atomic_init(&f->rxq->tail, 0);
+    atomic_init(&f->rxq->notify_pending, 0);
+    atomic_init(&f->rxq->dead, 0);
+    
+    f->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (f->wake_fd < 0) {
+        f->error_str = strerror(errno);
+        return -1;
+    }
+    f->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (f->stop_fd < 0) {
+        f->error_str = strerror(errno);
+        close(f->wake_fd);
+        return -1;
+    }
+    
+    f->io_fd = fd;
+    f->io_error_str = NULL;
+    f->io_running = 1;
+    
+    int rc = pthread_create(&f->io_thread, NULL, fpga_io_thread, f);
+    if (rc != 0) {
+        f->error_str = strerror(rc);
+        f->io_running = 0;
+        close(f->wake_fd);
+        close(f->stop_fd);
+        return -1;
+    }
+    
+    f->error_str = DBG_GUV_SUCC;
+    return 0;
+}
+
+int fpga_drain_io_thread(fpga_connection_info *f) {
+    if (f == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    if (f->rxq == NULL) {
+        f->error_str = DBG_GUV_SUCC;
+        return 0; //Nothing to do
+    }
+    fci_rx_queue *q = f->rxq;
+    
+    //Clear the notification first. Anything pushed after this point will
+    //send a new one, so nothing can get stranded
+    if (f->io_running) {
+        uint64_t cnt;
+        read(f->wake_fd, &cnt, sizeof(cnt));
+    }
+    atomic_store(&q->notify_pending, 0);
+    
+    unsigned head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    uint64_t now = dbg_log_now_ns(); //For latency stats
+    while (head != tail) {
+        fci_rx_evt *evt = q->evts + (head % FCI_RX_QUEUE_SIZE);
+        
+        if (evt->is_receipt) {
+            deliver_receipt(f, evt->addr, evt->receipt);
+        } else {
+            f->rx_logs++;
+            dbg_guv *d = fpga_get_guv(f, evt->addr);
+            if (d != NULL) {
+                //Copy it into the guv's ring if we can. Otherwise, the
+                //manager still gets to see it
+                dbg_log_rec *rec = dbg_log_reserve(&d->logs);
+                if (rec != NULL) {
+                    *rec = evt->rec;
+                    deliver_log(d, rec, 1);
+                } else {
+                    f->error_str = d->logs.error_str;
+                    deliver_log(d, &evt->rec, 0);
                 }
-                f->in_buf_pos = i;
-                break;
-            }
-            
-            //We shift our read position past the header now that we're done
-            //with it
-            rd_pos++;
-            words_to_treat--;
-            
-            dbg_guv *d = f->guvs + dbg_guv_addr;
-            
-            uint32_t TID, TDEST;
-            
-            //This is the ugly business of how TDEST and TID are encoded in
-            //the packet. 
-            if (TID_TDEST_sum > 0 && TID_TDEST_sum <= 32) {
-                //TDEST and TID are in a single word
-                word = *rd_pos++;
-                words_to_treat--;
-                
-                TID = word>>TDEST_width;
-                TDEST = word & ((1 << TDEST_width) - 1);
-            } else if (TID_TDEST_sum > 32) {
-                //TDEST and TID are in separate words
-                word = *rd_pos++;
-                words_to_treat--;
-                TID = word;
-                
-                word = *rd_pos++;
-                words_to_treat--;
-                TDEST = word;
-            }
-            
-            //Why the hell not? Add the current time into the dbg_guv window
-            time_t tm;
-            time(&tm);
-            char *time_str = strdup(ctime(&tm));
-            //Strip newline
-            time_str[strlen(time_str) -1] = '\0';
-            free(append_log(d, time_str));
-            
-            //Print TLAST
-            char *log = malloc(16);
-            sprintf(log, "TLAST: %d", TLAST);
-            free(append_log(d, log));
-            
-            //Print out TDEST and TID, if they are included
-            if (TID_width > 0) {
-                log = malloc(16);
-                sprintf(log, "TID:   %u", TID);
-                free(append_log(d, log));
-            }
-            if (TDEST_width > 0) {
-                log = malloc(16);
-                sprintf(log, "TDEST: %u", TDEST);
-                free(append_log(d, log));
-            }
-            
-            //Now iterate through TDATA and print it all out.
-            
-            //Special case: if the log is 4 bytes or fewer, we'll also be
-            //nice and print out the value in decimal
-            int print_dec = (log_len <= 4);
-            
-            //Read all complete words
-            while (log_len > 4) {
-                word = *rd_pos++;
-                words_to_treat--;
-                log_len -= 4;
-                
-                log = malloc(16);
-                sprintf(log, "> %08x", word);
-                free(append_log(d, log));
-            }
-            
-            //Read partial words (if necessary)
-            if (log_len > 0) {
-                word = *rd_pos++;
-                words_to_treat--;
-                
-                //This value is right-padded, so right-shift it to the proper
-                //place value:
-                word >>= 8*(4 - log_len);
-                
-                log = malloc(32);
-                
-                int incr;
-                sprintf(log, "> %0*x%n", log_len*2, word, &incr);
-                
-                if (print_dec) sprintf(log + incr, " (%u)", word);
-                
-                free(append_log(d, log));
-            }
-            
-            //Finally, if the guv manager has hooked up a log callback, call
-            //it. 
-            if (d->ops.log != NULL) {
-                //TODO: check error code
-                #warning Error code is not checked
-                d->ops.log(d, beginning);
+                lat_stored(evt->rec.ns, now, 1);
             }
         }
+        
+        head++;
+        
+        //Give the slots back every so often, so the I/O thread isn't
+        //waiting on us for the whole batch
+        if (head % 64 == 0) {
+            atomic_store_explicit(&q->head, head, memory_order_release);
+        }
+    }
+    atomic_store_explicit(&q->head, head, memory_order_release);
+    
+    if (atomic_load_explicit(&q->dead, memory_order_acquire)) {
+        f->error_str = f->io_error_str;
+        return -1;
+    }
+    
+    f->error_str = DBG_GUV_SUCC;
+    return 0;
+}
+
+int fpga_stop_io_thread(fpga_connection_info *f) {
+    if (f == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    if (!f->io_running) {
+        f->error_str = DBG_GUV_SUCC;
+        return 0; //Nothing to do
+    }
+    
+    uint64_t one = 1;
+    write(f->stop_fd, &one, sizeof(one));
+    pthread_join(f->io_thread, NULL);
+    
+    //The thread is gone, so we own the ring again. Deliver whatever it 
+    //left in the queue before we switch back to decoding directly
+    int rc = fpga_drain_io_thread(f);
+    
+    f->io_running = 0;
+    close(f->wake_fd);
+    close(f->stop_fd);
+    
+    return rc; //f->error_str already set
+}
+
+int fpga_start_capture(fpga_connection_info *f, char const *path, size_t size) {
+    if (f == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    //The I/O thread owns the capture while it runs
+    if (f->io_running) {
+        f->error_str = DBG_GUV_IO_THREAD_RUNNING;
+        return -1;
+    }
+    
+    //Only one capture at a time
+    fpga_stop_capture(f);
+    
+    int rc = init_capture(&f->cap, path, size);
+    if (rc < 0) {
+        f->error_str = f->cap.error_str;
+        return -1;
+    }
+    
+    f->error_str = DBG_GUV_SUCC;
+    return 0;
+}
+
+int fpga_stop_capture(fpga_connection_info *f) {
+    if (f == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    if (f->io_running) {
+        f->error_str = DBG_GUV_IO_THREAD_RUNNING;
+        return -1;
+    }
+    
+    int rc = deinit_capture(&f->cap);
+    if (rc < 0) {
+        f->error_str = f->cap.error_str;
+        return -1;
+    }
+    
+    f->error_str = DBG_GUV_SUCC;
+    return 0;
+}
+
+int dbg_guv_set_filter(dbg_guv *d, char const *src, int *error_pos) {
+    if (d == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    if (src == NULL) {
+        if (d->filt != NULL) free(d->filt);
+        d->filt = NULL;
+        d->need_redraw = 1;
+        twm_request_redraw();
+        d->error_str = DBG_GUV_SUCC;
+        return 0;
+    }
+    
+    //Compile into a fresh filter so that a typo doesn't wipe out the one
+    //that's already running
+    filter *filt = malloc(sizeof(filter));
+    if (filt == NULL) {
+        d->error_str = DBG_GUV_OOM;
+        return -1;
     }
     
+    int rc = compile_filter(filt, src);
+    if (rc < 0) {
+        d->error_str = filt->error_str;
+        if (error_pos != NULL) *error_pos = filt->error_pos;
+        free(filt);
+        return -1;
+    }
+    
+    if (d->filt != NULL) free(d->filt);
+    d->filt = filt;
+    d->need_redraw = 1;
+    twm_request_redraw();
+    
+    d->error_str = DBG_GUV_SUCC;
+    return 0;
+}
+
+int dbg_guv_set_scrollback(dbg_guv *d, int nlogs) {
+    if (d == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    if (nlogs < 1 || nlogs > DBG_GUV_MAX_SCROLLBACK) {
+        d->error_str = DBG_GUV_BAD_SCROLLBACK;
+        return -1;
+    }
+    
+    int rc = dbg_log_set_cap(&d->logs, nlogs);
+    if (rc < 0) {
+        d->error_str = d->logs.error_str;
+        return -1;
+    }
+    
+    //Don't leave the view scrolled past the end
+    dbg_guv_scroll(d, 0);
+    
+    d->error_str = DBG_GUV_SUCC;
     return 0;
 }
 
-//Tries to write as much of f->out_buf as possible to the socket. This 
+//Switches d between showing flits and showing packets. Returns 0 on
+//success, -1 on error (and sets d->error_str), or -2 if d is NULL
+int dbg_guv_set_view(dbg_guv *d, dbg_guv_view view) {
+    if (d == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    if (view != DBG_GUV_VIEW_FLITS && view != DBG_GUV_VIEW_PACKETS) {
+        d->error_str = DBG_GUV_BAD_VIEW;
+        return -1;
+    }
+    
+    d->view = view;
+    d->need_redraw = 1;
+    twm_request_redraw();
+    
+    d->error_str = DBG_GUV_SUCC;
+    return 0;
+}
+
+//Turns the compressed history tier on or off for d. Turning it off throws
+//away everything that was in it. Returns 0 on success, -1 on error (and
+//sets d->error_str), or -2 if d is NULL
+int dbg_guv_set_history(dbg_guv *d, int on) {
+    if (d == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    int rc;
+    if (on) rc = dbg_log_enable_history(&d->logs);
+    else rc = dbg_log_disable_history(&d->logs);
+    if (rc < 0) {
+        d->error_str = d->logs.error_str;
+        return -1;
+    }
+    
+    //Don't leave the view scrolled past the end
+    dbg_guv_scroll(d, 0);
+    
+    d->error_str = DBG_GUV_SUCC;
+    return 0;
+}
+
+int fpga_connection_ingest(fpga_connection_info *f, char const *buf, int len) {
+    if (f == NULL || buf == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    uint64_t now = dbg_log_now_ns();
+    
+    //Same as read_fpga_connection, except memcpy plays the role of readv
+    char *ring = (char *) f->in_ring;
+    while (len > 0) {
+        int room = FCI_RX_RING_SIZE - (f->in_wr - f->in_rd);
+        int amt = (len < room) ? len : room;
+        
+        int wr = f->in_wr % FCI_RX_RING_SIZE;
+        int first = FCI_RX_RING_SIZE - wr;
+        if (first > amt) first = amt;
+        memcpy(ring + wr, buf, first);
+        memcpy(ring, buf + first, amt - first);
+        
+        f->in_wr += amt;
+        buf += amt;
+        len -= amt;
+        decode_fpga_connection(f, now);
+    }
+    
+    f->error_str = DBG_GUV_SUCC;
+    return 0;
+}
+
+//Tries to write as much of the TX queue as possible to the socket. This 
 //is non-blocking. Follows usual error return values
-//TODO: convert to writev when I get the chance
 int write_fpga_connection(fpga_connection_info *f, int fd) {
     if (f == NULL) {
         return -2; //This is all we can do
     }
     
-    //See how any contiguous bytes we can use from the circular buffer
-    int contig = f->out_buf_len;
-    if (f->out_buf_pos + f->out_buf_len > FCI_BUF_SIZE) {
-		contig = FCI_BUF_SIZE - f->out_buf_pos;
-	}
+    //Hand as much of the chain to the kernel as we can in one go
+    struct iovec iov[FCI_TX_MAX_IOV];
+    int iovcnt = 0;
+    fci_tx_seg *seg;
+    for (seg = f->tx_head; seg != NULL && iovcnt < FCI_TX_MAX_IOV; seg = seg->next) {
+        iov[iovcnt].iov_base = seg->data + seg->rd;
+        iov[iovcnt].iov_len = seg->wr - seg->rd;
+        iovcnt++;
+    }
+    
+    if (iovcnt == 0) {
+        f->error_str = DBG_GUV_SUCC;
+        return 0; //Nothing to do
+    }
 	
-	int rc = write(fd, f->out_buf + f->out_buf_pos, contig);
+	int rc = writev(fd, iov, iovcnt);
 	if (rc < 0) {
 		//Check if this is an error we should signal to the user
-		if (rc != EAGAIN && rc != EWOULDBLOCK) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
 			f->error_str = strerror(errno);
 			return -1;
 		}
@@ -446,29 +1298,59 @@ int write_fpga_connection(fpga_connection_info *f, int fd) {
 		//socket is writable. But we'll deal with this case anyway, with
 		//the caveat that well set the error string to IMPOSSIBLE
 		f->error_str = DBG_GUV_IMPOSSIBLE;
+		#warning Error code not checked
+		event_add(f->wr_ev, NULL);
 		return 0; //Nothing to do, but not an error
 	} else if (rc == 0) {
 		f->error_str = DBG_GUV_CNX_CLOSED;
 		return -1;
 	}
 	
-	//Update the position/length in the circular buffer
-	f->out_buf_len -= rc;
-	if (f->out_buf_len == 0) {
-		//Special case: since I don't a priori constrain the size of
-		//data appended into the outpu buffer, take this chance when
-		//the buffer is empty to move the position to the start. This
-		//minimizes some straddling.
-		f->out_buf_pos = 0;
-	} else {
-		f->out_buf_pos += rc;
-		f->out_buf_pos %= FCI_BUF_SIZE;
-		//Also, we need to reschedule the write event given that there
-		//is still data to send
+	//Throw away whatever got sent
+	f->tx_len -= rc;
+	while (rc > 0) {
+		seg = f->tx_head;
+		int n = seg->wr - seg->rd;
+		if (rc < n) {
+			seg->rd += rc;
+			break;
+		}
+		
+		rc -= n;
+		f->tx_head = seg->next;
+		if (f->tx_head == NULL) f->tx_tail = NULL;
+		put_tx_seg(f, seg);
+	}
+	
+	if (f->tx_len > 0) {
+		//We need to reschedule the write event given that there is still
+		//data to send
 		#warning Error code not checked
 		event_add(f->wr_ev, NULL);
 	}
 	
+	//Parked transactions go first, since they were committed before
+	//anything the waiters will send
+	if (f->tx_park_len > 0) fpga_unpark_tx(f);
+	
+	//Let anyone who was waiting for room know that they can go again.
+	//Waiting until we're down to half keeps them from waking up for every 
+	//single writev
+	if (f->tx_blocked > 0 && f->tx_park_len == 0 && f->tx_len <= f->tx_limit/2) {
+		int i;
+		for (i = 0; i < MAX_GUVS_PER_FPGA && f->tx_blocked > 0; i++) {
+			dbg_guv *d = f->guvs[i];
+			if (d == NULL || !d->tx_blocked) continue;
+			
+			d->tx_blocked = 0;
+			f->tx_blocked--;
+			if (d->ops.tx_ready != NULL) {
+				#warning Error code is not checked
+				d->ops.tx_ready(d);
+			}
+		}
+	}
+	
 	f->error_str = DBG_GUV_SUCC;
 	return 0;
 }
@@ -478,7 +1360,30 @@ int write_fpga_connection(fpga_connection_info *f, int fd) {
 void dbg_guv_set_name(dbg_guv *d, char *name) {
     if (d->name != NULL) free(d->name);
     d->name = strdup(name);
+    d->stats.name = d->name;
     d->need_redraw = 1;
+    d->stats.need_redraw = 1;
+    if (d->parent != NULL) dash_guv_changed(&d->parent->dash, d->addr);
+    twm_request_redraw();
+}
+
+//Fills status (which needs room for 8 chars) with the little status icons
+//from the title bar: '|', then F (inj_failed), dout_not_rdy_cnt, P, L/l,
+//D/d and V. They're all question marks before the first receipt
+void dbg_guv_status(dbg_guv const *d, char *status) {
+    if (d->values_unknown) {
+        strcpy(status, "|??????");
+        return;
+    }
+    
+    status[0] = '|';
+    status[1] = d->inj_failed ? 'F' : '-';
+    status[2] = '0' + d->dout_not_rdy_cnt; //Not super robust, but whatever
+    status[3] = d->keep_pausing ? 'P' : '-';
+    status[4] = d->keep_logging ? 'L' : (d->log_cnt != 0 ? 'l' : '-');
+    status[5] = d->keep_dropping ? 'D' : (d->drop_cnt != 0 ? 'd' : '-');
+    status[6] = d->inj_TVALID ? 'V' : '-';
+    status[7] = '\0';
 }
 
 //Returns number of bytes added into buf, or -1 on error.
@@ -497,21 +1402,13 @@ int draw_fn_dbg_guv(void *item, int x, int y, int w, int h, char *buf) {
     
     //Construct the little status icons
     char status[8];
-    status[0] = '|';
-    status[1] = d->inj_failed ? 'F' : '-';
-    status[2] = '0' + d->dout_not_rdy_cnt; //Not super robust, but whatever
-    status[3] = d->keep_pausing ? 'P' : '-';
-    status[4] = d->keep_logging ? 'L' : (d->log_cnt != 0 ? 'l' : '-');
-    status[5] = d->keep_dropping ? 'D' : (d->drop_cnt != 0 ? 'd' : '-');
-    status[6] = d->inj_TVALID ? 'V' : '-';
-    status[7] = '\0';
-    static char const *const unknown = "|??????";
+    dbg_guv_status(d, status);
     
     int incr = cursor_pos_cmd(buf, x, y);
     buf += incr;
     
     //Print the title bar
-    sprintf(buf, "%-*.*s%s%n", w - 7, w - 7, d->name, (d->values_unknown ? unknown : status), &incr);
+    sprintf(buf, "%-*.*s%s%n", w - 7, w - 7, d->name, status, &incr);
     buf += incr;
     //Turn off inverted video
     *buf++ = '\e'; *buf++ = '['; *buf++ = '2'; *buf++ = '7'; *buf++ = 'm';
@@ -520,6 +1417,21 @@ int draw_fn_dbg_guv(void *item, int x, int y, int w, int h, char *buf) {
     h--;
     y++;
     
+    //If there's a filter, say so (otherwise it's really confusing when
+    //logs go missing)
+    if (d->filt != NULL && h > 0) {
+        incr = cursor_pos_cmd(buf, x, y);
+        buf += incr;
+        char line[FILTER_MAX_SRC + 64];
+        snprintf(line, sizeof(line), "Filter: %s (kept %lu, dropped %lu)", 
+            d->filt->src, d->filt->kept, d->filt->dropped
+        );
+        sprintf(buf, "%-*.*s%n", w, w, line, &incr);
+        buf += incr;
+        h--;
+        y++;
+    }
+    
     //Check how many lines the manager wants
     if (d->ops.lines_req == NULL || d->ops.draw_ops.draw_fn == NULL) {
         d->error_str = DBG_GUV_NULL_CB;
@@ -536,10 +1448,17 @@ int draw_fn_dbg_guv(void *item, int x, int y, int w, int h, char *buf) {
         h -= mgr_lines;
     }
     
-    //Now simply draw the linebuf in the remaining space, if there is 
-    //any
-    if (h > 0) {
-		incr = draw_linebuf(&d->logs, d->log_pos, x, y, w, h, buf);
+    //Now simply draw the logs in the remaining space, if there is any
+    if (h > 0 && d->view == DBG_GUV_VIEW_PACKETS) {
+        incr = draw_reasm(&d->pkts, &d->logs, d->pkt_pos, x, y, w, h, buf);
+        
+        if (incr < 0) {
+            d->error_str = d->pkts.error_str;
+            return -1;
+        }
+        buf += incr;
+    } else if (h > 0) {
+		incr = draw_dbg_log(&d->logs, d->log_pos, x, y, w, h, buf);
 		
 		if (incr < 0) {
 			//Propagate error, not that it really matters...
@@ -550,6 +1469,9 @@ int draw_fn_dbg_guv(void *item, int x, int y, int w, int h, char *buf) {
 	}
     
     d->need_redraw = 0;
+    //Whether or not there was room for it, the filter line is up to date
+    d->filt_stale = 0;
+    d->filt_drawn_ns = dbg_log_now_ns();
     
     return buf - buf_saved;
 }
@@ -560,6 +1482,15 @@ int draw_sz_dbg_guv(void *item, int w, int h) {
     dbg_guv *d = (dbg_guv*) item;
     if (!d) return -1;
     
+    //Filter counters that changed on their own are redrawn at most once
+    //per DBG_GUV_FILT_PERIOD_NS. Until then, ask to be woken up
+    if (d->filt_stale && d->need_redraw == 0) {
+        uint64_t now = dbg_log_now_ns();
+        uint64_t due = d->filt_drawn_ns + DBG_GUV_FILT_PERIOD_NS;
+        if (now >= due) d->need_redraw = 1;
+        else twm_request_redraw_in(due - now);
+    }
+    
     if (d->need_redraw == 0) return 0; //Nothing to draw!
     
     int total_sz = 0;
@@ -582,7 +1513,7 @@ int draw_sz_dbg_guv(void *item, int w, int h) {
     
     int log_sz = 10 + w; //Bytes needed to move the cursor to a line, plus the length of a line
     
-    total_sz += (h-1) * log_sz; //We draw h-1 lines from the linebuf, since the first line is a title bar
+    total_sz += (h-1) * log_sz; //We draw h-1 lines from the logs, since the first line is a title bar
     
     return total_sz;
 }
@@ -596,14 +1527,26 @@ void trigger_redraw_dbg_guv(void *item) {
     d->need_redraw = 1;
 }
 
-//Simply scrolls the linebuf; positive for up, negative for down. A special
-//check in this function, along with a more robust check in draw_linebuf, 
+//Simply scrolls the logs; positive for up, negative for down. A special
+//check in this function, along with a more robust check in draw_dbg_log, 
 //make sure that you won't read out of bounds.
 void dbg_guv_scroll(dbg_guv *d, int amount) {
+    if (d->view == DBG_GUV_VIEW_PACKETS) {
+        d->pkt_pos += amount;
+        int npkts = reasm_npkts(&d->pkts);
+        if (d->pkt_pos >= npkts) d->pkt_pos = npkts - 1;
+        if (d->pkt_pos < 0) d->pkt_pos = 0;
+        d->need_redraw = 1;
+        twm_request_redraw();
+        return;
+    }
+    
     d->log_pos += amount;
+    int nlines = dbg_log_total_lines(&d->logs);
+    if (d->log_pos >= nlines) d->log_pos = nlines - 1;
     if (d->log_pos < 0) d->log_pos = 0;
-    if (d->log_pos >= d->logs.nlines) d->log_pos = d->logs.nlines - 1;
     d->need_redraw = 1;
+    twm_request_redraw();
 }
 
 draw_operations const dbg_guv_draw_ops = {
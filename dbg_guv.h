@@ -3,8 +3,16 @@
 
 #include <event2/event.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include "textio.h"
 #include "twm.h"
+#include "dbg_log.h"
+#include "capture.h"
+#include "filter.h"
+#include "reasm.h"
+#include "stats.h"
+#include "dash.h"
 
 //The trick here is that the register names will match to the correct
 //register address in the enum.
@@ -53,8 +61,12 @@ typedef int lines_req_fn(struct _dbg_guv *owner, int w, int h);
 typedef int cmd_receipt_fn(struct _dbg_guv *owner, uint32_t receipt);
 
 //A manager can supply this callback if it wishes to be notified about 
-//logs from a dbg_guv
-typedef int log_fn(struct _dbg_guv *owner, uint32_t const *log);
+//logs from a dbg_guv. The record is only valid for the duration of the call
+typedef int log_fn(struct _dbg_guv *owner, dbg_log_rec const *log);
+
+//If a manager was told to wait for room in the FPGA's TX queue (see 
+//fpga_tx_wait), this is called once there's room again
+typedef int tx_ready_fn(struct _dbg_guv *owner);
 
 //Also allow a timonier the chance to clean itself up
 typedef void cleanup_mgr_fn(struct _dbg_guv *owner);
@@ -65,6 +77,7 @@ typedef struct _guv_operations {
     lines_req_fn *lines_req;
     cmd_receipt_fn *cmd_receipt;
     log_fn *log;
+    tx_ready_fn *tx_ready;
     draw_operations draw_ops;
     cleanup_mgr_fn *cleanup_mgr;
 } guv_operations;
@@ -72,14 +85,30 @@ typedef struct _guv_operations {
 //To fix circular definition of dbg_guv and fpga_connection_info
 struct _fpga_connection_info;
 
-#define DBG_GUV_SCROLLBACK 512
+#define DBG_GUV_SCROLLBACK 512 //Default; can be changed per guv at runtime
+#define DBG_GUV_MAX_SCROLLBACK 50000000 //Keeps the line count in an int
 #define DBG_GUV_ADDR_WIDTH 12 //This is a constant from the hardware
+#define DBG_GUV_FILT_PERIOD_NS 250000000ull //How often the filter counters
+                                            //alone can cause a redraw
+
+//What the log area of a dbg_guv shows
+typedef enum _dbg_guv_view {
+    DBG_GUV_VIEW_FLITS,   //Every flit, one field per line
+    DBG_GUV_VIEW_PACKETS  //Flits stitched together by TLAST, one per line
+} dbg_guv_view;
+
 //This struct contains all the state associated with displaying dbg_guv
 // information.
 typedef struct _dbg_guv {
     //Stores messages received from FGPAs
-    linebuf logs;
+    dbg_log logs;
     int log_pos;
+    
+    //The same logs, reassembled into packets. This sees every log, even
+    //the ones the filter throws away
+    reasm pkts;
+    int pkt_pos;
+    dbg_guv_view view;
     char *name;
     int need_redraw;
     
@@ -105,45 +134,150 @@ typedef struct _dbg_guv {
     unsigned inj_failed;
     unsigned dout_not_rdy_cnt;
     
+    //What we think the hardware's scratch registers hold right now. Bit i
+    //of shadow_valid is set if shadow[i] is known. This is what lets a 
+    //dbg_guv_txn skip writes that wouldn't change anything
+    uint32_t shadow[16];
+    unsigned shadow_valid;
+    //Receipts only refresh the shadows once every LATCH we sent has been
+    //answered, and never for registers written since the last LATCH (the
+    //receipt doesn't know about those yet)
+    unsigned latches_in_flight;
+    unsigned shadow_written;
+    
+    //Set by fpga_tx_wait
+    int tx_blocked;
+    
+    //If non-NULL, only logs that match this filter are kept in the 
+    //scrollback. The manager still sees every log
+    filter *filt;
+    //Logs the filter throws away only change its counters, which aren't
+    //worth a frame each. filt_stale means the counters on screen are out
+    //of date, and they get redrawn once filt_drawn_ns is a period old
+    int filt_stale;
+    uint64_t filt_drawn_ns;
+    
     //The user can select one of several modes for operating the dbg_guv.
     //This is done by passing a set of function pointers into the dbg_guv
     //struct that will get triggered at various times
     guv_operations ops;
     void *mgr;
     
+    //If not NULL, the manager needs every receipt to be one it asked for
+    //(e.g. fio with flits in flight), so register writes typed by the user
+    //are refused. This says why
+    char const *busy_str;
+    
     //Address information for this dbg_guv
     struct _fpga_connection_info *parent;
     int addr; 
     
     //Error information
     char const *error_str;
+    
+    //Live traffic numbers. This is also the item for the guv's stats pane.
+    //It's big, so it goes last to keep the fields above close together
+    guv_stats stats;
 } dbg_guv;
 
 #define MAX_GUVS_PER_FPGA 1024
-#define FCI_BUF_SIZE 512
+
+//Incoming bytes go into a ring. Since the size is a power of two (and a
+//multiple of 4), a word-aligned position never straddles the wrap, so 
+//packets can be decoded in place. 
+#define FCI_RX_RING_SIZE (64*1024) //In bytes
+#define FCI_RX_RING_WORDS (FCI_RX_RING_SIZE/4)
+#define FCI_RX_MAX_READS 16 //Most reads in one callback, so that one busy
+                            //FPGA doesn't starve everything else
+//Gets the word at free-running byte position pos
+#define FCI_RX_WORD(f, pos) ((f)->in_ring[((pos)/4) & (FCI_RX_RING_WORDS - 1)])
+
+//Outgoing data is queued in a chain of fixed-size segments. The chain grows
+//as needed up to tx_limit bytes, and the whole thing is drained with one
+//writev()
+#define FCI_TX_SEG_SIZE 4096
+#define FCI_TX_DEFAULT_LIMIT (256*1024)
+#define FCI_TX_MAX_IOV 16 //Most segments we'll hand to a single writev()
+//Transactions that don't fit under tx_limit are parked (up to this many
+//bytes) and queued by write_fpga_connection as the socket drains, so that
+//small producers like user commands never fail just because the link is
+//busy. Big producers (the windowed fio sender) still back off on their own
+//with fpga_tx_room/fpga_tx_wait
+#define FCI_TX_PARK_MAX (64*1024)
+typedef struct _fci_tx_seg {
+    struct _fci_tx_seg *next;
+    int rd, wr; //Bytes in [rd,wr) are waiting to be sent
+    char data[FCI_TX_SEG_SIZE];
+} fci_tx_seg;
+//If an FPGA has its own I/O thread (see fpga_start_io_thread), decoded
+//packets are passed to the UI thread through this single-producer single-
+//consumer queue. Guvs are only ever touched by the UI thread
+#define FCI_RX_QUEUE_SIZE 4096 //Must be a power of two
+typedef struct _fci_rx_evt {
+    int is_receipt;
+    int addr;
+    uint32_t receipt; //Only valid for receipts
+    dbg_log_rec rec; //Only valid for logs
+} fci_rx_evt;
+typedef struct _fci_rx_queue {
+    //Free-running counters, kept on separate cache lines so the two
+    //threads don't fight over them
+    _Alignas(64) atomic_uint head; //Only written by the UI thread
+    _Alignas(64) atomic_uint tail; //Only written by the I/O thread
+    _Alignas(64) atomic_int notify_pending; //Set when wake_fd has been poked
+    atomic_int dead; //Set when the I/O thread quits because of an error
+    fci_rx_evt evts[FCI_RX_QUEUE_SIZE];
+} fci_rx_queue;
 typedef struct _fpga_connection_info {    
     //For each dbg_guv, keep a local mirror of its control regs. These 
-    //structs also contain the log buffer
-    dbg_guv guvs[MAX_GUVS_PER_FPGA];
+    //structs also contain the log buffer. Only a handful of addresses are
+    //ever used, so entries stay NULL until fpga_get_guv creates them
+    dbg_guv *guvs[MAX_GUVS_PER_FPGA];
+    int num_guvs;
     
     //Fields for reading from socket
     struct event *rd_ev; 
-    uint32_t in_buf[FCI_BUF_SIZE]; //If a message straddles two network 
-                                   //packets, this buffer will hold on to 
-                                   //partially received messages.
-    int in_buf_pos;                //Position in input buffer.
+    uint32_t in_ring[FCI_RX_RING_WORDS]; //If a message straddles two 
+                                         //reads, the partial message just 
+                                         //waits here for the rest of it
+    unsigned in_rd, in_wr; //Free-running byte counters. The difference is
+                           //how many bytes are waiting to be decoded
+    unsigned long rx_receipts, rx_logs; //Number of packets decoded so far
+    capture cap; //If cap.map is non-NULL, every byte read is also recorded
+    
+    //Fields for the optional I/O thread. While it runs, it owns the socket
+    //reading, in_ring and cap, and the UI thread must not call 
+    //read_fpga_connection
+    int io_running;
+    pthread_t io_thread;
+    int io_fd; //Socket the thread reads from
+    int wake_fd; //eventfd: readable when there's something to drain
+    int stop_fd; //eventfd: poked by the UI thread to make the thread quit
+    struct event *wake_ev; //Not created or freed by this code
+    fci_rx_queue *rxq; //Allocated the first time the thread is started
+    char const *io_error_str; //Why the thread died
     
     //Fields for writing to socket
     struct event *wr_ev;
-    char out_buf[FCI_BUF_SIZE]; //Ring buffer of data to send on the
-                                //socket when it is next available.
-    int out_buf_pos, out_buf_len;
+    fci_tx_seg *tx_head, *tx_tail; //Data to send on the socket when it is
+                                   //next available
+    fci_tx_seg *tx_spare; //Keep one empty segment around so that we aren't
+                          //constantly calling malloc and free
+    int tx_len; //Total number of bytes queued
+    int tx_limit; //Producers are refused past this many bytes
+    int tx_blocked; //Number of guvs waiting in fpga_tx_wait
+    uint32_t *tx_park; //Parked transactions, each one a word count and
+                       //then the words themselves (oldest first)
+    int tx_park_len, tx_park_cap; //In words
     
     //Name used in symbol table
     char *name;
     
     //Error information
     char const* error_str;
+    
+    //One-cell-per-guv overview. This is also the item for its pane
+    guv_dash dash;
 } fpga_connection_info;
 
 //Returns a newly allocated and constructed fpga_connection_info struct,
@@ -154,25 +288,131 @@ fpga_connection_info* new_fpga_connection();
 //Cleans up an FPGA connection. Gracefully ignores NULL input
 void del_fpga_connection(fpga_connection_info *f);
 
-//Returns string which was displaced by new log. This can be NULL. NOTE: 
-//do NOT call this function if you are holding a mutex! By the way, does NOT
-//make an internal copy of the string; you must copy it yourself if this is
-//desired
-char *append_log(dbg_guv *d, char *log);
+//Returns the dbg_guv at addr, creating it if this is the first time anyone
+//has asked for it. Returns NULL on error (and sets f->error_str)
+dbg_guv* fpga_get_guv(fpga_connection_info *f, int addr);
 
 //Enqueues the given data, which will be sent when the socket becomes 
-//ready next. Returns -1 and sets f->error_str on error, or 0 on success.
-//(Returns -2 if f was NULL)
+//ready next. Either all of the data is queued or none of it is. Returns -1 
+//and sets f->error_str on error, or 0 on success. (Returns -2 if f was NULL)
 int fpga_enqueue_tx(fpga_connection_info *f, char const *buf, int len);
 
+//Returns the number of bytes that can still be queued before 
+//fpga_enqueue_tx starts refusing data
+int fpga_tx_room(fpga_connection_info const *f);
+
+//Asks for d->ops.tx_ready to be called once the TX queue has drained to
+//half of its limit. This is how producers like the fio manager back off
+//instead of erroring out when the network can't keep up
+void fpga_tx_wait(fpga_connection_info *f, dbg_guv *d);
+
+//Changes the most bytes that can be queued for sending. Returns 0 on 
+//success, -1 on error (and sets f->error_str), or -2 if f was NULL
+int fpga_set_tx_limit(fpga_connection_info *f, int limit);
+
+//A batch of register writes (and LATCHes) for one or more guvs on the same
+//FPGA. Nothing is sent until dbg_guv_txn_commit, which either queues the
+//whole batch or none of it. Along the way, writes that can't possibly make
+//a difference are dropped:
+// - A write to a register that already holds that value is skipped. We
+//   only keep shadows of the registers reported in command receipts. This
+//   is turned off for dbg_guv_send_cmd, since that's what user commands
+//   go through and they should always go out
+// - A second write to the same register before the next LATCH replaces
+//   the first one
+//Neither of these apply to the INJ_TDATA/TKEEP/TDEST/TID registers, since
+//wide values are shifted into those a word at a time.
+#define DBG_GUV_TXN_MAX_CMDS 32
+typedef struct _dbg_guv_txn {
+    fpga_connection_info *f;
+    
+    struct {
+        dbg_guv *d;
+        dbg_reg_type reg;
+        uint32_t param;
+    } cmds[DBG_GUV_TXN_MAX_CMDS];
+    int num_cmds;
+    
+    int use_shadows; //Set by dbg_guv_txn_begin
+    
+    //Error information
+    char const *error_str;
+} dbg_guv_txn;
+
+//Starts an empty transaction for guvs on f
+void dbg_guv_txn_begin(dbg_guv_txn *txn, fpga_connection_info *f);
+
+//Stages a register write (or a LATCH, in which case param is ignored). 
+//Returns 0 on success, -1 on error (and sets txn->error_str), or -2 if txn
+//was NULL
+int dbg_guv_txn_write(dbg_guv_txn *txn, dbg_guv *d, dbg_reg_type reg, uint32_t param);
+
+//Queues everything staged in txn for output in one go. On error, nothing
+//is queued. Returns 0 on success, -1 on error (and sets txn->error_str), 
+//or -2 if txn was NULL
+int dbg_guv_txn_commit(dbg_guv_txn *txn);
+
 //TODO: remove hardcoded widths
-//Constructs a dbg_guv commadn and queues it for output by calling
-//fpga_enequeue_tx
+//Shorthand for a transaction with a single command in it. The write is
+//always sent, even if the shadow says it wouldn't change anything. Returns
+//0 on success or -1 on error (and sets d->parent->error_str)
 int dbg_guv_send_cmd(dbg_guv *d, dbg_reg_type reg, uint32_t param);
 
 int read_fpga_connection(fpga_connection_info *f, int fd);
 
-//Tries to write as much of f->out_buf as possible to the socket. This 
+//Starts recording everything this FPGA sends into a capture file (see
+//capture.h) of at most size bytes. Returns 0 on success, -1 on error (and
+//sets f->error_str), or -2 if f was NULL
+int fpga_start_capture(fpga_connection_info *f, char const *path, size_t size);
+
+//Stops the capture, if one is running. Returns 0 on success, -1 on error
+//(and sets f->error_str), or -2 if f was NULL
+int fpga_stop_capture(fpga_connection_info *f);
+
+//Moves the socket reading and decoding for f onto its own thread, so that
+//a busy UI can't make the kernel buffers back up. The caller must stop 
+//calling read_fpga_connection, and should instead call 
+//fpga_drain_io_thread whenever f->wake_fd is readable. Returns 0 on 
+//success, -1 on error (and sets f->error_str), or -2 if f was NULL
+int fpga_start_io_thread(fpga_connection_info *f, int fd);
+
+//Delivers everything the I/O thread has decoded to the guvs. Returns 0 on
+//success, -1 if the I/O thread died (and sets f->error_str to the reason),
+//or -2 if f was NULL
+int fpga_drain_io_thread(fpga_connection_info *f);
+
+//Stops the I/O thread (if it's running) and delivers anything it left 
+//behind. Afterwards, the caller should go back to read_fpga_connection.
+//Same return values as fpga_drain_io_thread
+int fpga_stop_io_thread(fpga_connection_info *f);
+
+//Compiles src and makes it d's log filter. If src is NULL, removes the
+//filter instead. Returns 0 on success, -1 on error (and sets d->error_str;
+//for compile errors, *error_pos is set to where it went wrong if error_pos
+//isn't NULL), or -2 if d was NULL
+int dbg_guv_set_filter(dbg_guv *d, char const *src, int *error_pos);
+
+//Changes how many logs d keeps in its scrollback. The memory comes out of
+//the budget shared by all guvs (see dbg_log.h). Returns 0 on success, -1
+//on error (and sets d->error_str), or -2 if d is NULL
+int dbg_guv_set_scrollback(dbg_guv *d, int nlogs);
+
+//Switches d between showing flits and showing packets. Returns 0 on
+//success, -1 on error (and sets d->error_str), or -2 if d is NULL
+int dbg_guv_set_view(dbg_guv *d, dbg_guv_view view);
+
+//Turns the compressed history tier on or off for d. Turning it off throws
+//away everything that was in it. Returns 0 on success, -1 on error (and
+//sets d->error_str), or -2 if d is NULL
+int dbg_guv_set_history(dbg_guv *d, int on);
+
+//Pushes len bytes of FPGA->host stream through exactly the same decoding
+//and dispatch as read_fpga_connection, but from memory instead of a socket.
+//This is what the replay tool uses. Returns 0 on success or -2 if f or buf
+//was NULL
+int fpga_connection_ingest(fpga_connection_info *f, char const *buf, int len);
+
+//Tries to write as much of the TX queue as possible to the socket. This 
 //is non-blocking. Follows usual error return values
 int write_fpga_connection(fpga_connection_info *f, int fd);
 
@@ -180,6 +420,11 @@ int write_fpga_connection(fpga_connection_info *f, int fd);
 //will be freed
 void dbg_guv_set_name(dbg_guv *d, char *name);
 
+//Fills status (which needs room for 8 chars) with the little status icons
+//from the title bar: '|', then F (inj_failed), dout_not_rdy_cnt, P, L/l,
+//D/d and V. They're all question marks before the first receipt
+void dbg_guv_status(dbg_guv const *d, char *status);
+
 //Returns number of bytes added into buf, or -1 on error.
 int draw_fn_dbg_guv(void *item, int x, int y, int w, int h, char *buf);
 
@@ -192,7 +437,7 @@ int draw_sz_dbg_guv(void *item, int w, int h);
 void trigger_redraw_dbg_guv(void *item);
 
 //Simply scrolls the dbg_guv; positive for up, negative for down. A special
-//check in this function, along with a more robust check in draw_linebuf, 
+//check in this function, along with a more robust check in draw_dbg_log, 
 //make sure that you won't read out of bounds.
 void dbg_guv_scroll(dbg_guv *d, int amount);
 
@@ -211,5 +456,12 @@ extern char const *const DBG_GUV_BAD_ADDRESS; //= "could not resolve address";
 extern char const *const DBG_GUV_OOM; //= "out of memory";
 extern char const *const DBG_GUV_NOT_ENOUGH_SPACE; //= "not enough room in buffer";
 extern char const *const DBG_GUV_INCOMPLETE_WORD; // = "received non-multiple-of-4 number of bytes";
+extern char const *const DBG_GUV_ADDR_RANGE; // = "dbg_guv address out of range";
+extern char const *const DBG_GUV_TXN_FULL; // = "too many commands in transaction";
+extern char const *const DBG_GUV_WRONG_FPGA; // = "dbg_guv is not on this transaction's FPGA";
+extern char const *const DBG_GUV_BAD_LIMIT; // = "TX limit must be at least one segment";
+extern char const *const DBG_GUV_IO_THREAD_RUNNING; // = "not allowed while the I/O thread is running";
+extern char const *const DBG_GUV_BAD_SCROLLBACK; // = "scrollback must be between 1 and 50000000 logs";
+extern char const *const DBG_GUV_BAD_VIEW; // = "no such view";
 
 #endif
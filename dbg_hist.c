@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dbg_hist.h"
+
+char const *const DBG_HIST_SUCC = "success";
+char const *const DBG_HIST_OOM = "out of memory";
+char const *const DBG_HIST_OUT_OF_RANGE = "no such record in history";
+char const *const DBG_HIST_CORRUPT = "history block failed to decode";
+
+//Header byte. If HIST_RUN is set, the low 7 bits are a run length.
+//Otherwise, the other bits say which fields follow
+#define HIST_RUN       0x80
+#define HIST_SEQ       0x01 //Varint; otherwise it's the last one plus 1
+#define HIST_NS        0x02 //Varint delta; otherwise it's the same
+#define HIST_META      0x04 //TID_width, TDEST_width, TLAST, len as 4 bytes
+#define HIST_TID       0x08 //Varint
+#define HIST_TDEST     0x10 //Varint
+#define HIST_TDATA     0x20 //Word codes follow; otherwise every word is
+                            //the last value plus its step
+#define HIST_MAX_RUN   0x7F
+
+//TDATA word codes
+#define WORD_SAME   0 //Same as last time
+#define WORD_STEP   1 //Last time plus the same step as last time
+#define WORD_DELTA  2 //Zigzag varint delta from last time
+#define WORD_RAW    3 //4 bytes
+
+//Worst case for one record: header, seq, ns, meta, TID, TDEST, word codes
+//and raw words
+#define HIST_MAX_REC_BYTES (1 + 5 + 10 + 4 + 5 + 5 + 4 + 4*DBG_LOG_MAX_TDATA_WORDS)
+
+//What the encoder and decoder both remember about the previous record
+typedef struct _hist_state {
+    uint32_t seq;
+    uint64_t ns;
+    uint32_t TID, TDEST;
+    uint8_t TID_width, TDEST_width, TLAST, len;
+    uint32_t last[DBG_LOG_MAX_TDATA_WORDS];
+    uint32_t step[DBG_LOG_MAX_TDATA_WORDS];
+} hist_state;
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+//Returns NULL if the varint runs past end
+static uint8_t const *get_varint(uint8_t const *p, uint8_t const *end, uint64_t *v) {
+    uint64_t ret = 0;
+    int shift = 0;
+    while (p < end && shift < 64) {
+        uint8_t b = *p++;
+        ret |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *v = ret;
+            return p;
+        }
+        shift += 7;
+    }
+    return NULL;
+}
+
+static uint32_t zigzag(int32_t v) {
+    return ((uint32_t) v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+//Updates s after rec has been encoded or decoded
+static void hist_advance(hist_state *s, dbg_log_rec const *rec) {
+    s->seq = rec->seq;
+    s->ns = rec->ns;
+    s->TID = rec->TID;
+    s->TDEST = rec->TDEST;
+    s->TID_width = rec->TID_width;
+    s->TDEST_width = rec->TDEST_width;
+    s->TLAST = rec->TLAST;
+    s->len = rec->len;
+
+    int nwords = (rec->len + 3)/4;
+    int i;
+    for (i = 0; i < nwords; i++) {
+        s->step[i] = rec->TDATA[i] - s->last[i];
+        s->last[i] = rec->TDATA[i];
+    }
+}
+
+//Encodes rec at p and updates s to match. Returns pointer past the end of
+//what was written. If rec is exactly what a run would produce, this
+//writes a zero header byte and nothing else (i.e. returns p + 1)
+static uint8_t *hist_encode_rec(hist_state *s, dbg_log_rec const *rec, uint8_t *p) {
+    uint8_t *hdr = p++;
+    *hdr = 0;
+
+    if (rec->seq != s->seq + 1) {
+        *hdr |= HIST_SEQ;
+        p = put_varint(p, rec->seq);
+    }
+    if (rec->ns != s->ns) {
+        *hdr |= HIST_NS;
+        //Times never go backwards within a guv, but don't count on it
+        p = put_varint(p, (rec->ns - s->ns) << 1 ^ (uint64_t)((int64_t)(rec->ns - s->ns) >> 63));
+    }
+    if (rec->TID_width != s->TID_width || rec->TDEST_width != s->TDEST_width ||
+        rec->TLAST != s->TLAST || rec->len != s->len
+    ) {
+        *hdr |= HIST_META;
+        *p++ = rec->TID_width;
+        *p++ = rec->TDEST_width;
+        *p++ = rec->TLAST;
+        *p++ = rec->len;
+    }
+    if (rec->TID != s->TID) {
+        *hdr |= HIST_TID;
+        p = put_varint(p, rec->TID);
+    }
+    if (rec->TDEST != s->TDEST) {
+        *hdr |= HIST_TDEST;
+        p = put_varint(p, rec->TDEST);
+    }
+    
+    s->seq = rec->seq;
+    s->ns = rec->ns;
+    s->TID = rec->TID;
+    s->TDEST = rec->TDEST;
+    s->TID_width = rec->TID_width;
+    s->TDEST_width = rec->TDEST_width;
+    s->TLAST = rec->TLAST;
+    s->len = rec->len;
+
+    //Write the word codes optimistically, and take them back out if every
+    //word turned out to follow its step
+    int nwords = (rec->len + 3)/4;
+    int ncode_bytes = (nwords + 3)/4;
+    uint8_t *codes = p;
+    p += ncode_bytes;
+    int all_step = 1;
+    uint32_t code_bits = 0; //Kept in a register, then stored at the end
+    int i;
+    for (i = 0; i < nwords; i++) {
+        uint32_t v = rec->TDATA[i];
+        uint32_t d = v - s->last[i];
+        int code;
+        if (d == s->step[i]) {
+            code = WORD_STEP;
+        } else {
+            all_step = 0;
+            s->step[i] = d;
+            if (d == 0) {
+                code = WORD_SAME;
+            } else {
+                uint32_t z = zigzag(d);
+                if (z < (1u << 21)) {
+                    code = WORD_DELTA;
+                    p = put_varint(p, z);
+                } else {
+                    code = WORD_RAW;
+                    memcpy(p, &v, 4);
+                    p += 4;
+                }
+            }
+        }
+        s->last[i] = v;
+        code_bits |= (uint32_t) code << (2*i);
+    }
+    
+    if (all_step) return codes; //Nothing was written after the codes
+    
+    for (i = 0; i < ncode_bytes; i++) codes[i] = code_bits >> (8*i);
+    
+    *hdr |= HIST_TDATA;
+    return p;
+}
+
+//Decodes one record that isn't part of a run into rec. Returns pointer
+//past the end of what was read, or NULL if the data is bad
+static uint8_t const *hist_decode_rec(hist_state const *s, uint8_t hdr, uint8_t const *p, uint8_t const *end, dbg_log_rec *rec) {
+    uint64_t v;
+
+    if (hdr & HIST_SEQ) {
+        p = get_varint(p, end, &v);
+        if (p == NULL) return NULL;
+        rec->seq = v;
+    } else {
+        rec->seq = s->seq + 1;
+    }
+    if (hdr & HIST_NS) {
+        p = get_varint(p, end, &v);
+        if (p == NULL) return NULL;
+        rec->ns = s->ns + ((v >> 1) ^ -(v & 1));
+    } else {
+        rec->ns = s->ns;
+    }
+    if (hdr & HIST_META) {
+        if (end - p < 4) return NULL;
+        rec->TID_width = *p++;
+        rec->TDEST_width = *p++;
+        rec->TLAST = *p++;
+        rec->len = *p++;
+        if (rec->len > DBG_LOG_MAX_TDATA_BYTES) return NULL;
+    } else {
+        rec->TID_width = s->TID_width;
+        rec->TDEST_width = s->TDEST_width;
+        rec->TLAST = s->TLAST;
+        rec->len = s->len;
+    }
+    if (hdr & HIST_TID) {
+        p = get_varint(p, end, &v);
+        if (p == NULL) return NULL;
+        rec->TID = v;
+    } else {
+        rec->TID = s->TID;
+    }
+    if (hdr & HIST_TDEST) {
+        p = get_varint(p, end, &v);
+        if (p == NULL) return NULL;
+        rec->TDEST = v;
+    } else {
+        rec->TDEST = s->TDEST;
+    }
+
+    int nwords = (rec->len + 3)/4;
+    int i;
+    if (!(hdr & HIST_TDATA)) {
+        for (i = 0; i < nwords; i++) rec->TDATA[i] = s->last[i] + s->step[i];
+        return p;
+    }
+
+    uint8_t const *codes = p;
+    p += (nwords + 3)/4;
+    if (p > end) return NULL;
+    for (i = 0; i < nwords; i++) {
+        int code = (codes[i/4] >> (2*(i%4))) & 3;
+        switch (code) {
+        case WORD_SAME:
+            rec->TDATA[i] = s->last[i];
+            break;
+        case WORD_STEP:
+            rec->TDATA[i] = s->last[i] + s->step[i];
+            break;
+        case WORD_DELTA:
+            p = get_varint(p, end, &v);
+            if (p == NULL) return NULL;
+            rec->TDATA[i] = s->last[i] + unzigzag(v);
+            break;
+        default:
+            if (end - p < 4) return NULL;
+            memcpy(rec->TDATA + i, p, 4);
+            p += 4;
+            break;
+        }
+    }
+
+    return p;
+}
+
+//Decodes blk into recs (which has room for DBG_LOG_BLOCK_RECS). Returns 0
+//on success or -1 if the data is bad
+static int hist_decode_blk(dbg_hist_blk const *blk, dbg_log_rec *recs) {
+    hist_state s;
+    memset(&s, 0, sizeof(s));
+
+    uint8_t const *p = blk->data;
+    uint8_t const *end = blk->data + blk->size;
+    int n = 0;
+    while (p < end && n < blk->nrecs) {
+        uint8_t hdr = *p++;
+        if (hdr & HIST_RUN) {
+            int run = hdr & HIST_MAX_RUN;
+            if (n + run > blk->nrecs) return -1;
+            while (run--) {
+                dbg_log_rec *rec = recs + n++;
+                rec->seq = s.seq + 1;
+                rec->ns = s.ns;
+                rec->TID = s.TID;
+                rec->TDEST = s.TDEST;
+                rec->TID_width = s.TID_width;
+                rec->TDEST_width = s.TDEST_width;
+                rec->TLAST = s.TLAST;
+                rec->len = s.len;
+                int nwords = (s.len + 3)/4;
+                int i;
+                for (i = 0; i < nwords; i++) rec->TDATA[i] = s.last[i] + s.step[i];
+                for (; i < DBG_LOG_MAX_TDATA_WORDS; i++) rec->TDATA[i] = 0;
+                hist_advance(&s, rec);
+            }
+        } else {
+            dbg_log_rec *rec = recs + n++;
+            p = hist_decode_rec(&s, hdr, p, end, rec);
+            if (p == NULL) return -1;
+            int i;
+            for (i = (rec->len + 3)/4; i < DBG_LOG_MAX_TDATA_WORDS; i++) rec->TDATA[i] = 0;
+            hist_advance(&s, rec);
+        }
+    }
+
+    return (n == blk->nrecs && p == end) ? 0 : -1;
+}
+
+//Statically initialize a dbg_hist. Returns 0 on success, or -2 if h is
+//NULL
+int init_dbg_hist(dbg_hist *h) {
+    if (h == NULL) return -2; //This is all we can do
+
+    memset(h, 0, sizeof(dbg_hist));
+
+    h->error_str = DBG_HIST_SUCC;
+    return 0;
+}
+
+//Frees everything in h. Gracefully ignores NULL input
+void deinit_dbg_hist(dbg_hist *h) {
+    if (h == NULL) return;
+
+    while (h->nblks > 0) dbg_hist_drop_oldest(h);
+    if (h->blks != NULL) free(h->blks);
+    h->blks = NULL;
+    h->blks_cap = 0;
+
+    int i;
+    for (i = 0; i < DBG_HIST_CACHE_SIZE; i++) {
+        if (h->cache[i].recs != NULL) free(h->cache[i].recs);
+        h->cache[i].recs = NULL;
+        h->cache[i].valid = 0;
+    }
+}
+
+//Encodes the n records in recs (oldest first) as a new block, and returns
+//the number of bytes it took up. Returns -1 on error (and sets
+//h->error_str)
+int dbg_hist_append(dbg_hist *h, dbg_log_rec const *recs, int n) {
+    if (n <= 0) return 0;
+
+    //Make sure there's room in the index. Same trick as the dbg_log blocks
+    if (h->nblks == h->blks_cap) {
+        int new_cap = h->blks_cap ? 2*h->blks_cap : 16;
+        dbg_hist_blk *blks = malloc(new_cap * sizeof(dbg_hist_blk));
+        if (blks == NULL) {
+            h->error_str = DBG_HIST_OOM;
+            return -1;
+        }
+        int i;
+        for (i = 0; i < h->nblks; i++) {
+            blks[i] = h->blks[(h->first + i) & (h->blks_cap - 1)];
+        }
+        if (h->blks != NULL) free(h->blks);
+        h->blks = blks;
+        h->blks_cap = new_cap;
+        h->first = 0;
+    }
+
+    //Encode into a scratch buffer first, since we don't know how big it
+    //will be. Blocks are only ever DBG_LOG_BLOCK_RECS long
+    static uint8_t scratch[DBG_LOG_BLOCK_RECS * HIST_MAX_REC_BYTES];
+    if (n > DBG_LOG_BLOCK_RECS) n = DBG_LOG_BLOCK_RECS;
+
+    hist_state s;
+    memset(&s, 0, sizeof(s));
+    uint8_t *p = scratch;
+    uint64_t nlines = 0;
+    int run = 0;
+    int i;
+    for (i = 0; i < n; i++) {
+        dbg_log_rec const *rec = recs + i;
+        nlines += dbg_log_rec_nlines(rec);
+
+        //If we're in the middle of a run, leave room for the run byte in 
+        //case this record ends it
+        uint8_t *q = hist_encode_rec(&s, rec, p + (run > 0));
+        if (q == p + (run > 0) + 1 && p[run > 0] == 0) {
+            //Entirely predictable, so it just joins the run
+            run++;
+            if (run == HIST_MAX_RUN) {
+                *p++ = HIST_RUN | run;
+                run = 0;
+            }
+        } else {
+            if (run > 0) *p = HIST_RUN | run;
+            run = 0;
+            p = q;
+        }
+    }
+    if (run > 0) *p++ = HIST_RUN | run;
+
+    int size = p - scratch;
+    uint8_t *data = malloc(size);
+    if (data == NULL) {
+        h->error_str = DBG_HIST_OOM;
+        return -1;
+    }
+    memcpy(data, scratch, size);
+
+    dbg_hist_blk *blk = h->blks + ((h->first + h->nblks) & (h->blks_cap - 1));
+    blk->data = data;
+    blk->size = size;
+    blk->nrecs = n;
+    blk->start = h->end;
+    blk->line_start = h->end_line;
+    h->nblks++;
+
+    h->end += n;
+    h->end_line += nlines;
+    h->bytes += size;
+
+    h->error_str = DBG_HIST_SUCC;
+    return size;
+}
+
+//Throws away the oldest block. Returns the number of bytes freed (0 if h
+//was already empty)
+size_t dbg_hist_drop_oldest(dbg_hist *h) {
+    if (h->nblks == 0) return 0;
+
+    dbg_hist_blk *blk = h->blks + h->first;
+
+    int i;
+    for (i = 0; i < DBG_HIST_CACHE_SIZE; i++) {
+        if (h->cache[i].valid && h->cache[i].start == blk->start) h->cache[i].valid = 0;
+    }
+
+    size_t ret = blk->size;
+    free(blk->data);
+    blk->data = NULL;
+    h->bytes -= ret;
+
+    h->first = (h->first + 1) & (h->blks_cap - 1);
+    h->nblks--;
+    return ret;
+}
+
+//Number of records in h
+uint64_t dbg_hist_nrecs(dbg_hist const *h) {
+    if (h->nblks == 0) return 0;
+    return h->end - h->blks[h->first].start;
+}
+
+//Number of text lines needed to show all records in h
+uint64_t dbg_hist_nlines(dbg_hist const *h) {
+    if (h->nblks == 0) return 0;
+    return h->end_line - h->blks[h->first].line_start;
+}
+
+//Returns the block holding running record number a (if by_line is 0) or
+//running line number a (if by_line is 1). Binary search over the index
+static dbg_hist_blk *hist_find_blk(dbg_hist *h, uint64_t a, int by_line) {
+    int lo = 0, hi = h->nblks - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1)/2;
+        dbg_hist_blk *b = h->blks + ((h->first + mid) & (h->blks_cap - 1));
+        uint64_t start = by_line ? b->line_start : b->start;
+        if (start <= a) lo = mid;
+        else hi = mid - 1;
+    }
+    return h->blks + ((h->first + lo) & (h->blks_cap - 1));
+}
+
+//Returns the decoded records of blk, or NULL on error (and sets
+//h->error_str)
+static dbg_log_rec *hist_load(dbg_hist *h, dbg_hist_blk const *blk) {
+    int i;
+    for (i = 0; i < DBG_HIST_CACHE_SIZE; i++) {
+        if (h->cache[i].valid && h->cache[i].start == blk->start) {
+            h->cache[i].last_used = ++h->cache_clock;
+            return h->cache[i].recs;
+        }
+    }
+
+    //Replace an empty entry if there is one, otherwise the least recently
+    //used one
+    int victim = 0;
+    for (i = 0; i < DBG_HIST_CACHE_SIZE; i++) {
+        if (!h->cache[i].valid) {
+            victim = i;
+            break;
+        }
+        if (h->cache[i].last_used < h->cache[victim].last_used) victim = i;
+    }
+    i = victim;
+
+    if (h->cache[i].recs == NULL) {
+        h->cache[i].recs = malloc(DBG_LOG_BLOCK_RECS * sizeof(dbg_log_rec));
+        if (h->cache[i].recs == NULL) {
+            h->error_str = DBG_HIST_OOM;
+            return NULL;
+        }
+    }
+
+    h->cache[i].valid = 0;
+    if (hist_decode_blk(blk, h->cache[i].recs) < 0) {
+        h->error_str = DBG_HIST_CORRUPT;
+        return NULL;
+    }
+    h->cache[i].start = blk->start;
+    h->cache[i].valid = 1;
+    h->cache[i].last_used = ++h->cache_clock;
+    return h->cache[i].recs;
+}
+
+//Returns the i'th newest record in h (0 is the most recent), decoding its
+//block if necessary. Returns NULL on error (and sets h->error_str), or if
+//there is no such record. The pointer is good until DBG_HIST_CACHE_SIZE
+//other blocks have been decoded
+dbg_log_rec const *dbg_hist_get(dbg_hist *h, uint64_t i) {
+    if (i >= dbg_hist_nrecs(h)) {
+        h->error_str = DBG_HIST_OUT_OF_RANGE;
+        return NULL;
+    }
+
+    uint64_t a = h->end - 1 - i;
+    dbg_hist_blk *blk = hist_find_blk(h, a, 0);
+    dbg_log_rec *recs = hist_load(h, blk);
+    if (recs == NULL) return NULL;
+
+    return recs + (a - blk->start);
+}
+
+//Finds the record holding the i'th newest line in h (0 is the most recent
+//line). On success, *rec_ind is set to its index (as in dbg_hist_get) and
+//*line_ind is which of its lines it is, and 0 is returned. Returns -1 on
+//error (and sets h->error_str), or if there is no such line
+int dbg_hist_find_line(dbg_hist *h, uint64_t i, uint64_t *rec_ind, int *line_ind) {
+    if (i >= dbg_hist_nlines(h)) {
+        h->error_str = DBG_HIST_OUT_OF_RANGE;
+        return -1;
+    }
+
+    uint64_t a = h->end_line - 1 - i;
+    dbg_hist_blk *blk = hist_find_blk(h, a, 1);
+    dbg_log_rec *recs = hist_load(h, blk);
+    if (recs == NULL) return -1;
+
+    //Walk through this one block to find the record
+    uint64_t line = blk->line_start;
+    int r;
+    for (r = 0; r < blk->nrecs; r++) {
+        int n = dbg_log_rec_nlines(recs + r);
+        if (a < line + n) {
+            *rec_ind = h->end - 1 - (blk->start + r);
+            *line_ind = a - line;
+            return 0;
+        }
+        line += n;
+    }
+
+    h->error_str = DBG_HIST_CORRUPT;
+    return -1;
+}
@@ -0,0 +1,104 @@
+#ifndef DBG_HIST_H
+#define DBG_HIST_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+#include "dbg_log.h"
+
+//Compressed history tier that sits behind a dbg_log's in-memory blocks.
+//When a block of records is pushed out of memory, it gets encoded and
+//appended here instead of being thrown away.
+//
+//The encoding works one record at a time against the record before it:
+//
+//  - A header byte says which fields changed (sequence number, time,
+//    widths/TLAST/len, TID, TDEST). Unchanged fields take no space.
+//  - Each TDATA word is coded (2 bits) as "same as last time", "last time
+//    plus the same step as last time", a short varint delta, or 4 raw
+//    bytes. This covers counters and incrementing addresses.
+//  - Records that are entirely predictable (next seq, same time, every
+//    word following its step) are collapsed into a single run byte.
+//
+//Every block is encoded on its own, so any one of them can be decoded
+//without looking at the others. The block index keeps running record and
+//line counts so we can jump straight to the block that's on screen.
+
+//One encoded block
+typedef struct _dbg_hist_blk {
+    uint8_t *data;
+    int size;       //Bytes in data
+    int nrecs;
+    uint64_t start; //Running count of records before this block
+    uint64_t line_start; //Running count of lines before this block
+} dbg_hist_blk;
+
+#define DBG_HIST_CACHE_SIZE 2 //Drawing needs a record and the one before it,
+                              //which can be in different blocks
+
+typedef struct _dbg_hist {
+    dbg_hist_blk *blks; //Ring, oldest at first
+    int blks_cap;       //Always zero or a power of two
+    int first;
+    int nblks;
+
+    uint64_t end;       //Running count of records after the newest block
+    uint64_t end_line;  //Running count of lines after the newest block
+    size_t bytes;       //Memory used by encoded data
+
+    //Decoded blocks. Pointers returned by dbg_hist_get point in here
+    struct {
+        dbg_log_rec *recs; //DBG_LOG_BLOCK_RECS of them, allocated on first use
+        uint64_t start;    //Which block is in here
+        int valid;
+        unsigned last_used;
+    } cache[DBG_HIST_CACHE_SIZE];
+    unsigned cache_clock; //The least recently used entry gets replaced, so
+                          //the record you just got is never the victim
+
+    //Error information
+    char const *error_str;
+} dbg_hist;
+
+//Statically initialize a dbg_hist. Returns 0 on success, or -2 if h is
+//NULL
+int init_dbg_hist(dbg_hist *h);
+
+//Frees everything in h. Gracefully ignores NULL input
+void deinit_dbg_hist(dbg_hist *h);
+
+//Encodes the n records in recs (oldest first) as a new block, and returns
+//the number of bytes it took up. Returns -1 on error (and sets
+//h->error_str)
+int dbg_hist_append(dbg_hist *h, dbg_log_rec const *recs, int n);
+
+//Throws away the oldest block. Returns the number of bytes freed (0 if h
+//was already empty)
+size_t dbg_hist_drop_oldest(dbg_hist *h);
+
+//Number of records in h
+uint64_t dbg_hist_nrecs(dbg_hist const *h);
+
+//Number of text lines needed to show all records in h
+uint64_t dbg_hist_nlines(dbg_hist const *h);
+
+//Returns the i'th newest record in h (0 is the most recent), decoding its
+//block if necessary. Returns NULL on error (and sets h->error_str), or if
+//there is no such record. The pointer is good until DBG_HIST_CACHE_SIZE
+//other blocks have been decoded
+dbg_log_rec const *dbg_hist_get(dbg_hist *h, uint64_t i);
+
+//Finds the record holding the i'th newest line in h (0 is the most recent
+//line). On success, *rec_ind is set to its index (as in dbg_hist_get) and
+//*line_ind is which of its lines it is, and 0 is returned. Returns -1 on
+//error (and sets h->error_str), or if there is no such line
+int dbg_hist_find_line(dbg_hist *h, uint64_t i, uint64_t *rec_ind, int *line_ind);
+
+//////////////////////////////////////////////////
+//Error codes, which double as printable strings//
+//////////////////////////////////////////////////
+extern char const *const DBG_HIST_SUCC; // = "success";
+extern char const *const DBG_HIST_OOM; // = "out of memory";
+extern char const *const DBG_HIST_OUT_OF_RANGE; // = "no such record in history";
+extern char const *const DBG_HIST_CORRUPT; // = "history block failed to decode";
+
+#endif
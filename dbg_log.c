@@ -0,0 +1,600 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include "dbg_log.h"
+#include "dbg_hist.h"
+#include "textio.h"
+
+char const *const DBG_LOG_SUCC = "success";
+char const *const DBG_LOG_OOM = "out of memory";
+char const *const DBG_LOG_INVALID_PARAM = "invalid parameter";
+
+static dbg_log_time_mode time_mode = DBG_LOG_TIME_ABS;
+
+//Returns the current CLOCK_MONOTONIC time in ns. This is the clock used 
+//for dbg_log_rec.ns
+uint64_t dbg_log_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+//Changes how times are shown for every dbg_log. Takes effect the next time
+//they are drawn
+void dbg_log_set_time_mode(dbg_log_time_mode mode) {
+    time_mode = mode;
+}
+
+//Prints a duration with a sensible unit
+static int fmt_duration(char *line, int n, uint64_t ns) {
+    if (ns < 1000) {
+        return snprintf(line, n, "%lu ns", (unsigned long) ns);
+    } else if (ns < 1000000) {
+        return snprintf(line, n, "%.3f us", ns/1e3);
+    } else if (ns < 1000000000) {
+        return snprintf(line, n, "%.3f ms", ns/1e6);
+    } else {
+        return snprintf(line, n, "%.6f s", ns/1e9);
+    }
+}
+
+#define DBG_LOG_BLOCK_BYTES (DBG_LOG_BLOCK_RECS * sizeof(dbg_log_rec))
+
+//Shared by every dbg_log. Only ever touched from the UI thread
+static struct {
+    size_t used;    //In blocks
+    size_t budget;  //In blocks
+    size_t hist_used;   //In bytes
+    size_t hist_budget; //In bytes
+    dbg_log *lru_head, *lru_tail;
+} pool = {
+    .used = 0,
+    .budget = ((size_t) DBG_LOG_DEFAULT_BUDGET_MB << 20) / DBG_LOG_BLOCK_BYTES,
+    .hist_used = 0,
+    .hist_budget = (size_t) DBG_LOG_DEFAULT_HIST_MB << 20,
+    .lru_head = NULL,
+    .lru_tail = NULL
+};
+
+//Returns the r'th stored record (0 is the oldest)
+static dbg_log_rec *dbg_log_slot(dbg_log const *l, int r) {
+    int blk = (l->first_blk + (r >> DBG_LOG_BLOCK_SHIFT)) & (l->blocks_cap - 1);
+    return l->blocks[blk] + (r & (DBG_LOG_BLOCK_RECS - 1));
+}
+
+//Most blocks l will ever hold. The extra one is for the partly filled 
+//block at the new end
+static int dbg_log_max_blocks(dbg_log const *l) {
+    return (l->cap + DBG_LOG_BLOCK_RECS - 1)/DBG_LOG_BLOCK_RECS + 1;
+}
+
+static void lru_unlink(dbg_log *l) {
+    if (!l->in_lru) return;
+    
+    if (l->lru_prev) l->lru_prev->lru_next = l->lru_next;
+    else pool.lru_head = l->lru_next;
+    if (l->lru_next) l->lru_next->lru_prev = l->lru_prev;
+    else pool.lru_tail = l->lru_prev;
+    
+    l->lru_prev = NULL;
+    l->lru_next = NULL;
+    l->in_lru = 0;
+}
+
+//Moves l to the front of the LRU list
+static void lru_touch(dbg_log *l) {
+    lru_unlink(l);
+    l->lru_next = pool.lru_head;
+    if (pool.lru_head) pool.lru_head->lru_prev = l;
+    else pool.lru_tail = l;
+    pool.lru_head = l;
+    l->in_lru = 1;
+}
+
+//Returns the idlest log (other than except) that can spare a block, or NULL
+//if there isn't one
+static dbg_log *lru_victim(dbg_log const *except) {
+    dbg_log *v;
+    for (v = pool.lru_tail; v != NULL; v = v->lru_prev) {
+        if (v != except && !v->pinned && v->nblocks > 1) return v;
+    }
+    return NULL;
+}
+
+//Throws away the oldest history from the idlest logs until the history
+//tier is back under budget
+static void hist_trim() {
+    dbg_log *v = pool.lru_tail;
+    while (pool.hist_used > pool.hist_budget && v != NULL) {
+        if (v->hist != NULL && v->hist->nblks > 0) {
+            pool.hist_used -= dbg_hist_drop_oldest(v->hist);
+        } else {
+            v = v->lru_prev;
+        }
+    }
+}
+
+//Removes the oldest block from l and returns it. The block must be full,
+//which it always is unless it's the only one
+static dbg_log_rec *dbg_log_pop_block(dbg_log *l) {
+    dbg_log_rec *blk = l->blocks[l->first_blk];
+    
+    //With history, every stored record is shown, so the whole block moves
+    //over. If it can't be compressed, it's lost just like it would have
+    //been without history
+    if (l->hist != NULL) {
+        int rc = dbg_hist_append(l->hist, blk, DBG_LOG_BLOCK_RECS);
+        if (rc > 0) {
+            pool.hist_used += rc;
+            hist_trim();
+        }
+    }
+    
+    //Some of the records in it might be shown
+    int r;
+    for (r = l->nstored - l->nrecs; r < DBG_LOG_BLOCK_RECS; r++) {
+        l->nlines -= dbg_log_rec_nlines(blk + r);
+        l->nrecs--;
+    }
+    
+    l->first_blk = (l->first_blk + 1) & (l->blocks_cap - 1);
+    l->nblocks--;
+    l->nstored -= DBG_LOG_BLOCK_RECS;
+    return blk;
+}
+
+//Gets a block for the spare slot, either fresh from the pool, stolen from
+//another log, or recycled from our own oldest records. Returns 0 on 
+//success, or -1 on error (and sets l->error_str)
+static int dbg_log_grow(dbg_log *l) {
+    //Make sure there's room for one more block pointer. Always a power of 
+    //two, so the ring can be indexed with a mask
+    if (l->nblocks == l->blocks_cap) {
+        int new_cap = l->blocks_cap ? 2*l->blocks_cap : 4;
+        dbg_log_rec **blocks = malloc(new_cap * sizeof(dbg_log_rec *));
+        if (blocks == NULL) {
+            l->error_str = DBG_LOG_OOM;
+            return -1;
+        }
+        int i;
+        for (i = 0; i < l->nblocks; i++) {
+            blocks[i] = l->blocks[(l->first_blk + i) & (l->blocks_cap - 1)];
+        }
+        if (l->blocks != NULL) free(l->blocks);
+        l->blocks = blocks;
+        l->blocks_cap = new_cap;
+        l->first_blk = 0;
+    }
+    
+    dbg_log_rec *blk = NULL;
+    if (l->nblocks < dbg_log_max_blocks(l)) {
+        if (l->nblocks == 0 || pool.used < pool.budget) {
+            blk = malloc(DBG_LOG_BLOCK_BYTES);
+            if (blk != NULL) pool.used++;
+        } else {
+            dbg_log *v = lru_victim(l);
+            if (v != NULL) blk = dbg_log_pop_block(v);
+        }
+    }
+    
+    if (blk == NULL) {
+        if (l->nblocks == 0) {
+            l->error_str = DBG_LOG_OOM;
+            return -1;
+        }
+        //No choice but to write over our own oldest records
+        blk = dbg_log_pop_block(l);
+    }
+    
+    l->blocks[(l->first_blk + l->nblocks) & (l->blocks_cap - 1)] = blk;
+    l->nblocks++;
+    
+    //This is what "busy" means for the LRU list
+    lru_touch(l);
+    return 0;
+}
+
+//Statically initialize a dbg_log that will show up to cap records. Memory
+//is not allocated until the first call to dbg_log_reserve. Returns 0 on
+//success, -1 on error (and sets l->error_str), or -2 if l is NULL
+int init_dbg_log(dbg_log *l, int cap) {
+    if (l == NULL) return -2; //This is all we can do
+
+    if (cap <= 0) {
+        l->error_str = DBG_LOG_INVALID_PARAM;
+        return -1;
+    }
+
+    l->blocks = NULL;
+    l->blocks_cap = 0;
+    l->first_blk = 0;
+    l->nblocks = 0;
+    l->nstored = 0;
+    l->cap = cap;
+    l->nrecs = 0;
+    l->nlines = 0;
+    l->next_seq = 0;
+    l->t0 = 0;
+    l->pinned = 0;
+    l->hist = NULL;
+    l->lru_prev = NULL;
+    l->lru_next = NULL;
+    l->in_lru = 0;
+
+    l->error_str = DBG_LOG_SUCC;
+    return 0;
+}
+
+//Frees memory allocated by the dbg_log and gives its blocks back to the 
+//pool. Gracefully ignores NULL input
+void deinit_dbg_log(dbg_log *l) {
+    if (l == NULL) return;
+
+    lru_unlink(l);
+    
+    if (l->hist != NULL) {
+        pool.hist_used -= l->hist->bytes;
+        deinit_dbg_hist(l->hist);
+        free(l->hist);
+        l->hist = NULL;
+    }
+    
+    int i;
+    for (i = 0; i < l->nblocks; i++) {
+        free(l->blocks[(l->first_blk + i) & (l->blocks_cap - 1)]);
+    }
+    pool.used -= l->nblocks;
+    
+    if (l->blocks != NULL) free(l->blocks);
+    l->blocks = NULL;
+    l->blocks_cap = 0;
+    l->first_blk = 0;
+    l->nblocks = 0;
+    l->nstored = 0;
+    l->nrecs = 0;
+    l->nlines = 0;
+}
+
+//Changes how many records l shows. Blocks that are no longer needed are
+//freed right away. Returns 0 on success, -1 on error (and sets 
+//l->error_str), or -2 if l is NULL
+int dbg_log_set_cap(dbg_log *l, int cap) {
+    if (l == NULL) return -2; //This is all we can do
+
+    if (cap <= 0) {
+        l->error_str = DBG_LOG_INVALID_PARAM;
+        return -1;
+    }
+    
+    l->cap = cap;
+    while (l->nblocks > dbg_log_max_blocks(l)) {
+        free(dbg_log_pop_block(l));
+        pool.used--;
+    }
+    
+    //The number of records shown can go up as well as down, so just count
+    //the lines again. This only happens when the user asks for it
+    if (l->hist != NULL || l->nstored < l->cap) {
+        l->nrecs = l->nstored;
+    } else {
+        l->nrecs = l->cap;
+    }
+    l->nlines = 0;
+    int r;
+    for (r = l->nstored - l->nrecs; r < l->nstored; r++) {
+        l->nlines += dbg_log_rec_nlines(dbg_log_slot(l, r));
+    }
+
+    l->error_str = DBG_LOG_SUCC;
+    return 0;
+}
+
+//Sets the memory budget shared by all dbg_logs. If more than this is in
+//use, blocks are taken back from the idlest logs until it isn't (or until
+//every log is down to one block)
+void dbg_log_set_budget(size_t bytes) {
+    pool.budget = bytes / DBG_LOG_BLOCK_BYTES;
+    
+    while (pool.used > pool.budget) {
+        dbg_log *v = lru_victim(NULL);
+        if (v == NULL) break;
+        free(dbg_log_pop_block(v));
+        pool.used--;
+    }
+}
+
+//Turns on the compressed history tier for l. Returns 0 on success, -1 on
+//error (and sets l->error_str), or -2 if l is NULL
+int dbg_log_enable_history(dbg_log *l) {
+    if (l == NULL) return -2; //This is all we can do
+    
+    if (l->hist != NULL) return 0; //Already on
+    
+    l->hist = malloc(sizeof(dbg_hist));
+    if (l->hist == NULL) {
+        l->error_str = DBG_LOG_OOM;
+        return -1;
+    }
+    init_dbg_hist(l->hist);
+    
+    //Everything in memory is shown from now on
+    return dbg_log_set_cap(l, l->cap);
+}
+
+//Turns off the compressed history tier for l and throws away whatever was
+//in it. Returns 0 on success, -1 on error (and sets l->error_str), or -2 if
+//l is NULL
+int dbg_log_disable_history(dbg_log *l) {
+    if (l == NULL) return -2; //This is all we can do
+    
+    if (l->hist == NULL) return 0; //Already off
+    
+    pool.hist_used -= l->hist->bytes;
+    deinit_dbg_hist(l->hist);
+    free(l->hist);
+    l->hist = NULL;
+    
+    //Back to only showing cap records
+    return dbg_log_set_cap(l, l->cap);
+}
+
+//Sets the budget for compressed history shared by all dbg_logs. Same idea
+//as dbg_log_set_budget, except that a log can lose all of its history
+void dbg_log_set_hist_budget(size_t bytes) {
+    pool.hist_budget = bytes;
+    hist_trim();
+}
+
+//Reports how much memory the pool and the history tier are using, and
+//their budgets, in bytes. Any of the pointers can be NULL
+void dbg_log_pool_usage(size_t *used, size_t *budget, size_t *hist_used, size_t *hist_budget) {
+    if (used != NULL) *used = pool.used * DBG_LOG_BLOCK_BYTES;
+    if (budget != NULL) *budget = pool.budget * DBG_LOG_BLOCK_BYTES;
+    if (hist_used != NULL) *hist_used = pool.hist_used;
+    if (hist_budget != NULL) *hist_budget = pool.hist_budget;
+}
+
+//Number of text lines needed to show every record in l, including the 
+//history tier (clamped to INT_MAX)
+int dbg_log_total_lines(dbg_log const *l) {
+    if (l->hist == NULL) return l->nlines;
+    
+    uint64_t ret = l->nlines + dbg_hist_nlines(l->hist);
+    return (ret > INT_MAX) ? INT_MAX : ret;
+}
+
+//Returns a pointer to the spare slot, which the caller fills in. Nothing
+//is visible until dbg_log_commit is called. Returns NULL on error (and
+//sets l->error_str if possible)
+dbg_log_rec *dbg_log_reserve(dbg_log *l) {
+    if (l == NULL) return NULL;
+
+    //Most guvs never log anything, so they never take any blocks
+    if (l->nstored == l->nblocks * DBG_LOG_BLOCK_RECS) {
+        if (dbg_log_grow(l) < 0) return NULL;
+    }
+
+    return dbg_log_slot(l, l->nstored);
+}
+
+//Makes the record filled in after dbg_log_reserve visible, evicting the
+//oldest record if the log is full. This is also where rec->seq is set
+void dbg_log_commit(dbg_log *l) {
+    dbg_log_rec *rec = dbg_log_slot(l, l->nstored);
+    if (l->next_seq == 0) l->t0 = rec->ns;
+    rec->seq = l->next_seq++;
+
+    l->nlines += dbg_log_rec_nlines(rec);
+    l->nstored++;
+
+    if (l->nrecs == l->cap && l->hist == NULL) {
+        //The oldest shown record is still stored, but not shown anymore
+        l->nlines -= dbg_log_rec_nlines(dbg_log_slot(l, l->nstored - l->cap - 1));
+    } else {
+        l->nrecs++;
+    }
+}
+
+//Returns the i'th newest record (0 is the most recent), or NULL if there
+//is no such record
+dbg_log_rec const *dbg_log_get(dbg_log const *l, int i) {
+    if (i < 0) return NULL;
+    
+    if (i >= l->nrecs) {
+        if (l->hist == NULL) return NULL;
+        return dbg_hist_get(l->hist, i - l->nrecs);
+    }
+
+    return dbg_log_slot(l, l->nstored - 1 - i);
+}
+
+//Formats the time ns (taken from one of l's records) the way the user
+//asked for. prev_ns points to the time of whatever came just before, or
+//is NULL if that isn't known; it's only needed for delta times. Returns
+//number of characters written
+int dbg_log_fmt_time(dbg_log const *l, uint64_t ns, uint64_t const *prev_ns, char *line, int n) {
+    if (n < 2) {
+        if (n > 0) line[0] = '\0';
+        return 0;
+    }
+    
+    if (time_mode == DBG_LOG_TIME_REL) {
+        line[0] = '+';
+        return 1 + fmt_duration(line + 1, n - 1, ns - l->t0);
+    } else if (time_mode == DBG_LOG_TIME_DELTA) {
+        if (prev_ns == NULL) {
+            //The previous one might have been evicted
+            return snprintf(line, n, "(oldest)");
+        }
+        line[0] = '+';
+        return 1 + fmt_duration(line + 1, n - 1, ns - *prev_ns);
+    }
+    
+    //Monotonic time doesn't mean anything to a person, so convert to 
+    //the wall clock. The offset is only figured out once, so that
+    //someone changing the system time doesn't scramble the log
+    static int64_t offset = 0;
+    static int have_offset = 0;
+    if (!have_offset) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        offset = (int64_t)ts.tv_sec * 1000000000ll + ts.tv_nsec - (int64_t) dbg_log_now_ns();
+        have_offset = 1;
+    }
+    int64_t wall = (int64_t) ns + offset;
+    time_t secs = wall / 1000000000ll;
+    struct tm tm;
+    localtime_r(&secs, &tm);
+    return snprintf(line, n, "%02d:%02d:%02d.%09lld", 
+        tm.tm_hour, tm.tm_min, tm.tm_sec, (long long) (wall % 1000000000ll)
+    );
+}
+
+//Number of text lines that rec is displayed as
+int dbg_log_rec_nlines(dbg_log_rec const *rec) {
+    int ret = 2; //Timestamp and TLAST
+    if (rec->TID_width > 0) ret++;
+    if (rec->TDEST_width > 0) ret++;
+    ret += (rec->len + 3)/4;
+
+    return ret;
+}
+
+//Formats the i'th line of rec (which belongs to l) into line, which has
+//room for n bytes (including the NUL). prev is the record that came just
+//before rec, or NULL if there isn't one; it's only needed for delta times.
+//Returns number of characters written
+int dbg_log_fmt_line(dbg_log const *l, dbg_log_rec const *rec, dbg_log_rec const *prev, int i, char *line, int n) {
+    if (i == 0) {
+        int len = snprintf(line, n, "#%u ", rec->seq);
+        if (len >= n) return len;
+        
+        if (time_mode == DBG_LOG_TIME_DELTA && prev == NULL && rec->seq == 0) {
+            return len + snprintf(line + len, n - len, "(first)");
+        }
+        return len + dbg_log_fmt_time(l, rec->ns, prev ? &prev->ns : NULL, line + len, n - len);
+    }
+
+    if (i == 1) return snprintf(line, n, "TLAST: %d", rec->TLAST);
+    i -= 2;
+
+    if (rec->TID_width > 0) {
+        if (i == 0) return snprintf(line, n, "TID:   %u", rec->TID);
+        i--;
+    }
+    if (rec->TDEST_width > 0) {
+        if (i == 0) return snprintf(line, n, "TDEST: %u", rec->TDEST);
+        i--;
+    }
+
+    //All that's left is TDATA
+    int tdata_words = (rec->len + 3)/4;
+    if (i < 0 || i >= tdata_words) {
+        line[0] = '\0';
+        return 0;
+    }
+
+    if (i < tdata_words - 1) {
+        return snprintf(line, n, "> %08x", rec->TDATA[i]);
+    }
+
+    //Last word might be partial. Also, if the log is 4 bytes or fewer, be
+    //nice and print out the value in decimal
+    int last_len = rec->len - 4*(tdata_words - 1);
+    if (rec->len <= 4) {
+        return snprintf(line, n, "> %0*x (%u)", last_len*2, rec->TDATA[i], rec->TDATA[i]);
+    } else {
+        return snprintf(line, n, "> %0*x", last_len*2, rec->TDATA[i]);
+    }
+}
+
+//Draws the last h lines of l (starting from offset lines back) into the
+//rect defined by x,y,w,h. Only the visible lines are formatted. Same
+//guarantees and return values as draw_linebuf
+int draw_dbg_log(dbg_log *l, int offset, int x, int y, int w, int h, char *buf) {
+    //Sanity check inputs
+    if (l == NULL) {
+        return -2; //This is all we can do
+    }
+
+    if (w == 0 || h == 0) return 0; //Nothing to draw
+    if (x >= term_cols || y >= term_rows) return 0; //Nothing to draw
+
+    if (x < 0 || y < 0 || w < 0 || h < 0) {
+        l->error_str = DBG_LOG_INVALID_PARAM;
+        return -1;
+    }
+
+    //Save initial buf poitner so we can calculate total change
+    char *buf_saved = buf;
+
+    //Clip drawing rect to stay on the screen
+    if ((x+w-1) > term_cols) w = term_cols - x;
+    if ((y+h-1) > term_rows) h = term_rows - y;
+
+    //Don't let the user scroll past the oldest line
+    int total = dbg_log_total_lines(l);
+    if (offset + h > total) offset = total - h;
+    if (offset < 0) offset = 0;
+
+    //Lines are numbered backwards from the most recent one. Figure out
+    //which one goes in the top row
+    int top = offset + h - 1;
+    int first = (top < total) ? top : total - 1;
+
+    //Find the record containing that line. This is the only part that
+    //depends on how far back we've scrolled
+    int rec_ind = 0;
+    int line_ind = 0;
+    int rec_lines = 0;
+    dbg_log_rec const *rec = NULL;
+    if (first < l->nlines) {
+        int skip = 0; //Number of lines in records newer than rec_ind
+        rec = dbg_log_get(l, rec_ind);
+        while (rec != NULL) {
+            rec_lines = dbg_log_rec_nlines(rec);
+            if (skip + rec_lines > first) break;
+            skip += rec_lines;
+            rec = dbg_log_get(l, ++rec_ind);
+        }
+        line_ind = rec_lines - 1 - (first - skip);
+    } else if (first >= 0) {
+        //It's in the history tier. This only decodes the one block
+        uint64_t hist_ind;
+        if (dbg_hist_find_line(l->hist, first - l->nlines, &hist_ind, &line_ind) == 0) {
+            rec_ind = l->nrecs + hist_ind;
+            rec = dbg_log_get(l, rec_ind);
+            if (rec != NULL) rec_lines = dbg_log_rec_nlines(rec);
+        }
+    }
+
+    int i;
+    for (i = 0; i < h; i++) {
+        //Move the cursor
+        int incr = cursor_pos_cmd(buf, x, y + i);
+        buf += incr;
+
+        char line[80];
+        line[0] = '\0';
+
+        //Rows above the oldest line are left blank
+        if (top - i <= first && rec != NULL) {
+            dbg_log_fmt_line(l, rec, dbg_log_get(l, rec_ind + 1), line_ind, line, sizeof(line));
+
+            //Step forward in time
+            line_ind++;
+            if (line_ind == rec_lines) {
+                rec = dbg_log_get(l, --rec_ind);
+                if (rec != NULL) rec_lines = dbg_log_rec_nlines(rec);
+                line_ind = 0;
+            }
+        }
+
+        sprintf(buf, "%-*.*s%n", w, w, line, &incr);
+        buf += incr;
+    }
+
+    return buf - buf_saved;
+}
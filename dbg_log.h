@@ -0,0 +1,176 @@
+#ifndef DBG_LOG_H
+#define DBG_LOG_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+//TDATA length is sent as a 6-bit field (plus one), so a single log flit
+//carries at most 64 bytes
+#define DBG_LOG_MAX_TDATA_BYTES 64
+#define DBG_LOG_MAX_TDATA_WORDS (DBG_LOG_MAX_TDATA_BYTES/4)
+
+//Binary form of a single log flit. These are stored as-is in the per-guv
+//ring and are only turned into text when they are drawn
+typedef struct _dbg_log_rec {
+    uint64_t ns;            //CLOCK_MONOTONIC arrival time. Every packet
+                            //from the same read gets the same value
+    uint32_t seq;           //Per-guv sequence number, set by dbg_log_commit
+    uint32_t TID;
+    uint32_t TDEST;
+    uint8_t TID_width;      //In bits. Zero means the channel is absent
+    uint8_t TDEST_width;    //In bits. Zero means the channel is absent
+    uint8_t TLAST;
+    uint8_t len;            //Number of valid TDATA bytes
+    uint32_t TDATA[DBG_LOG_MAX_TDATA_WORDS]; //Partial last word is already
+                                             //right-shifted into place
+} dbg_log_rec;
+
+//Records are stored in fixed-size blocks, which all come out of one pool
+//with a global memory budget. Each dbg_log can show up to cap records. 
+//When it needs a new block and the budget is used up, it takes the oldest
+//block from whichever dbg_log went the longest without needing one (i.e.
+//the idlest), so a busy guv can hold millions of records while the total
+//stays bounded. Every dbg_log that has logged anything keeps at least one
+//block.
+#define DBG_LOG_BLOCK_SHIFT 8
+#define DBG_LOG_BLOCK_RECS (1 << DBG_LOG_BLOCK_SHIFT)
+#define DBG_LOG_DEFAULT_BUDGET_MB 256
+#define DBG_LOG_DEFAULT_HIST_MB 64 //For compressed history (see dbg_hist.h)
+
+struct _dbg_hist;
+
+//There is always a spare slot after the newest record; the decoder fills
+//it in place with dbg_log_reserve and then makes it visible with 
+//dbg_log_commit. If the spare slot needs a fresh block, getting one may
+//evict the oldest block's worth of records.
+//
+//If history is turned on, evicted blocks are compressed into a history
+//tier instead of being thrown away, and records are numbered straight
+//through from memory into history. The history tier has its own budget,
+//which is also shared by all dbg_logs and reclaimed from the idlest ones.
+typedef struct _dbg_log {
+    dbg_log_rec **blocks; //Ring of block pointers, oldest block at first_blk
+    int blocks_cap;     //Size of blocks[]. Always zero or a power of two
+    int first_blk;
+    int nblocks;        //Blocks currently held
+    int nstored;        //Records in the blocks. The oldest one is always
+                        //at the start of the oldest block
+    int cap;            //Maximum number of records shown. With history
+                        //turned on, this is just how many are kept in
+                        //memory (give or take a block)
+    int nrecs;          //Number of records shown from memory (the newest
+                        //nstored, up to cap unless there's history)
+    int nlines;         //Number of text lines needed to show the records
+                        //in memory
+    struct _dbg_hist *hist; //Compressed older records, or NULL
+    uint32_t next_seq;  //Sequence number for the next committed record
+    uint64_t t0;        //Arrival time of the first record ever committed.
+                        //Relative times are measured from here
+    int pinned;         //If nonzero, blocks are never taken from this log
+    
+    //Position in the pool's LRU list (most recent first)
+    struct _dbg_log *lru_prev, *lru_next;
+    int in_lru;
+
+    //Error information
+    char const *error_str;
+} dbg_log;
+
+//How the arrival time of each record is shown
+typedef enum _dbg_log_time_mode {
+    DBG_LOG_TIME_ABS,   //Wall clock time of day
+    DBG_LOG_TIME_REL,   //Since the first log on this guv
+    DBG_LOG_TIME_DELTA  //Since the previous log on this guv
+} dbg_log_time_mode;
+
+//Returns the current CLOCK_MONOTONIC time in ns. This is the clock used 
+//for dbg_log_rec.ns
+uint64_t dbg_log_now_ns();
+
+//Changes how times are shown for every dbg_log. Takes effect the next time
+//they are drawn
+void dbg_log_set_time_mode(dbg_log_time_mode mode);
+
+//Statically initialize a dbg_log that will show up to cap records. Memory
+//is not allocated until the first call to dbg_log_reserve. Returns 0 on
+//success, -1 on error (and sets l->error_str), or -2 if l is NULL
+int init_dbg_log(dbg_log *l, int cap);
+
+//Frees memory allocated by the dbg_log and gives its blocks back to the 
+//pool. Gracefully ignores NULL input
+void deinit_dbg_log(dbg_log *l);
+
+//Changes how many records l shows. Blocks that are no longer needed are
+//freed right away. Returns 0 on success, -1 on error (and sets 
+//l->error_str), or -2 if l is NULL
+int dbg_log_set_cap(dbg_log *l, int cap);
+
+//Sets the memory budget shared by all dbg_logs. If more than this is in
+//use, blocks are taken back from the idlest logs until it isn't (or until
+//every log is down to one block)
+void dbg_log_set_budget(size_t bytes);
+
+//Turns on the compressed history tier for l. Returns 0 on success, -1 on
+//error (and sets l->error_str), or -2 if l is NULL
+int dbg_log_enable_history(dbg_log *l);
+
+//Turns off the compressed history tier for l and throws away whatever was
+//in it. Returns 0 on success, -1 on error (and sets l->error_str), or -2 if
+//l is NULL
+int dbg_log_disable_history(dbg_log *l);
+
+//Sets the budget for compressed history shared by all dbg_logs. Same idea
+//as dbg_log_set_budget, except that a log can lose all of its history
+void dbg_log_set_hist_budget(size_t bytes);
+
+//Reports how much memory the pool and the history tier are using, and
+//their budgets, in bytes. Any of the pointers can be NULL
+void dbg_log_pool_usage(size_t *used, size_t *budget, size_t *hist_used, size_t *hist_budget);
+
+//Number of text lines needed to show every record in l, including the 
+//history tier (clamped to INT_MAX)
+int dbg_log_total_lines(dbg_log const *l);
+
+//Returns a pointer to the spare slot, which the caller fills in. Nothing
+//is visible until dbg_log_commit is called. Returns NULL on error (and
+//sets l->error_str if possible)
+dbg_log_rec *dbg_log_reserve(dbg_log *l);
+
+//Makes the record filled in after dbg_log_reserve visible, evicting the
+//oldest record if the ring is full. This is also where rec->seq is set
+void dbg_log_commit(dbg_log *l);
+
+//Returns the i'th newest record (0 is the most recent), or NULL if there
+//is no such record. Records past nrecs come from the history tier, and
+//the pointer is only good until a couple of other history blocks have
+//been looked at (see dbg_hist_get)
+dbg_log_rec const *dbg_log_get(dbg_log const *l, int i);
+
+//Formats the time ns (taken from one of l's records) the way the user
+//asked for. prev_ns points to the time of whatever came just before, or
+//is NULL if that isn't known; it's only needed for delta times. Returns
+//number of characters written
+int dbg_log_fmt_time(dbg_log const *l, uint64_t ns, uint64_t const *prev_ns, char *line, int n);
+
+//Number of text lines that rec is displayed as
+int dbg_log_rec_nlines(dbg_log_rec const *rec);
+
+//Formats the i'th line of rec (which belongs to l) into line, which has
+//room for n bytes (including the NUL). prev is the record that came just
+//before rec, or NULL if there isn't one; it's only needed for delta times.
+//Returns number of characters written
+int dbg_log_fmt_line(dbg_log const *l, dbg_log_rec const *rec, dbg_log_rec const *prev, int i, char *line, int n);
+
+//Draws the last h lines of l (starting from offset lines back) into the
+//rect defined by x,y,w,h. Only the visible lines are formatted. Same
+//guarantees and return values as draw_linebuf
+int draw_dbg_log(dbg_log *l, int offset, int x, int y, int w, int h, char *buf);
+
+//////////////////////////////////////////////////
+//Error codes, which double as printable strings//
+//////////////////////////////////////////////////
+extern char const *const DBG_LOG_SUCC; // = "success";
+extern char const *const DBG_LOG_OOM; // = "out of memory";
+extern char const *const DBG_LOG_INVALID_PARAM; // = "invalid parameter";
+
+#endif
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "filter.h"
+
+char const *const FILTER_SUCC = "success";
+char const *const FILTER_NULL_ARG = "received NULL argument";
+char const *const FILTER_EXP_FIELD = "expected tdest, tid, tlast, len or data[N]";
+char const *const FILTER_EXP_NUM = "expected a number";
+char const *const FILTER_EXP_OP = "expected &&, || or end of filter";
+char const *const FILTER_BAD_WORD = "TDATA word index out of range";
+char const *const FILTER_BAD_RANGE = "range is backwards";
+char const *const FILTER_TOO_LONG = "filter has too many terms";
+
+//Helpers for the recursive descent. Each one advances *s past whatever it
+//consumed. Filters are only compiled when the user types one in, so none
+//of this needs to be fast
+
+static void skip_ws(char const **s) {
+    while (isspace(**s)) (*s)++;
+}
+
+//If the next thing in *s is tok, consumes it and returns 1. Otherwise
+//returns 0 and leaves *s alone
+static int accept(char const **s, char const *tok) {
+    skip_ws(s);
+    int len = strlen(tok);
+    if (strncmp(*s, tok, len) != 0) return 0;
+    //Don't match "in" at the start of "index", for example
+    if (isalpha(tok[len-1]) && isalnum((*s)[len])) return 0;
+    *s += len;
+    return 1;
+}
+
+static int parse_num(filter *f, char const **s, char const *start, uint32_t *dest) {
+    skip_ws(s);
+    char *endptr;
+    unsigned long long val = strtoull(*s, &endptr, 0);
+    if (endptr == *s || val > UINT32_MAX) {
+        f->error_str = FILTER_EXP_NUM;
+        f->error_pos = *s - start;
+        return -1;
+    }
+    *dest = val;
+    *s = endptr;
+    return 0;
+}
+
+static int parse_term(filter *f, char const **s, char const *start, filter_term *t) {
+    t->neg = accept(s, "!");
+    t->mask = 0xFFFFFFFF;
+    t->word = 0;
+
+    if (accept(s, "tdest")) {
+        t->field = FILT_TDEST;
+    } else if (accept(s, "tid")) {
+        t->field = FILT_TID;
+    } else if (accept(s, "tlast")) {
+        t->field = FILT_TLAST;
+    } else if (accept(s, "len")) {
+        t->field = FILT_LEN;
+    } else if (accept(s, "data")) {
+        t->field = FILT_TDATA;
+        uint32_t word;
+        if (!accept(s, "[")) {
+            f->error_str = FILTER_EXP_FIELD;
+            f->error_pos = *s - start;
+            return -1;
+        }
+        if (parse_num(f, s, start, &word) < 0) return -1;
+        if (word >= DBG_LOG_MAX_TDATA_WORDS) {
+            f->error_str = FILTER_BAD_WORD;
+            f->error_pos = *s - start;
+            return -1;
+        }
+        if (!accept(s, "]")) {
+            f->error_str = FILTER_EXP_FIELD;
+            f->error_pos = *s - start;
+            return -1;
+        }
+        t->word = word;
+    } else {
+        f->error_str = FILTER_EXP_FIELD;
+        f->error_pos = *s - start;
+        return -1;
+    }
+
+    //Careful not to mistake && for a mask
+    skip_ws(s);
+    if (**s == '&' && (*s)[1] != '&') {
+        (*s)++;
+        if (parse_num(f, s, start, &t->mask) < 0) return -1;
+    }
+
+    //Turn the comparison into a range. The order matters here, since "<"
+    //would also match the start of "<="
+    uint32_t v, hi;
+    int neg = 0;
+    if (accept(s, "==")) {
+        if (parse_num(f, s, start, &v) < 0) return -1;
+        t->lo = v;
+        t->span = 0;
+    } else if (accept(s, "!=")) {
+        if (parse_num(f, s, start, &v) < 0) return -1;
+        neg = 1;
+        t->lo = v;
+        t->span = 0;
+    } else if (accept(s, "<=")) {
+        if (parse_num(f, s, start, &v) < 0) return -1;
+        t->lo = 0;
+        t->span = v;
+    } else if (accept(s, ">=")) {
+        if (parse_num(f, s, start, &v) < 0) return -1;
+        t->lo = v;
+        t->span = 0xFFFFFFFF - v;
+    } else if (accept(s, "<")) {
+        if (parse_num(f, s, start, &v) < 0) return -1;
+        if (v == 0) {
+            //x < 0 is never true, which is the same as NOT(anything)
+            neg = 1;
+            t->lo = 0;
+            t->span = 0xFFFFFFFF;
+        } else {
+            t->lo = 0;
+            t->span = v - 1;
+        }
+    } else if (accept(s, ">")) {
+        if (parse_num(f, s, start, &v) < 0) return -1;
+        if (v == 0xFFFFFFFF) {
+            //Same story
+            neg = 1;
+            t->lo = 0;
+            t->span = 0xFFFFFFFF;
+        } else {
+            t->lo = v + 1;
+            t->span = 0xFFFFFFFF - t->lo;
+        }
+    } else if (accept(s, "in")) {
+        if (parse_num(f, s, start, &v) < 0) return -1;
+        if (!accept(s, "..")) {
+            f->error_str = FILTER_EXP_NUM;
+            f->error_pos = *s - start;
+            return -1;
+        }
+        if (parse_num(f, s, start, &hi) < 0) return -1;
+        if (hi < v) {
+            f->error_str = FILTER_BAD_RANGE;
+            f->error_pos = *s - start;
+            return -1;
+        }
+        t->lo = v;
+        t->span = hi - v;
+    } else {
+        //Bare field means "is nonzero", i.e. NOT(== 0)
+        neg = 1;
+        t->lo = 0;
+        t->span = 0;
+    }
+
+    t->neg ^= neg;
+    return 0;
+}
+
+//Compiles src into f and resets the counters. Returns 0 on success, -1 on
+//error (and sets f->error_str and f->error_pos), or -2 if f is NULL
+int compile_filter(filter *f, char const *src) {
+    if (f == NULL) return -2; //This is all we can do
+
+    if (src == NULL) {
+        f->error_str = FILTER_NULL_ARG;
+        return -1;
+    }
+
+    char const *s = src;
+    int n = 0;
+    int conj_start = 0; //Index of the first term in the current conjunction
+    while (1) {
+        if (n == FILTER_MAX_TERMS) {
+            f->error_str = FILTER_TOO_LONG;
+            f->error_pos = s - src;
+            return -1;
+        }
+
+        if (parse_term(f, &s, src, f->terms + n) < 0) return -1;
+        f->terms[n].last = 0;
+        n++;
+
+        if (accept(&s, "&&")) continue;
+
+        //This conjunction is over. All of its terms jump to the start of
+        //the next one if they fail
+        f->terms[n-1].last = 1;
+        int i;
+        for (i = conj_start; i < n; i++) f->terms[i].fail = n;
+        conj_start = n;
+
+        if (accept(&s, "||")) continue;
+
+        skip_ws(&s);
+        if (*s != '\0') {
+            f->error_str = FILTER_EXP_OP;
+            f->error_pos = s - src;
+            return -1;
+        }
+        break;
+    }
+
+    f->num_terms = n;
+    snprintf(f->src, sizeof(f->src), "%s", src);
+    f->kept = 0;
+    f->dropped = 0;
+
+    f->error_str = FILTER_SUCC;
+    return 0;
+}
+
+//Returns nonzero if rec passes the filter, and updates the counters
+int filter_match(filter *f, dbg_log_rec const *rec) {
+    int pc = 0;
+    while (pc < f->num_terms) {
+        filter_term const *t = f->terms + pc;
+
+        uint32_t val;
+        switch (t->field) {
+        case FILT_TDEST: val = rec->TDEST; break;
+        case FILT_TID:   val = rec->TID; break;
+        case FILT_TLAST: val = rec->TLAST; break;
+        case FILT_LEN:   val = rec->len; break;
+        default:
+            val = (4*t->word < rec->len) ? rec->TDATA[t->word] : 0;
+            break;
+        }
+
+        int match = (((val & t->mask) - t->lo) <= t->span) ^ t->neg;
+        if (match) {
+            if (t->last) {
+                f->kept++;
+                return 1;
+            }
+            pc++;
+        } else {
+            pc = t->fail;
+        }
+    }
+
+    f->dropped++;
+    return 0;
+}
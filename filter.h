@@ -0,0 +1,84 @@
+#ifndef FILTER_H
+#define FILTER_H 1
+
+#include <stdint.h>
+#include "dbg_log.h"
+
+//Log filters. A filter is a little expression like
+//
+//    tdest == 3 && data[0] & 0xFF00 == 0x1200 || tid in 4..7 && tlast
+//
+//which is compiled into a flat list of terms, so that checking a packet is
+//just a handful of compares. Logs that don't match are counted and thrown
+//away before they ever reach the scrollback.
+//
+//Grammar (no parentheses; && binds tighter than ||):
+//
+//    expr  := conj ('||' conj)*
+//    conj  := term ('&&' term)*
+//    term  := ['!'] field ['&' NUM] [cmp]
+//    cmp   := ('==' | '!=' | '<' | '<=' | '>' | '>=') NUM
+//           | 'in' NUM '..' NUM
+//    field := 'tdest' | 'tid' | 'tlast' | 'len' | 'data[' NUM ']'
+//
+//A term with no comparison means "is nonzero". data[i] is the i'th TDATA
+//word (0 if the log is too short to have one).
+
+#define FILTER_MAX_TERMS 32
+#define FILTER_MAX_SRC 128
+
+typedef enum _filter_field {
+    FILT_TDEST,
+    FILT_TID,
+    FILT_TLAST,
+    FILT_LEN,
+    FILT_TDATA
+} filter_field;
+
+//Every kind of comparison boils down to a range check:
+//
+//    match = ((value & mask) - lo <= span) XOR neg
+//
+//using unsigned wraparound, so one compare covers both ends of the range
+typedef struct _filter_term {
+    uint8_t field;  //A filter_field
+    uint8_t word;   //Which TDATA word, for FILT_TDATA
+    uint8_t neg;
+    uint8_t last;   //Nonzero if this is the last term in its conjunction
+    uint16_t fail;  //Index of the term to jump to if this one is false
+    uint32_t mask, lo, span;
+} filter_term;
+
+typedef struct _filter {
+    filter_term terms[FILTER_MAX_TERMS];
+    int num_terms;
+    char src[FILTER_MAX_SRC + 1]; //So we can show the user what they typed
+
+    //Statistics
+    unsigned long kept, dropped;
+
+    //Error information
+    char const *error_str;
+    int error_pos; //Offset into the source where compilation failed
+} filter;
+
+//Compiles src into f and resets the counters. Returns 0 on success, -1 on
+//error (and sets f->error_str and f->error_pos), or -2 if f is NULL
+int compile_filter(filter *f, char const *src);
+
+//Returns nonzero if rec passes the filter, and updates the counters
+int filter_match(filter *f, dbg_log_rec const *rec);
+
+//////////////////////////////////////////////////
+//Error codes, which double as printable strings//
+//////////////////////////////////////////////////
+extern char const *const FILTER_SUCC; // = "success";
+extern char const *const FILTER_NULL_ARG; // = "received NULL argument";
+extern char const *const FILTER_EXP_FIELD; // = "expected tdest, tid, tlast, len or data[N]";
+extern char const *const FILTER_EXP_NUM; // = "expected a number";
+extern char const *const FILTER_EXP_OP; // = "expected &&, || or end of filter";
+extern char const *const FILTER_BAD_WORD; // = "TDATA word index out of range";
+extern char const *const FILTER_BAD_RANGE; // = "range is backwards";
+extern char const *const FILTER_TOO_LONG; // = "filter has too many terms";
+
+#endif
@@ -0,0 +1,115 @@
+#include <string.h>
+#include "lat.h"
+
+static lat_hist hists[LAT_NUM_STAGES];
+
+static struct {
+    uint64_t read_ns;
+    uint64_t count;
+} pending[LAT_MAX_PENDING];
+static int npending = 0;
+
+static char const *const stage_names[LAT_NUM_STAGES] = {
+    [LAT_STORE] = "read->stored",
+    [LAT_PAINT] = "read->painted",
+    [LAT_DRAW]  = "draw",
+    [LAT_LOOP]  = "loop lag"
+};
+
+//Values below LAT_SUB get a bucket each. After that, every power of two
+//gets LAT_SUB buckets
+static int lat_bucket(uint64_t v) {
+    if (v < LAT_SUB) return v;
+    int e = 63 - __builtin_clzll(v);
+    return (e - LAT_SUB_BITS + 1) * LAT_SUB + (int) ((v >> (e - LAT_SUB_BITS)) - LAT_SUB);
+}
+
+//Largest value that lands in bucket i
+static uint64_t lat_bucket_top(int i) {
+    int blk = i / LAT_SUB;
+    int m = i % LAT_SUB;
+    if (blk == 0) return m;
+    uint64_t lo = (uint64_t) (LAT_SUB + m) << (blk - 1);
+    return lo + ((uint64_t) 1 << (blk - 1)) - 1;
+}
+
+//Adds count samples of ns to the stage's histogram
+void lat_record(lat_stage s, uint64_t ns, uint64_t count) {
+    lat_hist *h = hists + s;
+    h->counts[lat_bucket(ns)] += count;
+    h->total += count;
+    if (ns > h->max) h->max = ns;
+}
+
+//Says that count logs read at read_ns made it into the scrollback at now.
+//This records the store latency and remembers them until lat_painted
+void lat_stored(uint64_t read_ns, uint64_t now, uint64_t count) {
+    lat_record(LAT_STORE, now - read_ns, count);
+
+    //Everything from the same read has the same timestamp, so they only
+    //need one entry
+    if (npending > 0 && pending[npending - 1].read_ns == read_ns) {
+        pending[npending - 1].count += count;
+    } else if (npending == LAT_MAX_PENDING) {
+        pending[npending - 1].count += count;
+    } else {
+        pending[npending].read_ns = read_ns;
+        pending[npending].count = count;
+        npending++;
+    }
+}
+
+//Says that the screen was just updated, so everything stored so far has
+//now been painted
+void lat_painted(uint64_t now) {
+    int i;
+    for (i = 0; i < npending; i++) {
+        lat_record(LAT_PAINT, now - pending[i].read_ns, pending[i].count);
+    }
+    npending = 0;
+}
+
+//Returns the smallest value that at least fraction p (between 0 and 1) of
+//the stage's samples are less than or equal to. This is the top of the
+//bucket, so it's never an underestimate. Returns 0 if there are no samples
+uint64_t lat_percentile(lat_stage s, double p) {
+    lat_hist const *h = hists + s;
+    if (h->total == 0) return 0;
+
+    //Round up, so that p50 of three samples is the second one
+    uint64_t target = p * h->total;
+    if (target < p * h->total) target++;
+    if (target < 1) target = 1;
+    if (target > h->total) target = h->total;
+
+    uint64_t seen = 0;
+    int i;
+    for (i = 0; i < LAT_NBUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= target) {
+            uint64_t top = lat_bucket_top(i);
+            return (top < h->max) ? top : h->max;
+        }
+    }
+
+    return h->max; //Shouldn't get here
+}
+
+//Number of samples, and the largest one, for a stage
+uint64_t lat_count(lat_stage s) {
+    return hists[s].total;
+}
+
+uint64_t lat_max(lat_stage s) {
+    return hists[s].max;
+}
+
+//Name of a stage, for printing
+char const *lat_stage_name(lat_stage s) {
+    return stage_names[s];
+}
+
+//Throws away every sample (but not the logs waiting to be painted)
+void lat_reset() {
+    memset(hists, 0, sizeof(hists));
+}
@@ -0,0 +1,71 @@
+#ifndef LAT_H
+#define LAT_H 1
+
+#include <stdint.h>
+
+//Built-in latency instrumentation, so we can tell where the time goes when
+//the UI feels sluggish. Each stage has an HDR-style histogram: values are
+//bucketed by power of two, and each power of two is split into 32 linear
+//sub-buckets, so any value is off by at most ~3% and recording one is a
+//count-leading-zeros and an increment. Everything in here is only touched
+//from the UI thread.
+//
+//Stages:
+//
+//  - store: from read() to the log being in its guv's scrollback. Logs are
+//    decoded straight into the scrollback, so this covers decoding too.
+//    With an I/O thread, it also includes the time spent in its queue
+//  - paint: from read() to the first screen update after it was stored
+//  - draw:  how long each call to twm_draw_tree takes
+//  - loop:  event loop lag, i.e. how long after it was due each frame starts
+
+#define LAT_SUB_BITS 5
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_NBUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+//Batches of stored logs waiting for their first paint. If this fills up,
+//new batches are lumped in with the newest one (which makes their paint
+//latency look a little worse than it was, never better)
+#define LAT_MAX_PENDING 64
+
+typedef enum _lat_stage {
+    LAT_STORE,
+    LAT_PAINT,
+    LAT_DRAW,
+    LAT_LOOP,
+    LAT_NUM_STAGES
+} lat_stage;
+
+typedef struct _lat_hist {
+    uint64_t counts[LAT_NBUCKETS];
+    uint64_t total;
+    uint64_t max;
+} lat_hist;
+
+//Adds count samples of ns to the stage's histogram
+void lat_record(lat_stage s, uint64_t ns, uint64_t count);
+
+//Says that count logs read at read_ns made it into the scrollback at now.
+//This records the store latency and remembers them until lat_painted
+void lat_stored(uint64_t read_ns, uint64_t now, uint64_t count);
+
+//Says that the screen was just updated, so everything stored so far has
+//now been painted
+void lat_painted(uint64_t now);
+
+//Returns the smallest value that at least fraction p (between 0 and 1) of
+//the stage's samples are less than or equal to. This is the top of the
+//bucket, so it's never an underestimate. Returns 0 if there are no samples
+uint64_t lat_percentile(lat_stage s, double p);
+
+//Number of samples, and the largest one, for a stage
+uint64_t lat_count(lat_stage s);
+uint64_t lat_max(lat_stage s);
+
+//Name of a stage, for printing
+char const *lat_stage_name(lat_stage s);
+
+//Throws away every sample (but not the logs waiting to be painted)
+void lat_reset();
+
+#endif
@@ -9,14 +9,20 @@
 #include <signal.h>
 #include <event2/event.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
 #include "timonier.h"
 #include "textio.h"
 #include "dbg_guv.h"
 #include "dbg_cmd.h"
 #include "twm.h"
+#include "lat.h"
+#include "trace.h"
 
 #define write_const_str(x) write(1, x, sizeof(x))
 
+#define DEFAULT_MAX_FPS 30
+
 //This is the window that shows messages going by
 msg_win *err_log = NULL;
 
@@ -68,21 +74,131 @@ void twm_resize_cb(void) {
     readline_redisplay();
 }
 
+//Nothing draws on a timer. Anything that changes what's on screen asks the
+//TWM for a redraw, and the TWM calls schedule_draw (at most once per frame)
+//to set off this one-shot event
+static struct event *draw_ev = NULL;
+static unsigned max_fps = DEFAULT_MAX_FPS;
+static uint64_t last_draw_ns = 0;
+static uint64_t draw_due_ns = 0; //When draw_ev will fire, or 0 if it isn't pending
+
+//Frames are written to the terminal through their own non-blocking file
+//descriptor, so a slow terminal (e.g. over SSH) doesn't stall the event
+//loop. Whatever it can't take right away is sent by screen_write_cb
+static int screen_fd = STDOUT_FILENO;
+static struct event *screen_ev = NULL;
+
+//Hooked up to the TWM. Makes sure a frame happens within delay_ns, but no
+//sooner than one frame period after the last one
+void schedule_draw(uint64_t delay_ns) {
+    uint64_t now = dbg_log_now_ns();
+    uint64_t when = now + delay_ns;
+    uint64_t next_frame = last_draw_ns + 1000000000ull / max_fps;
+    if (when < next_frame) when = next_frame;
+    
+    //If a frame is already coming by then, it'll pick this up too
+    if (draw_due_ns != 0 && draw_due_ns <= when) return;
+    
+    draw_due_ns = when;
+    uint64_t wait = (when > now) ? when - now : 0;
+    struct timeval tv = {wait / 1000000000ull, (wait % 1000000000ull) / 1000};
+    event_add(draw_ev, &tv);
+}
+
+//Called once a frame has made it all the way to the terminal
+static void frame_done() {
+    lat_painted(dbg_log_now_ns());
+    place_readline_cursor();
+}
+
+//Keeps sending the frame in flight whenever the terminal can take more
+void screen_write_cb(evutil_socket_t fd, short what, void *arg) {
+    int rc = twm_flush(screen_fd, t);
+    if (rc < 0) {
+        char errmsg[80];
+        sprintf(errmsg, "Could not draw tree: %s", t->error_str);
+        msg_win_dynamic_append(err_log, errmsg);
+    } else if (rc > 0) {
+        event_add(screen_ev, NULL);
+    } else {
+        frame_done();
+    }
+}
+
+//Blocks until the frame in flight (if any) is all out. Anything else that
+//writes to the terminal has to call this first, or it could end up in
+//the middle of one of the frame's escape sequences
+static void finish_frame() {
+    if (twm_tree_pending(t) == 0) return;
+    
+    event_del(screen_ev);
+    int rc;
+    do {
+        struct pollfd p = {.fd = screen_fd, .events = POLLOUT};
+        poll(&p, 1, -1);
+        rc = twm_flush(screen_fd, t);
+    } while (rc > 0);
+    
+    if (rc == 0) frame_done();
+}
+
 void draw_cb(evutil_socket_t fd, short what, void *arg) {    
-    int rc = twm_draw_tree(STDOUT_FILENO, t, 1, 1, term_cols, term_rows - 2);
+    TRACE(TR_DRAW, TRACE_BEGIN, 0);
+    
+    //Work out how long after it was due this frame started
+    uint64_t start = dbg_log_now_ns();
+    lat_record(LAT_LOOP, (start > draw_due_ns) ? start - draw_due_ns : 0, 1);
+    draw_due_ns = 0;
+    last_draw_ns = start;
+    
+    int rc = twm_draw_tree(screen_fd, t, 1, 1, term_cols, term_rows - 2);
+    
+    uint64_t end = dbg_log_now_ns();
+    lat_record(LAT_DRAW, end - start, 1);
+    
     if (rc < 0) {
         char errmsg[80];
         sprintf(errmsg, "Could not draw tree: %s", t->error_str);
         msg_win_dynamic_append(err_log, errmsg);
     } else if (rc > 0) {
-        place_readline_cursor();
+        if (twm_tree_pending(t) > 0) {
+            event_add(screen_ev, NULL);
+        } else {
+            frame_done();
+        }
     }
+    
+    TRACE(TR_DRAW, TRACE_END, rc);
+}
+
+//SIGWINCH comes through libevent, so the resize (and the redraw it asks
+//for) happens on the event loop instead of inside a signal handler
+void winch_cb(evutil_socket_t sig, short what, void *arg) {
+    finish_frame();
+    term_resized();
 }
 
 void fpga_read_cb(evutil_socket_t fd, short what, void *arg) {
     fpga_connection_info *f = arg;
     
+    TRACE(TR_FPGA_READ, TRACE_BEGIN, fd);
     int rc = read_fpga_connection(f, fd);
+    TRACE(TR_FPGA_READ, TRACE_END, fd);
+    if (rc < 0) {
+        char errmsg[80];
+        sprintf(errmsg, "Could not read from FPGA: %s. Closing...", f->error_str);
+        msg_win_dynamic_append(err_log, errmsg);
+        cleanup_fpga_connection(f);
+    }
+}
+
+//Only used when the FPGA has its own I/O thread. fd is the thread's eventfd
+void fpga_wake_cb(evutil_socket_t fd, short what, void *arg) {
+    fpga_connection_info *f = arg;
+    
+    TRACE(TR_FPGA_WAKE, TRACE_BEGIN, fd);
+    int rc = fpga_drain_io_thread(f);
+    TRACE(TR_FPGA_WAKE, TRACE_END, fd);
     if (rc < 0) {
         char errmsg[80];
         sprintf(errmsg, "Could not read from FPGA: %s. Closing...", f->error_str);
@@ -94,7 +210,9 @@ void fpga_read_cb(evutil_socket_t fd, short what, void *arg) {
 void fpga_write_cb(evutil_socket_t fd, short what, void *arg) {
     fpga_connection_info *f = arg;
     
+    TRACE(TR_FPGA_WRITE, TRACE_BEGIN, fd);
     int rc = write_fpga_connection(f, fd);
+    TRACE(TR_FPGA_WRITE, TRACE_END, fd);
     if (rc < 0) {
         char errmsg[80];
         sprintf(errmsg, "Could not write to FPGA: %s. Closing...", f->error_str);
@@ -181,6 +299,11 @@ void handle_stdin_cb(evutil_socket_t fd, short what, void *arg) {
     //nice way to get rid of the global variables
     struct event_base *base = arg;
     
+    TRACE(TR_STDIN, TRACE_BEGIN, 0);
+    
+    //Readline and the commands write straight to the terminal
+    finish_frame();
+    
     //Sometimes timonerie uses a special key. However, if it doesn't use it,
     //we should pass it to readline
     static char ansi_code[16];
@@ -264,8 +387,11 @@ void handle_stdin_cb(evutil_socket_t fd, short what, void *arg) {
                         if (dir == TWM_UP) msg_win_scroll(m, in.shift ? 10: 1);
                         if (dir == TWM_DOWN) msg_win_scroll(m, in.shift ? -10: -1);
                     }
+                    //On a dashboard, this moves the selected cell instead
+                    guv_dash *dsh = twm_tree_get_focused_as(t, draw_fn_guv_dash);
+                    if (dsh) dash_move_sel(dsh, dir, in.shift ? 10 : 1);
                     
-                    if (g == NULL && m == NULL) {
+                    if (g == NULL && m == NULL && dsh == NULL) {
                         msg_win_dynamic_append(err_log, "Not a scrollable window");
                     }
                 } else {
@@ -321,6 +447,31 @@ void handle_stdin_cb(evutil_socket_t fd, short what, void *arg) {
                     msg_win_dynamic_append(err_log, errmsg);
                 }
                 break;
+            case 'o': {
+                //Open the guv that's selected on the focused dashboard
+                guv_dash *dsh = twm_tree_get_focused_as(t, draw_fn_guv_dash);
+                if (dsh == NULL) {
+                    msg_win_dynamic_append(err_log, "Not a dashboard");
+                    break;
+                }
+                dbg_guv *g = dash_selected(dsh);
+                if (g == NULL) {
+                    msg_win_dynamic_append(err_log, "This FPGA has no guvs yet");
+                    break;
+                }
+                rc = twm_tree_focus_item(t, g);
+                if (t->error_str == TWM_NOT_FOUND) {
+                    rc = twm_tree_add_window(t, g, dbg_guv_draw_ops);
+                    if (rc < 0) {
+                        sprintf(errmsg, "Could not add guv to display: %s", t->error_str);
+                        msg_win_dynamic_append(err_log, errmsg);
+                    }
+                } else if (rc < 0) {
+                    sprintf(errmsg, "Error while searching tree: %s", t->error_str);
+                    msg_win_dynamic_append(err_log, errmsg);
+                }
+                break;
+            }
             default:
                 used_ansi_code = 0;
                 break;
@@ -341,6 +492,8 @@ void handle_stdin_cb(evutil_socket_t fd, short what, void *arg) {
         sprintf(errmsg, "Bad input, why = %s, smoking_gun = 0x%02x", in.error_str, in.smoking_gun & 0xFF);
         msg_win_dynamic_append(err_log, errmsg);
     }
+    
+    TRACE(TR_STDIN, TRACE_END, c);
 }
 
 void got_rl_line(char *str) {    
@@ -459,7 +612,15 @@ void got_rl_line(char *str) {
                     break;
                 }
                 fpga_connection_info *f = sym_dat(e, sem_val*)->v;
-                selected = f->guvs + cmd.dbg_guv_addr;
+                //This is one of the two places where a guv gets created (the
+                //other is when the FPGA first talks to us)
+                selected = fpga_get_guv(f, cmd.dbg_guv_addr);
+                if (selected == NULL) {
+                    char line[80];
+                    sprintf(line, "Could not select guv: %s", f->error_str);
+                    msg_win_dynamic_append(err_log, line);
+                    break;
+                }
             } else if (sym_dat(e, sem_val*)->type == SYM_DG) {
                 selected = sym_dat(e, sem_val*)->v;
             } else {
@@ -500,6 +661,7 @@ void got_rl_line(char *str) {
                 g->ops = default_guv_ops;
                 g->mgr = NULL; //Doesn't really do anything, but helps with valgrind
                 g->need_redraw = 1;
+                twm_request_redraw();
             } else if (!strncmp(cmd.id, "fio", sizeof(cmd.id)) && g->ops.draw_ops.draw_fn != fio_guv_ops.draw_ops.draw_fn) {
                 if (g->ops.cleanup_mgr != NULL) g->ops.cleanup_mgr(g);
                 g->ops = fio_guv_ops;
@@ -513,6 +675,21 @@ void got_rl_line(char *str) {
                     }
                 }
                 g->need_redraw = 1;
+                twm_request_redraw();
+            } else if (!strncmp(cmd.id, "trig", sizeof(cmd.id)) && g->ops.draw_ops.draw_fn != trig_guv_ops.draw_ops.draw_fn) {
+                if (g->ops.cleanup_mgr != NULL) g->ops.cleanup_mgr(g);
+                g->ops = trig_guv_ops;
+                if (g->ops.init_mgr) {
+                    int rc = g->ops.init_mgr(g);
+                    if (rc < 0) {
+                        sprintf(line, "Could not set manager: %s. Resetting...", g->error_str);
+                        msg_win_dynamic_append(err_log, line);
+                        g->ops = default_guv_ops;
+                        g->mgr = NULL;
+                    }
+                }
+                g->need_redraw = 1;
+                twm_request_redraw();
             } else {
                 msg_win_dynamic_append(err_log, "Manager unchanged");
             }
@@ -611,6 +788,13 @@ void got_rl_line(char *str) {
                 break;
             } 
             
+            //The manager would mistake our receipt for one of its own
+            if (g->busy_str != NULL) {
+                snprintf(line, sizeof(line), "Not writing to %s: %s", g->name, g->busy_str);
+                msg_win_dynamic_append(err_log, line);
+                break;
+            }
+            
             //cursor_pos(1, term_rows-1);
             if (cmd.reg == LATCH) {
                 sprintf(line, "Committing values to %s%n", g->name, &len);
@@ -650,6 +834,8 @@ void got_rl_line(char *str) {
                 //Just here to get rid of warning for not using everything in the enum
                 break;
             }
+            //drop_cnt and log_cnt show up in the status icons
+            dash_guv_changed(&g->parent->dash, g->addr);
             
             //Actually send the command
 			int rc = dbg_guv_send_cmd(g, cmd.reg, cmd.param);
@@ -659,6 +845,304 @@ void got_rl_line(char *str) {
 			}
             break;
         }
+        case CMD_TXLIMIT: {
+            symtab_entry *e = symtab_lookup(ids, cmd.id);
+            if (!e) {
+                char line[120];
+                sprintf(line, "Could not find [%s]: %s", cmd.id, ids->error_str);
+                msg_win_dynamic_append(err_log, line);
+                break;
+            }
+            if (sym_dat(e, sem_val*)->type != SYM_FCI) {
+                msg_win_dynamic_append(err_log, "This is not an FPGA");
+                break;
+            }
+            fpga_connection_info *f = sym_dat(e, sem_val*)->v;
+            int rc = fpga_set_tx_limit(f, cmd.param);
+            if (rc < 0) {
+                char line[80];
+                sprintf(line, "Could not set TX limit: %s", f->error_str);
+                msg_win_dynamic_append(err_log, line);
+            }
+            break;
+        }
+        case CMD_IOTHREAD: {
+            symtab_entry *e = symtab_lookup(ids, cmd.id);
+            if (!e) {
+                char line[120];
+                sprintf(line, "Could not find [%s]: %s", cmd.id, ids->error_str);
+                msg_win_dynamic_append(err_log, line);
+                break;
+            }
+            if (sym_dat(e, sem_val*)->type != SYM_FCI) {
+                msg_win_dynamic_append(err_log, "This is not an FPGA");
+                break;
+            }
+            fpga_connection_info *f = sym_dat(e, sem_val*)->v;
+            char line[120];
+            
+            if (cmd.param && !f->io_running) {
+                //Hand the socket over to the thread
+                event_del(f->rd_ev);
+                int rc = fpga_start_io_thread(f, event_get_fd(f->rd_ev));
+                if (rc < 0) {
+                    sprintf(line, "Could not start I/O thread: %s", f->error_str);
+                    msg_win_dynamic_append(err_log, line);
+                    event_add(f->rd_ev, NULL);
+                    break;
+                }
+                f->wake_ev = event_new(ev_base, f->wake_fd, EV_READ | EV_PERSIST, fpga_wake_cb, f);
+                event_add(f->wake_ev, NULL);
+            } else if (!cmd.param && f->io_running) {
+                event_free(f->wake_ev);
+                f->wake_ev = NULL;
+                int rc = fpga_stop_io_thread(f);
+                if (rc < 0) {
+                    sprintf(line, "Could not read from FPGA: %s. Closing...", f->error_str);
+                    msg_win_dynamic_append(err_log, line);
+                    cleanup_fpga_connection(f);
+                    break;
+                }
+                event_add(f->rd_ev, NULL);
+            }
+            break;
+        }
+        case CMD_FILTER: {
+            if (g == NULL) {
+                msg_win_dynamic_append(err_log, "No dbg_guv is selected");
+                break;
+            }
+            
+            char const *src = cmd.rest;
+            if (!strcmp(src, "off")) src = NULL;
+            
+            int pos = 0;
+            int rc = dbg_guv_set_filter(g, src, &pos);
+            if (rc < 0) {
+                char line[120];
+                sprintf(line, "Could not set filter: %s (at position %d)", g->error_str, pos);
+                msg_win_dynamic_append(err_log, line);
+            }
+            break;
+        }
+        case CMD_SCROLLBACK: {
+            if (g == NULL) {
+                msg_win_dynamic_append(err_log, "No dbg_guv is selected");
+                break;
+            }
+            
+            int rc = dbg_guv_set_scrollback(g, cmd.param);
+            if (rc < 0) {
+                char line[80];
+                sprintf(line, "Could not set scrollback: %s", g->error_str);
+                msg_win_dynamic_append(err_log, line);
+            }
+            break;
+        }
+        case CMD_HISTORY: {
+            if (g == NULL) {
+                msg_win_dynamic_append(err_log, "No dbg_guv is selected");
+                break;
+            }
+            
+            int rc = dbg_guv_set_history(g, cmd.param);
+            if (rc < 0) {
+                char line[80];
+                sprintf(line, "Could not change history: %s", g->error_str);
+                msg_win_dynamic_append(err_log, line);
+            }
+            break;
+        }
+        case CMD_TRACE: {
+            if (cmd.param == 2) {
+                char const *error_str;
+                int rc = trace_dump(cmd.path, &error_str);
+                char line[120];
+                if (rc < 0) {
+                    snprintf(line, sizeof(line), "Could not dump trace: %s", error_str);
+                } else {
+                    snprintf(line, sizeof(line), "Wrote %d events to %s", rc, cmd.path);
+                }
+                msg_win_dynamic_append(err_log, line);
+            } else {
+                trace_set_enabled(cmd.param);
+            }
+            break;
+        }
+        case CMD_LAT: {
+            if (cmd.param) {
+                lat_reset();
+                msg_win_dynamic_append(err_log, "Latency stats cleared");
+                break;
+            }
+            
+            int i;
+            for (i = 0; i < LAT_NUM_STAGES; i++) {
+                char line[160];
+                sprintf(line, "%-14s n=%-10llu p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us",
+                    lat_stage_name(i), (unsigned long long) lat_count(i),
+                    lat_percentile(i, 0.5)/1e3, lat_percentile(i, 0.99)/1e3,
+                    lat_percentile(i, 0.999)/1e3, lat_max(i)/1e3
+                );
+                msg_win_dynamic_append(err_log, line);
+            }
+            break;
+        }
+        case CMD_FPS: {
+            if (cmd.param > 0) max_fps = cmd.param;
+            
+            char line[80];
+            sprintf(line, "Drawing at most %u frames per second", max_fps);
+            msg_win_dynamic_append(err_log, line);
+            break;
+        }
+        case CMD_WEIGHT: {
+            int rc = twm_set_weight_focused(t, cmd.param, cmd.param2);
+            if (rc < 0) {
+                char line[80];
+                sprintf(line, "Could not set weight: %s", t->error_str);
+                msg_win_dynamic_append(err_log, line);
+            }
+            break;
+        }
+        case CMD_DASH: {
+            symtab_entry *e = symtab_lookup(ids, cmd.id);
+            if (!e) {
+                char line[120];
+                sprintf(line, "Could not find [%s]: %s", cmd.id, ids->error_str);
+                msg_win_dynamic_append(err_log, line);
+                break;
+            }
+            if (sym_dat(e, sem_val*)->type != SYM_FCI) {
+                msg_win_dynamic_append(err_log, "This is not an FPGA");
+                break;
+            }
+            fpga_connection_info *f = sym_dat(e, sem_val*)->v;
+            
+            int rc = twm_tree_focus_item(t, &f->dash);
+            if (t->error_str == TWM_NOT_FOUND) {
+                int rc = twm_tree_add_window(t, &f->dash, guv_dash_draw_ops);
+                if (rc < 0) {
+                    char line[80];
+                    sprintf(line, "Could not show dashboard: %s", t->error_str);
+                    msg_win_dynamic_append(err_log, line);
+                }
+            } else if (rc < 0) {
+                char line[80];
+                sprintf(line, "Error while searching tree: %s", t->error_str);
+                msg_win_dynamic_append(err_log, line);
+            }
+            break;
+        }
+        case CMD_STATS: {
+            if (g == NULL) {
+                msg_win_dynamic_append(err_log, "No dbg_guv is selected");
+                break;
+            }
+            
+            int rc = twm_tree_focus_item(t, &g->stats);
+            if (t->error_str == TWM_NOT_FOUND) {
+                int rc = twm_tree_add_window(t, &g->stats, guv_stats_draw_ops);
+                if (rc < 0) {
+                    char line[80];
+                    sprintf(line, "Could not show stats: %s", t->error_str);
+                    msg_win_dynamic_append(err_log, line);
+                }
+            } else if (rc < 0) {
+                char line[80];
+                sprintf(line, "Error while searching tree: %s", t->error_str);
+                msg_win_dynamic_append(err_log, line);
+            }
+            break;
+        }
+        case CMD_VIEW: {
+            if (g == NULL) {
+                msg_win_dynamic_append(err_log, "No dbg_guv is selected");
+                break;
+            }
+            
+            int rc = dbg_guv_set_view(g, cmd.param);
+            if (rc < 0) {
+                char line[80];
+                sprintf(line, "Could not change view: %s", g->error_str);
+                msg_win_dynamic_append(err_log, line);
+            }
+            break;
+        }
+        case CMD_LOGMEM: {
+            if (cmd.param > 0) {
+                dbg_log_set_budget((size_t) cmd.param << 20);
+                
+                //Some guvs may have lost logs
+                int rc = twm_tree_redraw(t);
+                if (rc < 0) {
+                    char line[80];
+                    sprintf(line, "Could not issue redraw: %s", t->error_str);
+                    msg_win_dynamic_append(err_log, line);
+                }
+            }
+            
+            size_t used, budget, hist_used, hist_budget;
+            dbg_log_pool_usage(&used, &budget, &hist_used, &hist_budget);
+            char line[120];
+            sprintf(line, "Logs are using %.1f of %.1f MB (history: %.1f of %.1f MB)", 
+                used/1048576.0, budget/1048576.0, hist_used/1048576.0, hist_budget/1048576.0
+            );
+            msg_win_dynamic_append(err_log, line);
+            break;
+        }
+        case CMD_TIME: {
+            dbg_log_set_time_mode(cmd.param);
+            
+            //Every log window needs to be redrawn
+            int rc = twm_tree_redraw(t);
+            if (rc < 0) {
+                char line[80];
+                sprintf(line, "Could not issue redraw: %s", t->error_str);
+                msg_win_dynamic_append(err_log, line);
+            }
+            break;
+        }
+        case CMD_CAPTURE: {
+            symtab_entry *e = symtab_lookup(ids, cmd.id);
+            if (!e) {
+                char line[120];
+                sprintf(line, "Could not find [%s]: %s", cmd.id, ids->error_str);
+                msg_win_dynamic_append(err_log, line);
+                break;
+            }
+            if (sym_dat(e, sem_val*)->type != SYM_FCI) {
+                msg_win_dynamic_append(err_log, "This is not an FPGA");
+                break;
+            }
+            fpga_connection_info *f = sym_dat(e, sem_val*)->v;
+            char line[160];
+            
+            if (!strcmp(cmd.path, "off")) {
+                if (f->cap.map == NULL) {
+                    msg_win_dynamic_append(err_log, "No capture is running");
+                    break;
+                }
+                size_t len = f->cap.pos;
+                unsigned long dropped = f->cap.dropped;
+                int rc = fpga_stop_capture(f);
+                if (rc < 0) {
+                    sprintf(line, "Could not stop capture: %s", f->error_str);
+                } else {
+                    sprintf(line, "Captured %lu bytes (%lu dropped)", (unsigned long) len, dropped);
+                }
+                msg_win_dynamic_append(err_log, line);
+                break;
+            }
+            
+            size_t mb = cmd.has_param ? cmd.param : CAPTURE_DEFAULT_MB;
+            int rc = fpga_start_capture(f, cmd.path, mb*1024*1024);
+            if (rc < 0) {
+                sprintf(line, "Could not start capture: %s", f->error_str);
+                msg_win_dynamic_append(err_log, line);
+            }
+            break;
+        }
         case CMD_HANDLED: {
 			//Nothing to do
 			break;
@@ -679,6 +1163,7 @@ int main(int argc, char **argv) {
     //Setup the TWM screen
     atexit(clean_screen);
     term_init(0);
+    trace_thread_name("ui");
     init_readline(got_rl_line);
     
     t = new_twm_tree();
@@ -711,9 +1196,25 @@ int main(int argc, char **argv) {
     struct event *input_ev = event_new(ev_base, STDIN_FILENO, EV_READ | EV_PERSIST, handle_stdin_cb, ev_base);
     event_add(input_ev, NULL);
     
-    //Event for perdiocally drawing the TWM every 50 ms
-    struct event *draw_ev = event_new(ev_base, -1, EV_TIMEOUT | EV_PERSIST, draw_cb, NULL);
-    event_add(draw_ev, (struct timeval[1]){{0, 50*1000}});
+    //Get our own file description for the terminal, so that making it 
+    //non-blocking doesn't affect stdin or anyone else's writes. If that
+    //doesn't work, frames are just written with blocking writes
+    char const *tty = ttyname(STDOUT_FILENO);
+    if (tty != NULL) {
+        int fd = open(tty, O_WRONLY | O_NONBLOCK | O_NOCTTY);
+        if (fd >= 0) screen_fd = fd;
+    }
+    screen_ev = event_new(ev_base, screen_fd, EV_WRITE, screen_write_cb, NULL);
+    
+    //Event for drawing the TWM. It only gets added when something asks for
+    //a redraw, so draw the first frame right away
+    draw_ev = event_new(ev_base, -1, 0, draw_cb, NULL);
+    twm_set_redraw_hook(schedule_draw);
+    twm_tree_redraw(t);
+    
+    //Take over SIGWINCH from textio (see winch_cb)
+    struct event *winch_ev = evsignal_new(ev_base, SIGWINCH, winch_cb, NULL);
+    event_add(winch_ev, NULL);
     
     //Events for reading from FPGA connections are added by fpga_conn_cb, 
     //which is triggered when a connection is succesfully opened 
@@ -727,7 +1228,13 @@ int main(int argc, char **argv) {
     //Get to work freeing the memory for all these events. This is to
     //declutter valgrind's output and make it easier for me to fix other
     //issues
+    //Cleanup below can still post messages, so stop scheduling frames first
+    finish_frame();
+    twm_set_redraw_hook(NULL);
     event_free(draw_ev);
+    event_free(screen_ev);
+    if (screen_fd != STDOUT_FILENO) close(screen_fd);
+    event_free(winch_ev);
     event_free(input_ev);
     
     //Close any open FPGA connections. Technically we don't have to do this,
@@ -806,19 +1313,24 @@ void cleanup_fpga_connection(fpga_connection_info *f) {
 	//TODO? Should events be freed by del_fpga_connection?
 	//So far, my answer has been no because they are not created by
 	//new_fpga_connection
+    if (f->wake_ev != NULL) event_free(f->wake_ev);
+    fpga_stop_io_thread(f); //Whatever, don't bother error-checking
     event_free(f->rd_ev);
     event_free(f->wr_ev);
     
     int i;
     for (i = 0; i < MAX_GUVS_PER_FPGA; i++) {
         //Whatever, don't bother error-checking
-        dbg_guv *g = f->guvs + i;
+        dbg_guv *g = f->guvs[i];
+        if (g == NULL) continue; //Never created
         //Release ID
         symtab_entry *e = symtab_lookup(ids, g->name);
         if (e) symtab_array_remove(ids, e);
         //Close windows
         twm_tree_remove_item(t, g);
+        twm_tree_remove_item(t, &g->stats);
     }
+    twm_tree_remove_item(t, &f->dash);
     
     //Free this FPGA's ID
     if (f->name) {
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reasm.h"
+#include "textio.h"
+
+char const *const REASM_SUCC = "success";
+char const *const REASM_NULL_ARG = "received NULL argument";
+char const *const REASM_OOM = "out of memory";
+char const *const REASM_INVALID_PARAM = "invalid parameter";
+
+static unsigned reasm_hash(uint32_t TID, uint32_t TDEST) {
+    uint32_t h = TID * 0x9E3779B1u ^ TDEST * 0x85EBCA77u;
+    return h ^ (h >> 15);
+}
+
+//Doubles the size of the TID/TDEST table. Returns 0 on success or -1 if
+//out of memory
+static int reasm_grow_streams(reasm *r) {
+    int new_cap = r->streams_cap ? 2*r->streams_cap : 16;
+    reasm_stream *ns = calloc(new_cap, sizeof(reasm_stream));
+    if (ns == NULL) return -1;
+
+    int i;
+    for (i = 0; i < r->streams_cap; i++) {
+        reasm_stream const *s = r->streams + i;
+        if (!s->used) continue;
+        unsigned h = reasm_hash(s->TID, s->TDEST) & (new_cap - 1);
+        while (ns[h].used) h = (h + 1) & (new_cap - 1);
+        ns[h] = *s;
+    }
+
+    if (r->streams != NULL) free(r->streams);
+    r->streams = ns;
+    r->streams_cap = new_cap;
+    return 0;
+}
+
+//Returns the table entry for this TID/TDEST pair, adding it if needed.
+//Returns NULL if the table is full (or we ran out of memory)
+static reasm_stream *reasm_stream_for(reasm *r, uint32_t TID, uint32_t TDEST) {
+    if (r->streams_cap > 0) {
+        unsigned h = reasm_hash(TID, TDEST) & (r->streams_cap - 1);
+        while (r->streams[h].used) {
+            reasm_stream *s = r->streams + h;
+            if (s->TID == TID && s->TDEST == TDEST) return s;
+            h = (h + 1) & (r->streams_cap - 1);
+        }
+    }
+
+    //Not there. Keep the table at most half full so probes stay short
+    if (r->nstreams == REASM_MAX_STREAMS) return NULL;
+    if (2*(r->nstreams + 1) > r->streams_cap) {
+        if (reasm_grow_streams(r) < 0) return NULL;
+    }
+
+    unsigned h = reasm_hash(TID, TDEST) & (r->streams_cap - 1);
+    while (r->streams[h].used) h = (h + 1) & (r->streams_cap - 1);
+    reasm_stream *s = r->streams + h;
+    s->TID = TID;
+    s->TDEST = TDEST;
+    s->open = 0;
+    s->used = 1;
+    r->nstreams++;
+    return s;
+}
+
+//Statically initialize a reasm. Nothing is allocated until the first flit
+//comes in. Returns 0 on success, or -2 if r is NULL
+int init_reasm(reasm *r) {
+    if (r == NULL) return -2; //This is all we can do
+
+    r->pkts = NULL;
+    r->cap = REASM_DEFAULT_CAP;
+    r->npkts = 0;
+    r->streams = NULL;
+    r->streams_cap = 0;
+    r->nstreams = 0;
+
+    r->error_str = REASM_SUCC;
+    return 0;
+}
+
+//Frees memory allocated by r. Gracefully ignores NULL input
+void deinit_reasm(reasm *r) {
+    if (r == NULL) return;
+
+    if (r->pkts != NULL) free(r->pkts);
+    r->pkts = NULL;
+    if (r->streams != NULL) free(r->streams);
+    r->streams = NULL;
+    r->streams_cap = 0;
+    r->nstreams = 0;
+    r->npkts = 0;
+}
+
+//Adds one flit. Returns 0 on success, -1 on error (and sets r->error_str),
+//or -2 if r or rec is NULL
+int reasm_add_flit(reasm *r, dbg_log_rec const *rec) {
+    if (r == NULL) return -2; //This is all we can do
+    if (rec == NULL) {
+        r->error_str = REASM_NULL_ARG;
+        return -2;
+    }
+
+    if (r->pkts == NULL) {
+        r->pkts = malloc(r->cap * sizeof(reasm_pkt));
+        if (r->pkts == NULL) {
+            r->error_str = REASM_OOM;
+            return -1;
+        }
+    }
+
+    reasm_stream *s = reasm_stream_for(r, rec->TID, rec->TDEST);
+
+    //Find this pair's open packet, as long as it's still in the ring
+    reasm_pkt *p = NULL;
+    int cut = 0;
+    if (s != NULL && s->open != 0) {
+        uint64_t ind = s->open - 1;
+        if (r->npkts - ind <= (uint64_t) r->cap) {
+            p = r->pkts + (ind & (r->cap - 1));
+        } else {
+            cut = 1;
+        }
+    }
+
+    if (p == NULL) {
+        uint64_t ind = r->npkts++;
+        p = r->pkts + (ind & (r->cap - 1));
+        p->first_ns = rec->ns;
+        p->first_seq = rec->seq;
+        p->TID = rec->TID;
+        p->TDEST = rec->TDEST;
+        p->TID_width = rec->TID_width;
+        p->TDEST_width = rec->TDEST_width;
+        p->nflits = 0;
+        p->nbytes = 0;
+        p->npreview = 0;
+        p->flags = REASM_OPEN;
+        if (cut) p->flags |= REASM_CUT;
+        if (s == NULL) p->flags |= REASM_UNTRACKED;
+        else s->open = ind + 1;
+    }
+
+    p->last_ns = rec->ns;
+    p->nflits++;
+    p->nbytes += rec->len;
+
+    //Only the first few bytes of a packet are ever looked at. Bytes come
+    //out most significant first, same as when the flit is printed
+    int w;
+    for (w = 0; 4*w < rec->len && p->npreview < REASM_PREVIEW_BYTES; w++) {
+        int word_bytes = rec->len - 4*w;
+        if (word_bytes > 4) word_bytes = 4;
+        int b;
+        for (b = word_bytes - 1; b >= 0 && p->npreview < REASM_PREVIEW_BYTES; b--) {
+            p->preview[p->npreview++] = rec->TDATA[w] >> (8*b);
+        }
+    }
+
+    if (rec->TLAST || s == NULL) {
+        p->flags &= ~REASM_OPEN;
+        if (s != NULL) s->open = 0;
+    }
+
+    r->error_str = REASM_SUCC;
+    return 0;
+}
+
+//Number of packets that can be shown
+int reasm_npkts(reasm const *r) {
+    return (r->npkts < (uint64_t) r->cap) ? r->npkts : r->cap;
+}
+
+//Returns the i'th newest packet (0 is the most recent, which might still
+//be open), or NULL if there is no such packet
+reasm_pkt const *reasm_get(reasm const *r, int i) {
+    if (i < 0 || i >= reasm_npkts(r)) return NULL;
+    return r->pkts + ((r->npkts - 1 - i) & (r->cap - 1));
+}
+
+//Formats pkt as a single line into line, which has room for n bytes
+//(including the NUL). Times are shown the same way as in l (which is
+//the log the flits went into). prev is the packet that started just before
+//pkt, or NULL. Returns number of characters written
+int reasm_fmt_pkt(dbg_log const *l, reasm_pkt const *pkt, reasm_pkt const *prev, char *line, int n) {
+    int len = snprintf(line, n, "#%u ", pkt->first_seq);
+    if (len >= n) return len;
+    len += dbg_log_fmt_time(l, pkt->first_ns, prev ? &prev->first_ns : NULL, line + len, n - len);
+    if (len >= n) return len;
+
+    if (pkt->TID_width > 0) {
+        len += snprintf(line + len, n - len, " TID %u", pkt->TID);
+        if (len >= n) return len;
+    }
+    if (pkt->TDEST_width > 0) {
+        len += snprintf(line + len, n - len, " TDEST %u", pkt->TDEST);
+        if (len >= n) return len;
+    }
+
+    //Duration is from first flit to last flit
+    len += snprintf(line + len, n - len, " %u flit%s %u B in %.3f us%s%s:",
+        pkt->nflits, pkt->nflits == 1 ? "" : "s", pkt->nbytes,
+        (pkt->last_ns - pkt->first_ns)/1e3,
+        (pkt->flags & REASM_OPEN) ? " (open)" : "",
+        (pkt->flags & REASM_CUT) ? " (cut)" : ""
+    );
+    if (len >= n) return len;
+
+    int i;
+    for (i = 0; i < pkt->npreview; i++) {
+        len += snprintf(line + len, n - len, " %02x", pkt->preview[i]);
+        if (len >= n) return len;
+    }
+    if (pkt->nbytes > pkt->npreview) {
+        len += snprintf(line + len, n - len, " ...");
+    }
+
+    return len;
+}
+
+//Draws one packet per line, newest at the bottom, starting from offset
+//packets back. Same guarantees and return values as draw_dbg_log
+int draw_reasm(reasm *r, dbg_log const *l, int offset, int x, int y, int w, int h, char *buf) {
+    //Sanity check inputs
+    if (r == NULL) {
+        return -2; //This is all we can do
+    }
+
+    if (w == 0 || h == 0) return 0; //Nothing to draw
+    if (x >= term_cols || y >= term_rows) return 0; //Nothing to draw
+
+    if (x < 0 || y < 0 || w < 0 || h < 0) {
+        r->error_str = REASM_INVALID_PARAM;
+        return -1;
+    }
+
+    char *buf_saved = buf;
+
+    //Clip drawing rect to stay on the screen
+    if ((x+w-1) > term_cols) w = term_cols - x;
+    if ((y+h-1) > term_rows) h = term_rows - y;
+
+    //Don't let the user scroll past the oldest packet
+    int total = reasm_npkts(r);
+    if (offset + h > total) offset = total - h;
+    if (offset < 0) offset = 0;
+
+    int i;
+    for (i = 0; i < h; i++) {
+        int incr = cursor_pos_cmd(buf, x, y + i);
+        buf += incr;
+
+        char line[160];
+        line[0] = '\0';
+
+        //Rows above the oldest packet are left blank
+        int ind = offset + h - 1 - i;
+        reasm_pkt const *pkt = reasm_get(r, ind);
+        if (pkt != NULL) {
+            reasm_fmt_pkt(l, pkt, reasm_get(r, ind + 1), line, sizeof(line));
+        }
+
+        sprintf(buf, "%-*.*s%n", w, w, line, &incr);
+        buf += incr;
+    }
+
+    r->error_str = REASM_SUCC;
+    return buf - buf_saved;
+}
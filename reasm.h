@@ -0,0 +1,102 @@
+#ifndef REASM_H
+#define REASM_H 1
+
+#include <stdint.h>
+#include "dbg_log.h"
+
+//Stitches log flits back together into AXI Stream packets. Flits for
+//different TID/TDEST pairs can be interleaved, so each pair gets its own
+//open packet, and a packet ends at its TLAST flit.
+//
+//Packets live in a fixed-size ring, in the order they started. A packet
+//gets its slot as soon as its first flit shows up and is then updated in
+//place, so adding a flit is a hash lookup plus a few stores, and TDATA is
+//only copied (into the little preview) once. The full TDATA stays in the
+//guv's log; first_seq says where to find it.
+
+#define REASM_DEFAULT_CAP 2048  //Packets remembered per guv. Power of two
+#define REASM_MAX_STREAMS 1024  //Distinct TID/TDEST pairs we keep track of
+#define REASM_PREVIEW_BYTES 16
+
+//Packet flags
+#define REASM_OPEN      0x1 //Haven't seen TLAST yet
+#define REASM_CUT       0x2 //Earlier flits belonged to a packet that fell
+                            //out of the ring, so this isn't the whole thing
+#define REASM_UNTRACKED 0x4 //Too many TID/TDEST pairs; every flit on this
+                            //one is its own packet
+
+typedef struct _reasm_pkt {
+    uint64_t first_ns;  //Arrival time of first flit
+    uint64_t last_ns;   //Arrival time of most recent flit
+    uint32_t first_seq; //Sequence number (in the guv's log) of first flit
+    uint32_t TID;
+    uint32_t TDEST;
+    uint32_t nflits;
+    uint32_t nbytes;
+    uint8_t TID_width;
+    uint8_t TDEST_width;
+    uint8_t flags;
+    uint8_t npreview;   //Number of valid bytes in preview
+    uint8_t preview[REASM_PREVIEW_BYTES]; //First few TDATA bytes, in the
+                                          //same order they are printed
+} reasm_pkt;
+
+//One entry in the open-addressed TID/TDEST table. Entries are never
+//removed; the number of pairs in a real design is small
+typedef struct _reasm_stream {
+    uint32_t TID;
+    uint32_t TDEST;
+    uint64_t open; //1 + index of this pair's open packet, or 0 if none
+    int used;
+} reasm_stream;
+
+typedef struct _reasm {
+    reasm_pkt *pkts;    //Ring. Allocated on first flit
+    int cap;            //Power of two
+    uint64_t npkts;     //Number of packets ever started
+
+    reasm_stream *streams;
+    int streams_cap;    //Zero or a power of two
+    int nstreams;
+
+    //Error information
+    char const *error_str;
+} reasm;
+
+//Statically initialize a reasm. Nothing is allocated until the first flit
+//comes in. Returns 0 on success, or -2 if r is NULL
+int init_reasm(reasm *r);
+
+//Frees memory allocated by r. Gracefully ignores NULL input
+void deinit_reasm(reasm *r);
+
+//Adds one flit. Returns 0 on success, -1 on error (and sets r->error_str),
+//or -2 if r or rec is NULL
+int reasm_add_flit(reasm *r, dbg_log_rec const *rec);
+
+//Number of packets that can be shown
+int reasm_npkts(reasm const *r);
+
+//Returns the i'th newest packet (0 is the most recent, which might still
+//be open), or NULL if there is no such packet
+reasm_pkt const *reasm_get(reasm const *r, int i);
+
+//Formats pkt as a single line into line, which has room for n bytes
+//(including the NUL). Times are shown the same way as in l (which is
+//the log the flits went into). prev is the packet that started just before
+//pkt, or NULL. Returns number of characters written
+int reasm_fmt_pkt(dbg_log const *l, reasm_pkt const *pkt, reasm_pkt const *prev, char *line, int n);
+
+//Draws one packet per line, newest at the bottom, starting from offset
+//packets back. Same guarantees and return values as draw_dbg_log
+int draw_reasm(reasm *r, dbg_log const *l, int offset, int x, int y, int w, int h, char *buf);
+
+//////////////////////////////////////////////////
+//Error codes, which double as printable strings//
+//////////////////////////////////////////////////
+extern char const *const REASM_SUCC; // = "success";
+extern char const *const REASM_NULL_ARG; // = "received NULL argument";
+extern char const *const REASM_OOM; // = "out of memory";
+extern char const *const REASM_INVALID_PARAM; // = "invalid parameter";
+
+#endif
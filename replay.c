@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dbg_guv.h"
+#include "capture.h"
+#include "textio.h"
+
+//Feeds a capture of the FPGA->host stream through the real decoder, so we
+//can reproduce log storms and measure decoder changes without netcat,
+//fifos, and fake_dbg_guv. Takes either a capture file or a raw dump of the
+//stream (see capture.h).
+//
+//In "fast" mode (the default) the data is pushed through as quickly as
+//possible. In "timed" mode each chunk is held back until the same time
+//(relative to the first chunk) that it was originally received. Raw dumps
+//have no timestamps, so they can only be replayed in fast mode.
+
+//Size of the pieces a raw dump is cut into. Roughly what a busy socket
+//hands back per read()
+#define REPLAY_RAW_CHUNK 4096
+
+//Some of the code we link against writes errors here
+msg_win *err_log = NULL;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t ns) {
+    struct timespec ts = {
+        .tv_sec = ns / 1000000000ull,
+        .tv_nsec = ns % 1000000000ull
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+//Pushes one pass of the capture through f. Returns number of bytes fed,
+//or -1 if the file is corrupt
+static long replay_capture(fpga_connection_info *f, char const *data, size_t len, int timed) {
+    capture_file_hdr const *hdr = (capture_file_hdr const *) data;
+    size_t pos = hdr->hdr_len;
+    size_t end = hdr->hdr_len + hdr->data_len;
+    if (end > len) end = len; //Capture was cut short; use what's there
+
+    long fed = 0;
+    uint64_t first_ns = 0, base_ns = now_ns();
+    int first = 1;
+    while (pos + sizeof(capture_chunk_hdr) <= end) {
+        capture_chunk_hdr const *c = (capture_chunk_hdr const *) (data + pos);
+        if (c->len == 0 && c->ns == 0) break; //Preallocated but never written
+        if (pos + CAPTURE_CHUNK_SZ(c->len) > end) return -1;
+
+        if (timed) {
+            if (first) first_ns = c->ns;
+            else sleep_until_ns(base_ns + (c->ns - first_ns));
+            first = 0;
+        }
+
+        fpga_connection_ingest(f, data + pos + sizeof(capture_chunk_hdr), c->len);
+        fed += c->len;
+        pos += CAPTURE_CHUNK_SZ(c->len);
+    }
+
+    return fed;
+}
+
+//Same thing for a headerless dump
+static long replay_raw(fpga_connection_info *f, char const *data, size_t len) {
+    size_t pos;
+    for (pos = 0; pos < len; pos += REPLAY_RAW_CHUNK) {
+        size_t amt = len - pos;
+        if (amt > REPLAY_RAW_CHUNK) amt = REPLAY_RAW_CHUNK;
+        fpga_connection_ingest(f, data + pos, amt);
+    }
+    return len;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: replay CAPTURE_FILE [fast|timed] [REPEATS]\n");
+        return -1;
+    }
+
+    int timed = 0;
+    if (argc >= 3) {
+        if (!strcmp(argv[2], "timed")) timed = 1;
+        else if (strcmp(argv[2], "fast")) {
+            fprintf(stderr, "Mode must be fast or timed, not [%.32s]\n", argv[2]);
+            return -1;
+        }
+    }
+
+    int repeats = 1;
+    if (argc == 4 && (sscanf(argv[3], "%d", &repeats) != 1 || repeats < 1)) {
+        fprintf(stderr, "Could not parse repeat count [%.32s]\n", argv[3]);
+        return -1;
+    }
+
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open [%.64s]: %s\n", argv[1], strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "Could not get size of [%.64s] (or it's empty)\n", argv[1]);
+        close(fd);
+        return -1;
+    }
+    size_t len = st.st_size;
+
+    char const *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); //The mapping stays valid
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Could not map [%.64s]: %s\n", argv[1], strerror(errno));
+        return -1;
+    }
+
+    //Page the whole thing in ahead of time so we're timing the decoder and
+    //not the disk
+    madvise((void *) data, len, MADV_SEQUENTIAL);
+    madvise((void *) data, len, MADV_WILLNEED);
+    volatile char touch;
+    size_t i;
+    for (i = 0; i < len; i += 4096) touch = data[i];
+    (void) touch;
+
+    int is_capture = (len >= sizeof(capture_file_hdr) && !memcmp(data, CAPTURE_MAGIC, 8));
+    if (is_capture) {
+        capture_file_hdr const *hdr = (capture_file_hdr const *) data;
+        if (hdr->version != CAPTURE_VERSION || hdr->hdr_len < sizeof(capture_file_hdr)) {
+            fprintf(stderr, "Unsupported capture version %u\n", hdr->version);
+            return -1;
+        }
+        printf("Capture file, %lu bytes of stream data\n", (unsigned long) hdr->data_len);
+        int j;
+        for (j = 0; j < hdr->num_guvs && j < CAPTURE_MAX_GUVS; j++) {
+            printf("    guv %u: TID_width = %u, TDEST_width = %u\n",
+                hdr->guvs[j].addr, hdr->guvs[j].TID_width, hdr->guvs[j].TDEST_width
+            );
+        }
+    } else if (timed) {
+        fprintf(stderr, "Raw dumps have no timestamps; use fast mode\n");
+        return -1;
+    } else {
+        printf("Raw dump, %lu bytes\n", (unsigned long) len);
+    }
+
+    fpga_connection_info *f = new_fpga_connection();
+    if (f == NULL) {
+        fprintf(stderr, "Could not allocate fpga_connection_info\n");
+        return -1;
+    }
+
+    long fed = 0;
+    uint64_t start = now_ns();
+    int r;
+    for (r = 0; r < repeats; r++) {
+        long rc = is_capture ? replay_capture(f, data, len, timed) : replay_raw(f, data, len);
+        if (rc < 0) {
+            fprintf(stderr, "Capture is corrupt\n");
+            return -1;
+        }
+        fed += rc;
+    }
+    uint64_t elapsed = now_ns() - start;
+    if (elapsed == 0) elapsed = 1;
+
+    unsigned long pkts = f->rx_receipts + f->rx_logs;
+    printf("Fed %ld bytes in %.3f ms (%.1f MB/s)\n", fed, elapsed/1e6, fed*1e3/elapsed);
+    printf("Decoded %lu receipts and %lu logs on %d guvs\n", f->rx_receipts, f->rx_logs, f->num_guvs);
+    if (pkts > 0) {
+        printf("%.0f packets/s, %.1f ns/packet\n", pkts*1e9/elapsed, (double) elapsed/pkts);
+    }
+    if (f->in_wr != f->in_rd) {
+        printf("(%u bytes of partial packet left over)\n", f->in_wr - f->in_rd);
+    }
+
+    del_fpga_connection(f);
+    munmap((void *) data, len);
+    return 0;
+}
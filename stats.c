@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <string.h>
+#include "stats.h"
+#include "textio.h"
+
+char const *const STATS_SUCC = "success";
+
+//Statically initialize a guv_stats. Returns 0 on success, or -2 if s is
+//NULL
+int init_guv_stats(guv_stats *s, char const *name) {
+    if (s == NULL) return -2; //This is all we can do
+
+    memset(s, 0, sizeof(guv_stats));
+    s->name = name;
+    s->need_redraw = 1;
+
+    s->error_str = STATS_SUCC;
+    return 0;
+}
+
+//Counts one log flit
+void stats_add_flit(guv_stats *s, dbg_log_rec const *rec) {
+    s->flits++;
+    s->bytes += rec->len;
+    s->pkts += rec->TLAST;
+    if (rec->TID_width > 0) {
+        s->tid_cnt[rec->TID < STATS_NBUCKETS - 1 ? rec->TID : STATS_NBUCKETS - 1]++;
+    }
+    if (rec->TDEST_width > 0) {
+        s->tdest_cnt[rec->TDEST < STATS_NBUCKETS - 1 ? rec->TDEST : STATS_NBUCKETS - 1]++;
+    }
+}
+
+//Counts one command receipt
+void stats_add_receipt(guv_stats *s, int inj_failed, unsigned dout_not_rdy_cnt) {
+    s->receipts++;
+    s->inj_failed += (inj_failed != 0);
+    if (dout_not_rdy_cnt > s->dout_not_rdy_max) s->dout_not_rdy_max = dout_not_rdy_cnt;
+}
+
+//Takes a snapshot if a full period has gone by since the last one. Returns
+//1 if it did, 0 if not
+int stats_sample_now(guv_stats *s, uint64_t now) {
+    if (s->nsamples > 0) {
+        stats_sample const *last = s->samples + ((s->nsamples - 1) & (STATS_NSAMPLES - 1));
+        if (now - last->ns < STATS_PERIOD_NS) return 0;
+    }
+
+    stats_sample *smp = s->samples + (s->nsamples & (STATS_NSAMPLES - 1));
+    smp->ns = now;
+    smp->flits = s->flits;
+    smp->pkts = s->pkts;
+    smp->bytes = s->bytes;
+    smp->receipts = s->receipts;
+    smp->dout_not_rdy_max = s->dout_not_rdy_max;
+    s->dout_not_rdy_max = 0;
+    s->nsamples++;
+
+    s->need_redraw = 1;
+    return 1;
+}
+
+//Returns the i'th newest snapshot (0 is the most recent), or NULL if there
+//isn't one
+static stats_sample const *stats_get_sample(guv_stats const *s, int i) {
+    if (i < 0 || i >= STATS_NSAMPLES || (uint64_t) i >= s->nsamples) return NULL;
+    return s->samples + ((s->nsamples - 1 - i) & (STATS_NSAMPLES - 1));
+}
+
+//Nonzero if another snapshot would change what's shown: either something
+//happened since the last one, or the rates haven't settled to zero yet
+static int stats_moving(guv_stats const *s) {
+    stats_sample const *cur = stats_get_sample(s, 0);
+    stats_sample const *prev = stats_get_sample(s, 1);
+    if (cur == NULL || prev == NULL) return 1;
+    if (s->flits != cur->flits || s->receipts != cur->receipts) return 1;
+    return cur->flits != prev->flits || cur->receipts != prev->receipts || cur->dout_not_rdy_max != 0;
+}
+
+//Prints x with a k/M/G suffix
+static int fmt_si(char *line, int n, double x) {
+    if (x < 1e3) return snprintf(line, n, "%.1f", x);
+    if (x < 1e6) return snprintf(line, n, "%.1fk", x/1e3);
+    if (x < 1e9) return snprintf(line, n, "%.1fM", x/1e6);
+    return snprintf(line, n, "%.1fG", x/1e9);
+}
+
+//Per-second rate of one of the running totals over the last period. off
+//is the offset of that total inside a stats_sample
+static int fmt_rate(guv_stats const *s, size_t off, char *line, int n) {
+    stats_sample const *cur = stats_get_sample(s, 0);
+    stats_sample const *prev = stats_get_sample(s, 1);
+    if (prev == NULL) return snprintf(line, n, "-");
+
+    uint64_t a = *(uint64_t const *)((char const *)prev + off);
+    uint64_t b = *(uint64_t const *)((char const *)cur + off);
+    return fmt_si(line, n, (b - a) * 1e9 / (cur->ns - prev->ns));
+}
+
+//Shows what fraction of flits went to each bucket, biggest first
+static int fmt_dist(uint64_t const *cnt, char *line, int n) {
+    uint64_t total = 0;
+    int i;
+    for (i = 0; i < STATS_NBUCKETS; i++) total += cnt[i];
+    if (total == 0) return snprintf(line, n, "-");
+
+    //Just a selection sort. There are only 16 of them and this only runs
+    //once a second
+    int done[STATS_NBUCKETS] = {0};
+    int len = 0;
+    while (len < n) {
+        int best = -1;
+        for (i = 0; i < STATS_NBUCKETS; i++) {
+            if (done[i] || cnt[i] == 0) continue;
+            if (best < 0 || cnt[i] > cnt[best]) best = i;
+        }
+        if (best < 0) break;
+        done[best] = 1;
+        len += snprintf(line + len, n - len, "%s%d%s:%.0f%%",
+            len ? " " : "", best, (best == STATS_NBUCKETS - 1) ? "+" : "",
+            100.0 * cnt[best] / total
+        );
+    }
+    return len;
+}
+
+//ASCII sparkline of dout_not_rdy_cnt, oldest on the left, scaled to the
+//biggest value shown
+static int fmt_dout_series(guv_stats const *s, char *line, int n) {
+    static char const ramp[] = "_.:-=+*#";
+    int levels = sizeof(ramp) - 2;
+
+    int num = STATS_NSAMPLES;
+    if ((uint64_t) num > s->nsamples) num = s->nsamples;
+    if (num > n - 1) num = n - 1;
+    if (num <= 0) {
+        if (n > 0) line[0] = '\0';
+        return 0;
+    }
+
+    unsigned max = 0;
+    int i;
+    for (i = 0; i < num; i++) {
+        unsigned v = stats_get_sample(s, i)->dout_not_rdy_max;
+        if (v > max) max = v;
+    }
+
+    for (i = 0; i < num; i++) {
+        unsigned v = stats_get_sample(s, num - 1 - i)->dout_not_rdy_max;
+        line[i] = ramp[max ? (int)((uint64_t) v * levels / max) : 0];
+    }
+    line[num] = '\0';
+    return num;
+}
+
+//Returns number of bytes added into buf, or -1 on error.
+int draw_fn_guv_stats(void *item, int x, int y, int w, int h, char *buf) {
+    guv_stats *s = (guv_stats*) item;
+    if (!s) return -1;
+
+    if (s->need_redraw == 0) return 0; //Nothing to draw!
+
+    char *buf_saved = buf;
+
+    //Lines to print, not counting the title bar
+    char lines[6][160];
+    char a[32], b[32], c[32];
+
+    fmt_rate(s, offsetof(stats_sample, flits), a, sizeof(a));
+    fmt_rate(s, offsetof(stats_sample, pkts), b, sizeof(b));
+    fmt_rate(s, offsetof(stats_sample, bytes), c, sizeof(c));
+    snprintf(lines[0], sizeof(lines[0]), "Flits/s: %s  Packets/s: %s  Bytes/s: %s", a, b, c);
+
+    if (s->pkts > 0) {
+        snprintf(a, sizeof(a), "%.1f B", (double) s->bytes / s->pkts);
+    } else {
+        snprintf(a, sizeof(a), "-");
+    }
+    snprintf(lines[1], sizeof(lines[1]), "Total: %llu flits, %llu packets, %llu B (avg packet %s)",
+        (unsigned long long) s->flits, (unsigned long long) s->pkts,
+        (unsigned long long) s->bytes, a
+    );
+
+    fmt_rate(s, offsetof(stats_sample, receipts), a, sizeof(a));
+    snprintf(lines[2], sizeof(lines[2]), "Receipts/s: %s  inj_failed: %llu",
+        a, (unsigned long long) s->inj_failed
+    );
+
+    int len = snprintf(lines[3], sizeof(lines[3]), "TDEST: ");
+    fmt_dist(s->tdest_cnt, lines[3] + len, sizeof(lines[3]) - len);
+    len = snprintf(lines[4], sizeof(lines[4]), "TID:   ");
+    fmt_dist(s->tid_cnt, lines[4] + len, sizeof(lines[4]) - len);
+
+    stats_sample const *last = stats_get_sample(s, 0);
+    len = snprintf(lines[5], sizeof(lines[5]), "dout_not_rdy (%u): ", last ? last->dout_not_rdy_max : 0);
+    fmt_dout_series(s, lines[5] + len, sizeof(lines[5]) - len);
+
+    //Title bar, in inverted video
+    int incr = cursor_pos_cmd(buf, x, y);
+    buf += incr;
+    *buf++ = '\e'; *buf++ = '['; *buf++ = '7'; *buf++ = 'm';
+    char title[64];
+    snprintf(title, sizeof(title), "%s stats", s->name ? s->name : "");
+    sprintf(buf, "%-*.*s%n", w, w, title, &incr);
+    buf += incr;
+    *buf++ = '\e'; *buf++ = '['; *buf++ = '2'; *buf++ = '7'; *buf++ = 'm';
+
+    int i;
+    for (i = 1; i < h; i++) {
+        incr = cursor_pos_cmd(buf, x, y + i);
+        buf += incr;
+        sprintf(buf, "%-*.*s%n", w, w, (i - 1 < 6) ? lines[i - 1] : "", &incr);
+        buf += incr;
+    }
+
+    s->need_redraw = 0;
+
+    return buf - buf_saved;
+}
+
+//Returns how many bytes are needed (can be an upper bound) to draw the
+//stats given the size. This is also where snapshots get taken
+int draw_sz_guv_stats(void *item, int w, int h) {
+    guv_stats *s = (guv_stats*) item;
+    if (!s) return -1;
+
+    uint64_t now = dbg_log_now_ns();
+    stats_sample_now(s, now);
+
+    //Nobody polls us, so ask to be woken up for the next snapshot. Once
+    //things have been quiet for a whole period, we can sleep
+    if (stats_moving(s)) {
+        stats_sample const *last = stats_get_sample(s, 0);
+        twm_request_redraw_in(last->ns + STATS_PERIOD_NS - now);
+    }
+
+    if (s->need_redraw == 0) return 0; //Nothing to draw!
+
+    return 4 + 5 + h*(10 + w);
+}
+
+//Tells us that we should redraw, probably because we moved to another
+//area of the screen
+void trigger_redraw_guv_stats(void *item) {
+    guv_stats *s = (guv_stats*) item;
+    if (!s) return;
+
+    s->need_redraw = 1;
+}
+
+draw_operations const guv_stats_draw_ops = {
+    draw_fn_guv_stats,
+    draw_sz_guv_stats,
+    trigger_redraw_guv_stats,
+    NULL //No exit function needed
+};
@@ -0,0 +1,83 @@
+#ifndef STATS_H
+#define STATS_H 1
+
+#include <stdint.h>
+#include "dbg_log.h"
+#include "twm.h"
+
+//Live traffic statistics for one guv. The decode path only ever bumps
+//running totals (a handful of adds per flit), so these are always on.
+//Rates are worked out when the stats pane is drawn: once per period it
+//takes a snapshot of the totals, and the difference between the last two
+//snapshots gives the rate. The snapshots also make up the time series.
+
+#define STATS_NBUCKETS 16   //TID/TDEST values 0 to 14 get their own
+                            //bucket; everything else goes in the last one
+#define STATS_NSAMPLES 64   //Length of time series. Power of two
+#define STATS_PERIOD_NS 1000000000ull
+
+typedef struct _stats_sample {
+    uint64_t ns;
+    uint64_t flits;
+    uint64_t pkts;
+    uint64_t bytes;
+    uint64_t receipts;
+    unsigned dout_not_rdy_max; //Largest dout_not_rdy_cnt seen this period
+} stats_sample;
+
+typedef struct _guv_stats {
+    //Running totals
+    uint64_t flits;
+    uint64_t pkts;      //Flits with TLAST set
+    uint64_t bytes;
+    uint64_t receipts;
+    uint64_t inj_failed; //Receipts with inj_failed set
+    uint64_t tid_cnt[STATS_NBUCKETS];   //Only flits that have a TID
+    uint64_t tdest_cnt[STATS_NBUCKETS]; //Only flits that have a TDEST
+    unsigned dout_not_rdy_max; //Since the last snapshot
+
+    //Snapshots, oldest first
+    stats_sample samples[STATS_NSAMPLES];
+    uint64_t nsamples; //Number of snapshots ever taken
+
+    //Display information
+    char const *name; //Points at the guv's name, so it follows renames
+    int need_redraw;
+
+    //Error information
+    char const *error_str;
+} guv_stats;
+
+//Statically initialize a guv_stats. Returns 0 on success, or -2 if s is
+//NULL
+int init_guv_stats(guv_stats *s, char const *name);
+
+//Counts one log flit
+void stats_add_flit(guv_stats *s, dbg_log_rec const *rec);
+
+//Counts one command receipt
+void stats_add_receipt(guv_stats *s, int inj_failed, unsigned dout_not_rdy_cnt);
+
+//Takes a snapshot if a full period has gone by since the last one. Returns
+//1 if it did, 0 if not
+int stats_sample_now(guv_stats *s, uint64_t now);
+
+//Returns number of bytes added into buf, or -1 on error.
+int draw_fn_guv_stats(void *item, int x, int y, int w, int h, char *buf);
+
+//Returns how many bytes are needed (can be an upper bound) to draw the
+//stats given the size. This is also where snapshots get taken
+int draw_sz_guv_stats(void *item, int w, int h);
+
+//Tells us that we should redraw, probably because we moved to another
+//area of the screen
+void trigger_redraw_guv_stats(void *item);
+
+extern draw_operations const guv_stats_draw_ops;
+
+//////////////////////////////////////////////////
+//Error codes, which double as printable strings//
+//////////////////////////////////////////////////
+extern char const *const STATS_SUCC; // = "success";
+
+#endif
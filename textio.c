@@ -85,6 +85,12 @@ static void get_term_sz() {
     if (resize_cb != NULL) resize_cb();
 }
 
+//Re-reads the terminal size and calls the resize callback, outside of the
+//signal handler
+void term_resized() {
+    get_term_sz();
+}
+
 //Returns 0 on success, -1 on error
 int term_init(int enable_mouse) {
     //Check if we are outputting to a TTY
@@ -543,7 +549,7 @@ int textio_getch_cr(char c, textio_input *res) {
     static int parsed_num_dirty; //If nonzero, it means we read in a few digits
     
     //Some of the code below expects initialized values in the struct
-    res->wc[5] = 0; //NUL-terminate unicode char string
+    res->wc[4] = 0; //NUL-terminate unicode char string
     res->csi_seen = 0;
     res->qmark_seen = 0;
     res->num_params = 0;
@@ -1038,6 +1044,7 @@ void msg_win_set_name(msg_win *m, char *name) {
 char* msg_win_append(msg_win *m, char *log) {
     char *ret = linebuf_append(&m->l, log);
     m->need_redraw = 1;
+    twm_request_redraw();
     return ret;
 }
 
@@ -1123,6 +1130,7 @@ void msg_win_scroll(msg_win *m, int amount) {
     if (m->buf_offset < 0) m->buf_offset = 0;
     if (m->buf_offset >= m->l.nlines) m->buf_offset = m->l.nlines - 1;
     m->need_redraw = 1;
+    twm_request_redraw();
 }
 
 draw_operations const msg_win_draw_ops = {
@@ -148,6 +148,12 @@ extern int term_rows, term_cols;
 //Pass NULL to remove the callback
 void set_resize_cb(win_resize_cb *cb);
 
+//Re-reads the terminal size and calls the resize callback. This is what 
+//textio's SIGWINCH handler does, but that runs inside the signal handler.
+//If you would rather get SIGWINCH through your event loop (e.g. with 
+//evsignal_new, which replaces textio's handler), call this from there
+void term_resized();
+
 void cursor_pos(int x, int y);
 
 //Writes command into buf, returns number of bytes written
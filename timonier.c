@@ -12,6 +12,7 @@
 #include "timonier.h"
 #include "textio.h"
 #include "coroutine.h"
+#include "trace.h"
 
 //I don't feel bad about this global variable being here, since I really 
 //only moved this stuff out of main.c to keep the code files more organized.
@@ -163,6 +164,17 @@ typedef enum _fio_state_t {
                         //is told to unpause
 #define FIO_HI_WMARK 384 //If output buffer goes above this level, the dbg_guv
                          //is told to pause
+#define FIO_MAX_WINDOW 64 //Most flits we'll ever have in flight at once
+#define FIO_FLIT_CMD_BYTES 12 //INJ_TDATA (addr + param) and a LATCH
+
+//Windowed injection keeps a record of each flit that has been sent but not
+//yet acknowledged. The hardware sends exactly one receipt per LATCH, and
+//they come back in order, so the oldest entry always matches the next 
+//receipt
+typedef struct _fio_flit {
+    uint32_t tdata;
+    int retx; //1 if this is a retransmission
+} fio_flit;
 typedef struct _fio {
 	dbg_guv *owner;
 	
@@ -179,11 +191,27 @@ typedef struct _fio {
     int send_fd;
     int send_bytes;
     char const *send_error_str;
+    uint32_t send_tdata; //Flit the stop-and-wait FSM is about to send. It
+                         //lives here since we may pause right before it
     //Input buffer and read event
     char in_buf[FIO_BUF_SIZE];
     int in_buf_pos, in_buf_len;
     struct event *file_rd_ev;
     
+    //Windowed injection. When send_window is 1 we use the old stop-and-wait
+    //state machine (sendfile_fsm), otherwise we use sendfile_pump
+    int send_window; //Maximum number of flits in flight, set by the user
+    int send_cwnd; //Current limit. Drops to 1 on a failed inject and then
+                   //grows back by one for every successful inject
+    fio_flit win[FIO_MAX_WINDOW]; //Ring of in-flight flits
+    int win_pos, win_len;
+    uint32_t resend[FIO_MAX_WINDOW]; //Ring of failed flits waiting to be
+                                     //retransmitted (oldest first)
+    int resend_pos, resend_len;
+    int send_eof; //Read the whole file, just waiting for stuff in flight
+    int send_stray_receipts; //Receipts from our own end-of-file latch
+    struct event *send_timer_ev; //Retry backoff
+    
     //Output file
     fio_file_state_t log_state;
     char log_file[MAX_FIO_NAME_SZ+1];
@@ -200,10 +228,18 @@ typedef struct _fio {
     struct event *file_wr_ev;
 } fio;
 
+static int sendfile_pump(fio *f);
+static void fio_window_rd_ev(fio *f, int fd);
+
 //Handles event to read from input file
-static void fio_file_rd_ev(evutil_socket_t fd, short what, void *arg) {
+static void fio_file_rd(evutil_socket_t fd, short what, void *arg) {
 	fio *f = arg;
 	
+    if (f->send_window > 1) {
+        fio_window_rd_ev(f, fd);
+        return;
+    }
+    
     //Special case: if ring buffer is empty, put the position back to 0.
     //Reduces ugly straddling cases.
     if (f->in_buf_len == 0) f->in_buf_pos = 0;
@@ -219,14 +255,19 @@ static void fio_file_rd_ev(evutil_socket_t fd, short what, void *arg) {
 		return;
 	} else if (rc == 0) {
         //Turn off TVALID to prevent accidental sends
-        rc = dbg_guv_send_cmd(f->owner, INJ_TVALID, 0);
+        dbg_guv_txn txn;
+        dbg_guv_txn_begin(&txn, f->owner->parent);
+        rc = dbg_guv_txn_write(&txn, f->owner, INJ_TVALID, 0);
         if (rc == 0) {
-            rc = dbg_guv_send_cmd(f->owner, LATCH, 0);
+            rc = dbg_guv_txn_write(&txn, f->owner, LATCH, 0);
+        }
+        if (rc == 0) {
+            rc = dbg_guv_txn_commit(&txn);
         }
         
         if (rc < 0) {
             //Is this really necessary?
-            f->send_error_str = f->owner->parent->error_str;
+            f->send_error_str = txn.error_str;
             f->send_state = FIO_ERROR;
         }
         
@@ -263,16 +304,21 @@ static void fio_file_rd_ev(evutil_socket_t fd, short what, void *arg) {
     f->in_buf_len -= 4;
 	
 	//Send the inject and latch commands
-	rc = dbg_guv_send_cmd(f->owner, INJ_TDATA, tdata);
+	dbg_guv_txn txn;
+	dbg_guv_txn_begin(&txn, f->owner->parent);
+	rc = dbg_guv_txn_write(&txn, f->owner, INJ_TDATA, tdata);
     if (rc == 0) {
-        rc = dbg_guv_send_cmd(f->owner, INJ_TVALID, 1);
+        rc = dbg_guv_txn_write(&txn, f->owner, INJ_TVALID, 1);
     }
 	if (rc == 0) {
-		rc = dbg_guv_send_cmd(f->owner, LATCH, 0);
+		rc = dbg_guv_txn_write(&txn, f->owner, LATCH, 0);
+	}
+	if (rc == 0) {
+		rc = dbg_guv_txn_commit(&txn);
 	}
 	
 	if (rc < 0) {
-		f->send_error_str = f->owner->parent->error_str;
+		f->send_error_str = txn.error_str;
 		f->send_state = FIO_ERROR;
 		return;
 	}
@@ -289,12 +335,12 @@ static void fio_file_rd_ev(evutil_socket_t fd, short what, void *arg) {
 
 //Handles event to write to logfile
 //TODO: change to writev when I get the chance
-static void fio_file_wr_ev(evutil_socket_t fd, short what, void *arg) {
+static void fio_file_wr(evutil_socket_t fd, short what, void *arg) {
     fio *f = arg;
     
     //See how any contiguous bytes we can use from the circular buffer
     int contig = f->out_buf_len;
-    if (f->out_buf_pos + f->out_buf_len > FCI_BUF_SIZE) {
+    if (f->out_buf_pos + f->out_buf_len > FIO_BUF_SIZE) {
 		contig = FIO_BUF_SIZE - f->out_buf_pos;
 	}
 	
@@ -368,7 +414,7 @@ static void retry_inject(evutil_socket_t fd, short what, void *arg) {
 //Yes, this has the classic performance problem that we make a ton of
 //small read() system calls... but who cares?
 //Returns 0 on success, -1 on error, setting f->send_error_str if possible
-static int sendfile_fsm(fio *f) {
+static int sendfile_fsm_step(fio *f) {
     //This code got real spaghettified, but ¯\_(ツ)_/¯
     switch (f->send_state) {
         case FIO_NOFILE: {
@@ -453,6 +499,7 @@ static int sendfile_fsm(fio *f) {
                 #warning Change this to use runtime size parameters
                 f->send_bytes += 4;
                 f->owner->need_redraw = 1;
+                twm_request_redraw();
                 
                 //If we don't have enough data in the read buffer, schedule
                 //a new read event and wait for it
@@ -464,19 +511,24 @@ static int sendfile_fsm(fio *f) {
                     //a read, trigger a latch if one is needed
                     if (f->log_latch_needed) {
                         //Don't accidentally send a double flit
-                        int rc = dbg_guv_send_cmd(f->owner, INJ_TVALID, 0);
+                        dbg_guv_txn txn;
+                        dbg_guv_txn_begin(&txn, f->owner->parent);
+                        int rc = dbg_guv_txn_write(&txn, f->owner, INJ_TVALID, 0);
                         if (rc == 0) {
-                            rc = dbg_guv_send_cmd(f->owner, LATCH, 0);
+                            rc = dbg_guv_txn_write(&txn, f->owner, LATCH, 0);
                         }
                         if (rc == 0) {
                             //But yeah turn TVALID back on since the send 
                             //logic expects it
-                            rc = dbg_guv_send_cmd(f->owner, INJ_TVALID, 1);
+                            rc = dbg_guv_txn_write(&txn, f->owner, INJ_TVALID, 1);
+                        }
+                        if (rc == 0) {
+                            rc = dbg_guv_txn_commit(&txn);
                         }
                         
                         if (rc < 0) {
                             //Is this really necessary?
-                            f->send_error_str = f->owner->parent->error_str;
+                            f->send_error_str = txn.error_str;
                             f->send_state = FIO_ERROR;
                             return -1;
                         }
@@ -503,7 +555,7 @@ static int sendfile_fsm(fio *f) {
                 } else {
                     //Send the next flit and wait for it
                     //Get the inject data out of the input buffer
-                    unsigned tdata = *(unsigned*)(f->in_buf + f->in_buf_pos);
+                    f->send_tdata = *(unsigned*)(f->in_buf + f->in_buf_pos);
                     f->in_buf_pos += 4;
                     f->in_buf_len -= 4;
                     
@@ -515,19 +567,24 @@ static int sendfile_fsm(fio *f) {
                         //logic asked for it.
                         if (f->log_latch_needed) {
                             //Don't accidentally send a double flit
-                            int rc = dbg_guv_send_cmd(f->owner, INJ_TVALID, 0);
+                            dbg_guv_txn txn;
+                            dbg_guv_txn_begin(&txn, f->owner->parent);
+                            int rc = dbg_guv_txn_write(&txn, f->owner, INJ_TVALID, 0);
                             if (rc == 0) {
-                                rc = dbg_guv_send_cmd(f->owner, LATCH, 0);
+                                rc = dbg_guv_txn_write(&txn, f->owner, LATCH, 0);
                             }
                             if (rc == 0) {
                                 //But yeah turn TVALID back on since the send 
                                 //logic expects it
-                                rc = dbg_guv_send_cmd(f->owner, INJ_TVALID, 1);
+                                rc = dbg_guv_txn_write(&txn, f->owner, INJ_TVALID, 1);
+                            }
+                            if (rc == 0) {
+                                rc = dbg_guv_txn_commit(&txn);
                             }
                             
                             if (rc < 0) {
                                 //Is this really necessary?
-                                f->send_error_str = f->owner->parent->error_str;
+                                f->send_error_str = txn.error_str;
                                 f->send_state = FIO_ERROR;
                                 return -1;
                             }
@@ -542,14 +599,19 @@ static int sendfile_fsm(fio *f) {
                     send_next_inject:;
                     
                     //Send the inject and latch commands
-                    int rc = dbg_guv_send_cmd(f->owner, INJ_TDATA, tdata);
+                    dbg_guv_txn txn;
+                    dbg_guv_txn_begin(&txn, f->owner->parent);
+                    int rc = dbg_guv_txn_write(&txn, f->owner, INJ_TDATA, f->send_tdata);
                     if (rc == 0) {
-                        rc = dbg_guv_send_cmd(f->owner, LATCH, 0);
+                        rc = dbg_guv_txn_write(&txn, f->owner, LATCH, 0);
+                    }
+                    if (rc == 0) {
+                        rc = dbg_guv_txn_commit(&txn);
                     }
                     
                     if (rc < 0) {
                         //Is this really necessary?
-                        f->send_error_str = f->owner->parent->error_str;
+                        f->send_error_str = txn.error_str;
                         f->send_state = FIO_ERROR;
                         return -1;
                     }
@@ -585,6 +647,311 @@ static int sendfile_fsm(fio *f) {
     }
 }
 
+//////////////////////////////
+//Windowed (pipelined) sends//
+//////////////////////////////
+
+//The stop-and-wait state machine above only moves one flit per round trip,
+//which is painfully slow for big stimulus files. In windowed mode we keep
+//up to send_window flits in flight and match the receipts against them as
+//they come back.
+//
+//Caveat: the hardware only has one inject register, so if flit k fails 
+//because the DUT didn't take flit k-1 yet, flit k+1 (already on the wire)
+//might still succeed and overtake flit k. There is nothing we can do about
+//that from out here. A stimulus file that arrives out of order is useless,
+//so as soon as we see an overtake the send stops with FIO_REORDERED. We
+//also collapse the window to 1 on the first failure, so a slow DUT gets a
+//chance to catch up before anything else is already on the wire behind 
+//the failed flit. If the DUT keeps up with the link, none of this happens.
+
+static void fio_window_rd_ev(fio *f, int fd) {
+    //Keep unsent bytes at the start of the buffer
+    if (f->in_buf_pos != 0) {
+        memmove(f->in_buf, f->in_buf + f->in_buf_pos, f->in_buf_len);
+        f->in_buf_pos = 0;
+    }
+    
+    int rc = read(fd, f->in_buf + f->in_buf_len, FIO_BUF_SIZE - f->in_buf_len);
+    if (rc < 0) {
+        f->send_state = FIO_ERROR;
+        f->send_error_str = strerror(errno);
+        return;
+    } else if (rc == 0) {
+        f->send_eof = 1;
+    } else {
+        f->in_buf_len += rc;
+    }
+    
+    //Errors are saved in f->send_error_str and drawn for the user
+    sendfile_pump(f);
+}
+
+static void fio_send_timer_cb(evutil_socket_t fd, short what, void *arg) {
+    TRACE(TR_FIO_SEND_TIMER, TRACE_BEGIN, 0);
+    sendfile_pump(arg);
+    TRACE(TR_FIO_SEND_TIMER, TRACE_END, 0);
+}
+
+//Returns 0 on success, -1 on error, setting f->send_error_str if possible
+static int sendfile_pump_step(fio *f) {
+    switch (f->send_state) {
+    case FIO_IDLE: {
+        //Just starting. Every LATCH we send from now on should inject
+        int rc = dbg_guv_send_cmd(f->owner, INJ_TVALID, 1);
+        if (rc < 0) {
+            f->send_error_str = f->owner->parent->error_str;
+            f->send_state = FIO_ERROR;
+            return -1;
+        }
+        break;
+    }
+    case FIO_WAIT_READ:
+    case FIO_WAIT_ACK:
+    case FIO_PAUSED:
+        break;
+    case FIO_NOFILE:
+        f->send_error_str = FIO_NONE_OPEN;
+        return -1;
+    default:
+        //Same as sendfile_fsm: don't clobber a useful error string
+        if (f->send_error_str == FIO_SUCCESS) {
+            f->send_error_str = FIO_BAD_STATE;
+        }
+        return -1;
+    }
+    
+    fpga_connection_info *parent = f->owner->parent;
+    
+    //All the flits we send here go out in as few transactions as possible
+    dbg_guv_txn txn;
+    dbg_guv_txn_begin(&txn, parent);
+    
+    //Fill up the window
+    while (!f->send_pause && f->win_len < f->send_cwnd) {
+        //Transaction is full; send what we have so far
+        if (txn.num_cmds + 2 > DBG_GUV_TXN_MAX_CMDS) {
+            if (dbg_guv_txn_commit(&txn) < 0) {
+                f->send_error_str = txn.error_str;
+                f->send_state = FIO_ERROR;
+                return -1;
+            }
+        }
+        
+        //If the network can't keep up, wait for the TX queue to drain
+        //(including whatever we've staged but not committed). We'll get
+        //a call to tx_ready_fio when there's room
+        int staged = txn.num_cmds * 8; //Upper bound
+        if (fpga_tx_room(parent) - staged < FIO_FLIT_CMD_BYTES) {
+            fpga_tx_wait(parent, f->owner);
+            break;
+        }
+        
+        fio_flit flit;
+        if (f->resend_len > 0) {
+            //Failed flits always go first. If the timer is pending, we're
+            //in the middle of backing off
+            if (evtimer_pending(f->send_timer_ev, NULL)) break;
+            flit.tdata = f->resend[f->resend_pos];
+            flit.retx = 1;
+            f->resend_pos = (f->resend_pos + 1) % FIO_MAX_WINDOW;
+            f->resend_len--;
+        } else if (f->in_buf_len >= 4) {
+            #warning Remove hardcoded widths
+            memcpy(&flit.tdata, f->in_buf + f->in_buf_pos, 4);
+            flit.retx = 0;
+            f->in_buf_pos += 4;
+            f->in_buf_len -= 4;
+        } else {
+            break; //Nothing to send right now
+        }
+        
+        //Unlike stop-and-wait, we always have to resend INJ_TDATA since
+        //the scratch register has probably been overwritten by now
+        int rc = dbg_guv_txn_write(&txn, f->owner, INJ_TDATA, flit.tdata);
+        if (rc == 0) {
+            rc = dbg_guv_txn_write(&txn, f->owner, LATCH, 0);
+        }
+        if (rc < 0) {
+            f->send_error_str = txn.error_str;
+            f->send_state = FIO_ERROR;
+            return -1;
+        }
+        
+        f->win[(f->win_pos + f->win_len) % FIO_MAX_WINDOW] = flit;
+        f->win_len++;
+    }
+    
+    if (dbg_guv_txn_commit(&txn) < 0) {
+        f->send_error_str = txn.error_str;
+        f->send_state = FIO_ERROR;
+        return -1;
+    }
+    
+    //Keep the input buffer topped up while flits are in flight, but don't
+    //bother reading 4 bytes at a time
+    if (!f->send_eof && f->in_buf_len < FIO_BUF_SIZE/2) {
+        if (!event_pending(f->file_rd_ev, EV_READ, NULL)) {
+            #warning Error code is not checked
+            event_add(f->file_rd_ev, NULL);
+        }
+    }
+    
+    if (f->send_pause) {
+        //Anything still in flight will keep getting matched up by
+        //window_receipt; we just won't send anything new
+        f->send_state = FIO_PAUSED;
+    } else if (f->win_len == 0 && f->resend_len == 0 && f->in_buf_len < 4) {
+        if (!f->send_eof) {
+            f->send_state = FIO_WAIT_READ;
+        } else if (f->in_buf_len != 0) {
+            f->send_error_str = FIO_STRAGGLERS;
+            f->send_state = FIO_ERROR;
+            return -1;
+        } else {
+            //Everything made it. Now (and not before, since it would clobber
+            //a pending inject) turn off TVALID to prevent accidental sends
+            int rc = dbg_guv_txn_write(&txn, f->owner, INJ_TVALID, 0);
+            if (rc == 0) {
+                rc = dbg_guv_txn_write(&txn, f->owner, LATCH, 0);
+            }
+            if (rc == 0) {
+                rc = dbg_guv_txn_commit(&txn);
+            }
+            if (rc < 0) {
+                f->send_error_str = txn.error_str;
+                f->send_state = FIO_ERROR;
+                return -1;
+            }
+            f->send_stray_receipts++;
+            f->send_state = FIO_DONE;
+        }
+    } else {
+        f->send_state = FIO_WAIT_ACK;
+    }
+    
+    f->owner->need_redraw = 1;
+    twm_request_redraw();
+    f->send_error_str = FIO_SUCCESS;
+    return 0;
+}
+
+//The send state is shown as a counter in traces, so the wait between
+//injecting and getting the receipt back stands out. Every state change
+//goes through one of these two functions (or the file read event)
+static void trace_send_state(fio *f, fio_file_state_t before) {
+    if (f->send_state != before) TRACE(TR_SENDFILE_STATE, TRACE_COUNTER, f->send_state);
+}
+
+static int sendfile_fsm(fio *f) {
+    fio_file_state_t before = f->send_state;
+    int rc = sendfile_fsm_step(f);
+    trace_send_state(f, before);
+    return rc;
+}
+
+//Receipts in windowed mode are matched to flits purely by order, so nobody
+//else can be allowed to cause one while flits are in flight. Once the send
+//has errored out, there's nothing left to protect
+static void fio_update_busy(fio *f) {
+    int live = f->send_state != FIO_ERROR && f->send_state != FIO_DONE && f->send_state != FIO_NOFILE;
+    int busy = f->send_window > 1 && live &&
+        (f->win_len > 0 || f->resend_len > 0 || f->send_stray_receipts > 0);
+    f->owner->busy_str = busy ? FIO_WINDOW_BUSY : NULL;
+}
+
+static int sendfile_pump(fio *f) {
+    fio_file_state_t before = f->send_state;
+    int rc = sendfile_pump_step(f);
+    trace_send_state(f, before);
+    fio_update_busy(f);
+    return rc;
+}
+
+static void fio_file_rd_ev(evutil_socket_t fd, short what, void *arg) {
+    fio *f = arg;
+    fio_file_state_t before = f->send_state;
+    TRACE(TR_FIO_FILE_RD, TRACE_BEGIN, fd);
+    fio_file_rd(fd, what, arg);
+    TRACE(TR_FIO_FILE_RD, TRACE_END, fd);
+    trace_send_state(f, before);
+}
+
+static void fio_file_wr_ev(evutil_socket_t fd, short what, void *arg) {
+    TRACE(TR_FIO_FILE_WR, TRACE_BEGIN, fd);
+    fio_file_wr(fd, what, arg);
+    TRACE(TR_FIO_FILE_WR, TRACE_END, fd);
+}
+
+//Matches a command receipt to the oldest in-flight flit
+static int window_receipt(fio *f) {
+    if (f->send_stray_receipts > 0) {
+        f->send_stray_receipts--;
+        return 0;
+    }
+    
+    //Not one of ours. This can happen if the state machine errored out
+    if (f->win_len == 0) return 0;
+    
+    fio_flit flit = f->win[f->win_pos];
+    f->win_pos = (f->win_pos + 1) % FIO_MAX_WINDOW;
+    f->win_len--;
+    
+    if (f->owner->inj_failed) {
+        if (flit.retx) {
+            //Same retry limits as stop-and-wait
+            if (++f->send_retries > 2) {
+                f->send_error_str = FIO_INJ_TIMEOUT;
+                f->send_state = FIO_ERROR;
+                return -1;
+            }
+            //This was the oldest failed flit, so it goes back to the front
+            f->resend_pos = (f->resend_pos + FIO_MAX_WINDOW - 1) % FIO_MAX_WINDOW;
+            f->resend[f->resend_pos] = flit.tdata;
+        } else {
+            f->resend[(f->resend_pos + f->resend_len) % FIO_MAX_WINDOW] = flit.tdata;
+        }
+        f->resend_len++;
+        
+        f->send_cwnd = 1;
+        
+        //Wait 5 ms on first retry, 50 ms on second, 2 sec on third
+        if (!evtimer_pending(f->send_timer_ev, NULL)) {
+            struct timeval dly = {
+                .tv_sec = (f->send_retries == 2) ? 2 : 0,
+                .tv_usec = (f->send_retries == 1) ? 50000 : 5000
+            };
+            #warning Return value not checked
+            evtimer_add(f->send_timer_ev, &dly);
+        }
+    } else {
+        //See the big comment above
+        if (!flit.retx && f->resend_len > 0) {
+            char line[MAX_FIO_NAME_SZ + 128];
+            snprintf(line, sizeof(line), "Stopped sending %s to %s: %s", f->send_file, f->owner->name, FIO_REORDERED);
+            msg_win_dynamic_append(err_log, line);
+            f->send_error_str = FIO_REORDERED;
+            f->send_state = FIO_ERROR;
+            return -1;
+        }
+        
+        f->send_retries = 0;
+        f->send_bytes += 4;
+        if (f->send_cwnd < f->send_window) f->send_cwnd++;
+    }
+    
+    return sendfile_pump(f);
+}
+
+//Tells the right state machine to get going
+static int sendfile_kick(fio *f) {
+    if (f->send_window > 1) {
+        return sendfile_pump(f);
+    } else {
+        return sendfile_fsm(f);
+    }
+}
+
 static int init_fio(dbg_guv *owner) {
 	//Takes care of buffer positions/lengths
     fio *mgr = calloc(1, sizeof(fio));
@@ -599,6 +966,7 @@ static int init_fio(dbg_guv *owner) {
     
     mgr->send_state = FIO_NOFILE;
     mgr->log_state = FIO_NOFILE;
+    mgr->send_window = 1; //Plain old stop-and-wait until the user says so
     
     owner->mgr = mgr;
     return 0;
@@ -612,6 +980,7 @@ typedef enum _fio_cmd {
 	FIO_SEND,
 	FIO_PAUSE,
 	FIO_CONT,
+	FIO_WINDOW,
 	FIO_NUM_CMDS,
 } fio_cmd;
 
@@ -623,6 +992,7 @@ static struct {char const * const str; fio_cmd cmd;} const fio_cmd_map[] = {
 	{"send", FIO_SEND},
 	{"pause", FIO_PAUSE},
 	{"cont", FIO_CONT},
+	{"window", FIO_WINDOW},
 };
 
 //File I/O command parser
@@ -677,6 +1047,7 @@ static int got_line_fio(dbg_guv *owner, char const *str) {
         //Close currently open file if necessary
         if (f->send_state != FIO_NOFILE) {
             event_free(f->file_rd_ev);
+            event_free(f->send_timer_ev);
             close(f->send_fd);
             f->send_fd = -1;
         }
@@ -692,13 +1063,22 @@ static int got_line_fio(dbg_guv *owner, char const *str) {
         #warning Return values not checked
         struct event_base *eb = event_get_base(owner->parent->rd_ev);
         f->file_rd_ev = event_new(eb, f->send_fd, EV_READ, fio_file_rd_ev, f);
+        f->send_timer_ev = evtimer_new(eb, fio_send_timer_cb, f);
         
         //Save the filename for the user's sake (no one has perfect memory!)
         filename_from_path(str, f->send_file);
         
         f->send_state = FIO_IDLE;
         f->send_bytes = 0; //Reset sent bytes counter
+        f->in_buf_pos = 0;
+        f->in_buf_len = 0;
+        f->win_len = 0;
+        f->resend_len = 0;
+        f->send_eof = 0;
+        f->send_cwnd = f->send_window;
+        fio_update_busy(f);
         f->owner->need_redraw = 1;
+        twm_request_redraw();
         return 0;
 	} 
 	case FIO_RXFILE: {
@@ -727,6 +1107,7 @@ static int got_line_fio(dbg_guv *owner, char const *str) {
         f->log_state = FIO_IDLE;
         f->log_numsaved = 0; //Reset number of saved logs
         f->owner->need_redraw = 1;
+        twm_request_redraw();
         return 0;
 	}
 	case FIO_LOGON: {
@@ -740,6 +1121,7 @@ static int got_line_fio(dbg_guv *owner, char const *str) {
         
         f->log_state = FIO_LOGGING;
         f->owner->need_redraw = 1;
+        twm_request_redraw();
         return 0;
 	}
 	case FIO_LOGOFF: {
@@ -747,6 +1129,7 @@ static int got_line_fio(dbg_guv *owner, char const *str) {
         if (f->log_state == FIO_LOGGING) {
             f->log_state = FIO_IDLE;
             f->owner->need_redraw = 1;
+            twm_request_redraw();
         }
         
         return 0;
@@ -758,22 +1141,64 @@ static int got_line_fio(dbg_guv *owner, char const *str) {
         }
         
         //Give the okay to start sending
-        sendfile_fsm(f);
+        sendfile_kick(f);
         
         f->owner->need_redraw = 1;
+        twm_request_redraw();
         return 0;
 	}
 	case FIO_PAUSE: {
 		f->send_pause = 1;
         f->owner->need_redraw = 1;
+        twm_request_redraw();
         return 0;
 	}
 	case FIO_CONT: {
         if (f->send_pause) {
             f->send_pause = 0;
             f->owner->need_redraw = 1;
+            twm_request_redraw();
         }
-        return sendfile_fsm(f);
+        return sendfile_kick(f);
+	}
+	case FIO_WINDOW: {
+        //window N: keep up to N inject flits in flight. Anything above 1 is
+        //only safe if the DUT takes every flit as fast as the link can
+        //deliver them; otherwise a failed flit can be overtaken and the send
+        //stops with FIO_REORDERED (see the comments above window_receipt)
+        
+        //Can't switch state machines in the middle of a transfer
+        switch (f->send_state) {
+        case FIO_WAIT_READ:
+        case FIO_WAIT_ACK:
+        case FIO_PAUSED:
+            owner->error_str = FIO_ALREADY_SENDING;
+            return -1;
+        default:
+            break;
+        }
+        
+        rc = parse_param(&dummy, str);
+        if (rc < 0) {
+            owner->error_str = dummy.error_str;
+            return -1;
+        }
+        if (dummy.param < 1 || dummy.param > FIO_MAX_WINDOW) {
+            owner->error_str = FIO_BAD_WINDOW;
+            return -1;
+        }
+        
+        f->send_window = dummy.param;
+        f->send_cwnd = dummy.param;
+        f->owner->need_redraw = 1;
+        twm_request_redraw();
+        
+        if (f->send_window > 1) {
+            char line[128];
+            snprintf(line, sizeof(line), "%s: window %d is only safe if the DUT keeps up with the link (a reordered send stops with an error)", owner->name, f->send_window);
+            msg_win_dynamic_append(err_log, line);
+        }
+        return 0;
 	}
 	default: {
 		owner->error_str = FIO_IMPOSSIBLE;
@@ -782,6 +1207,18 @@ static int got_line_fio(dbg_guv *owner, char const *str) {
 	}
 }
 
+//Called when the FPGA's TX queue has room again after sendfile_pump backed
+//off. The stop-and-wait state machine never sends enough to need this
+static int tx_ready_fio(dbg_guv *owner) {
+    fio *f = owner->mgr;
+    
+    if (f->send_window > 1) {
+        return sendfile_pump(f);
+    } else {
+        return 0;
+    }
+}
+
 static int lines_req_fio(dbg_guv *owner, int w, int h) {
     return 2; //We always use two lines
 }
@@ -796,23 +1233,30 @@ static int cmd_receipt_fio(dbg_guv *owner, uint32_t receipt) {
         return 0;
     }
     
-    if (f->send_state == FIO_WAIT_ACK)
+    if (f->send_window > 1) {
+        int rc = window_receipt(f);
+        fio_update_busy(f); //In case it errored out before pumping
+        return rc;
+    } else if (f->send_state == FIO_WAIT_ACK)
         return sendfile_fsm(f);
     else
         return 0;
 }
 
 #warning BROKEN BROKEN BROKEN
-static int log_fio(dbg_guv *owner, uint32_t const *log) {
+static int log_fio(dbg_guv *owner, dbg_log_rec const *log) {
     fio *f = owner->mgr;
     
     //Don't do anything if we're not logging
     if (f->log_state != FIO_LOGGING) {
         return 0;
     }
+    
+    //We save the raw TDATA bytes
+    char const *data = (char const *) log->TDATA;
+    int len = log->len;
 	
-    #warning Get rid of hardcoded widths
-	if(FIO_BUF_SIZE - f->out_buf_len < 8) {
+	if(FIO_BUF_SIZE - f->out_buf_len < len) {
         f->log_state = FIO_ERROR;
 		f->log_error_str = FIO_OVERFLOW;
 		return -1;
@@ -823,20 +1267,20 @@ static int log_fio(dbg_guv *owner, uint32_t const *log) {
     //this was easier
     
 	int wr_pos = (f->out_buf_pos + f->out_buf_len) % FIO_BUF_SIZE;
-	if (wr_pos + 8 > FIO_BUF_SIZE) {
+	if (wr_pos + len > FIO_BUF_SIZE) {
 		//Case 2: need to split into first and second halves
-		int first_half_len = FCI_BUF_SIZE - wr_pos - 1; //OBOE?
-		memcpy(f->out_buf + wr_pos, log, first_half_len);
+		int first_half_len = FIO_BUF_SIZE - wr_pos;
+		memcpy(f->out_buf + wr_pos, data, first_half_len);
 		
-		int second_half_len = 8 - first_half_len;
-		memcpy(f->out_buf + 0, log + first_half_len, second_half_len);
+		int second_half_len = len - first_half_len;
+		memcpy(f->out_buf + 0, data + first_half_len, second_half_len);
 		
 	} else {
 		//Case 1 or case 3: we can just directly copy in
-		memcpy(f->out_buf + wr_pos, log, 8);
+		memcpy(f->out_buf + wr_pos, data, len);
 	}
 	
-	f->out_buf_len += 8;
+	f->out_buf_len += len;
     f->log_numsaved++;
     
     //Check if we went past our high watermark
@@ -878,7 +1322,17 @@ static int draw_fn_fio(void *item, int x, int y, int w, int h, char *buf) {
 		break;
 	case FIO_WAIT_READ:
     case FIO_WAIT_ACK:
-		sprintf(status + pos, "TX (%d B sent): %s%n", f->send_bytes, f->send_file, &incr);
+        if (f->send_window > 1) {
+            sprintf(status + pos, "TX (%d B sent, %d/%d in flight): %s%n", 
+                f->send_bytes, 
+                f->win_len, 
+                f->send_cwnd,
+                f->send_file, 
+                &incr
+            );
+        } else {
+            sprintf(status + pos, "TX (%d B sent): %s%n", f->send_bytes, f->send_file, &incr);
+        }
 		pos += incr;
 		break;
 	case FIO_PAUSED:
@@ -970,6 +1424,7 @@ static void cleanup_fio(dbg_guv *owner) {
     if (f) {
         if (f->send_state != FIO_NOFILE) {
             event_free(f->file_rd_ev);
+            event_free(f->send_timer_ev);
             close(f->send_fd);
             f->send_state = FIO_NOFILE; //No real need to set the state...
         }
@@ -981,6 +1436,7 @@ static void cleanup_fio(dbg_guv *owner) {
         free(f);
     }
     owner->mgr = NULL;
+    owner->busy_str = NULL;
 }
 
 guv_operations const fio_guv_ops = {
@@ -989,6 +1445,7 @@ guv_operations const fio_guv_ops = {
     .lines_req = lines_req_fio,
     .cmd_receipt = cmd_receipt_fio,
     .log = log_fio,
+    .tx_ready = tx_ready_fio,
     .draw_ops = {
         .draw_fn = draw_fn_fio,
         .draw_sz = draw_sz_fio,
@@ -997,6 +1454,452 @@ guv_operations const fio_guv_ops = {
     .cleanup_mgr = cleanup_fio
 };
 
+//////////////////////////////////////////////////
+//Trigger manager                               //
+//////////////////////////////////////////////////
+
+//Works like the trigger on a logic analyzer. While armed, every log is
+//copied (in binary form) into a ring that holds pre + 1 + post records.
+//When the trigger condition is hit for the count'th time we keep going for
+//post more logs and then stop copying, which leaves exactly the window 
+//around the trigger sitting in the ring. Nothing is formatted until it's
+//drawn or saved.
+//
+//The condition is a filter expression (see filter.h), optionally combined
+//with a TLAST edge.
+
+#define TRIG_MAX_DEPTH 65536 //Most logs we'll keep before or after the trigger
+#define TRIG_DEFAULT_PRE 16
+#define TRIG_DEFAULT_POST 16
+
+typedef enum _trig_state_t {
+    TRIG_IDLE,
+    TRIG_ARMED,  //Waiting for the condition
+    TRIG_FIRED,  //Collecting post-trigger logs
+    TRIG_DONE    //Window is frozen
+} trig_state_t;
+
+typedef enum _trig_edge_t {
+    TRIG_EDGE_ANY,   //Condition alone is enough
+    TRIG_EDGE_FIRST, //Also has to be the first flit of a packet (i.e. the
+                     //flit before it had TLAST set)
+    TRIG_EDGE_LAST   //Also has to have TLAST set
+} trig_edge_t;
+
+typedef struct _trig {
+    dbg_guv *owner;
+    
+    trig_state_t state;
+    
+    //Settings. Changing pre or post reallocates the ring, so they can only
+    //be changed while idle
+    int pre, post;
+    int count; //Fire on this occurrence of the condition
+    trig_edge_t edge;
+    int has_cond; //If 0, every log satisfies the condition
+    filter cond;
+    
+    //Window. Records are numbered (by seq) from when we were armed
+    dbg_log ring;
+    int prev_tlast;
+    int hits;
+    int post_left;
+    int post_lines; //Text lines taken up by the post-trigger logs, so the 
+                    //trigger can be kept on screen
+    uint32_t fired_seq;
+    
+    char const *error_str;
+} trig;
+
+static int init_trig(dbg_guv *owner) {
+    trig *t = calloc(1, sizeof(trig));
+    if (!t) {
+        owner->error_str = TRIG_OOM;
+        return -1;
+    }
+    
+    t->owner = owner;
+    t->state = TRIG_IDLE;
+    t->pre = TRIG_DEFAULT_PRE;
+    t->post = TRIG_DEFAULT_POST;
+    t->count = 1;
+    t->edge = TRIG_EDGE_ANY;
+    
+    //No memory is allocated until the first log is copied in. Other guvs
+    //aren't allowed to steal from the window
+    init_dbg_log(&t->ring, t->pre + 1 + t->post);
+    t->ring.pinned = 1;
+    
+    owner->mgr = t;
+    return 0;
+}
+
+//Throws away whatever is in the ring and sizes it for the current pre and
+//post settings
+static int trig_reset_ring(trig *t) {
+    deinit_dbg_log(&t->ring);
+    int rc = init_dbg_log(&t->ring, t->pre + 1 + t->post);
+    if (rc < 0) {
+        t->owner->error_str = t->ring.error_str;
+        return -1;
+    }
+    t->ring.pinned = 1;
+    return 0;
+}
+
+typedef enum _trig_cmd {
+    TRIG_ARM,
+    TRIG_DISARM,
+    TRIG_PRE,
+    TRIG_POST,
+    TRIG_COUNT,
+    TRIG_EDGE,
+    TRIG_SAVE,
+    TRIG_NUM_CMDS
+} trig_cmd;
+
+static struct {char const * const str; trig_cmd cmd;} const trig_cmd_map[] = {
+    {"arm", TRIG_ARM},
+    {"disarm", TRIG_DISARM},
+    {"pre", TRIG_PRE},
+    {"post", TRIG_POST},
+    {"count", TRIG_COUNT},
+    {"edge", TRIG_EDGE},
+    {"save", TRIG_SAVE},
+};
+
+//Writes the frozen window to a text file, oldest log first
+static int trig_save(trig *t, char const *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        t->owner->error_str = strerror(errno);
+        return -1;
+    }
+    
+    int i;
+    for (i = t->ring.nrecs - 1; i >= 0; i--) {
+        dbg_log_rec const *rec = dbg_log_get(&t->ring, i);
+        dbg_log_rec const *prev = dbg_log_get(&t->ring, i + 1);
+        
+        if (rec->seq == t->fired_seq) fprintf(fp, "---- trigger ----\n");
+        
+        int nlines = dbg_log_rec_nlines(rec);
+        int j;
+        for (j = 0; j < nlines; j++) {
+            char line[80];
+            dbg_log_fmt_line(&t->ring, rec, prev, j, line, sizeof(line));
+            fprintf(fp, "%s\n", line);
+        }
+    }
+    
+    if (fclose(fp) != 0) {
+        t->owner->error_str = strerror(errno);
+        return -1;
+    }
+    return 0;
+}
+
+//Trigger command parser
+static int got_line_trig(dbg_guv *owner, char const *str) {
+    //Sanity check inputs
+    if (owner == NULL) {
+        return -2; //This is all we can do
+    }
+    
+    if (str == NULL) {
+        owner->error_str = TRIG_NULL_ARG;
+        return -1;
+    }
+    
+    //Get the command
+    char cmd[16];
+    int rc = parse_strn(cmd, sizeof(cmd), str);
+    if (rc < 0) {
+        owner->error_str = TRIG_BAD_CMD;
+        return -1;
+    }
+    str += rc;
+    
+    int i;
+    trig_cmd cmd_id = TRIG_NUM_CMDS;
+    for (i = 0; i < sizeof(trig_cmd_map)/sizeof(*trig_cmd_map); i++) {
+        if (!strcmp(trig_cmd_map[i].str, cmd)) {
+            cmd_id = trig_cmd_map[i].cmd;
+            break;
+        }
+    }
+    
+    if (cmd_id == TRIG_NUM_CMDS) {
+        owner->error_str = TRIG_BAD_CMD;
+        return -1;
+    }
+    
+    dbg_cmd dummy;
+    int incr = skip_whitespace(&dummy, str);
+    str += incr;
+    
+    trig *t = owner->mgr;
+    
+    switch (cmd_id) {
+    case TRIG_ARM: {
+        //Rest of the line is the condition. Compile it into a temporary 
+        //so a typo doesn't clobber the old one
+        if (*str != '\0') {
+            filter tmp;
+            rc = compile_filter(&tmp, str);
+            if (rc < 0) {
+                char line[120];
+                sprintf(line, "Trigger condition error at position %d", tmp.error_pos);
+                msg_win_dynamic_append(err_log, line);
+                owner->error_str = tmp.error_str;
+                return -1;
+            }
+            t->cond = tmp;
+            t->has_cond = 1;
+        } else {
+            t->has_cond = 0;
+        }
+        
+        if (trig_reset_ring(t) < 0) return -1;
+        t->prev_tlast = 1; //Assume we're starting on a packet boundary
+        t->hits = 0;
+        t->post_lines = 0;
+        t->state = TRIG_ARMED;
+        break;
+    }
+    case TRIG_DISARM:
+        //Keep whatever we've got, in case the user wants to look at it
+        if (t->state == TRIG_ARMED || t->state == TRIG_FIRED) {
+            t->state = TRIG_IDLE;
+        }
+        break;
+    case TRIG_PRE:
+    case TRIG_POST:
+    case TRIG_COUNT: {
+        if (t->state == TRIG_ARMED || t->state == TRIG_FIRED) {
+            owner->error_str = TRIG_ALREADY_ARMED;
+            return -1;
+        }
+        
+        rc = parse_param(&dummy, str);
+        if (rc < 0) {
+            owner->error_str = dummy.error_str;
+            return -1;
+        }
+        
+        if (cmd_id == TRIG_COUNT) {
+            if (dummy.param < 1) {
+                owner->error_str = TRIG_BAD_COUNT;
+                return -1;
+            }
+            t->count = dummy.param;
+            break;
+        }
+        
+        if (dummy.param > TRIG_MAX_DEPTH) {
+            owner->error_str = TRIG_BAD_DEPTH;
+            return -1;
+        }
+        if (cmd_id == TRIG_PRE) t->pre = dummy.param;
+        else t->post = dummy.param;
+        
+        //The old window no longer fits, so get rid of it
+        if (trig_reset_ring(t) < 0) return -1;
+        t->state = TRIG_IDLE;
+        break;
+    }
+    case TRIG_EDGE: {
+        if (!strcmp(str, "any")) {
+            t->edge = TRIG_EDGE_ANY;
+        } else if (!strcmp(str, "first")) {
+            t->edge = TRIG_EDGE_FIRST;
+        } else if (!strcmp(str, "last")) {
+            t->edge = TRIG_EDGE_LAST;
+        } else {
+            owner->error_str = TRIG_BAD_EDGE;
+            return -1;
+        }
+        break;
+    }
+    case TRIG_SAVE: {
+        if (t->ring.nrecs == 0) {
+            owner->error_str = TRIG_EMPTY;
+            return -1;
+        }
+        //Deliberately use rest of string, so filenames can have spaces
+        if (trig_save(t, str) < 0) return -1;
+        break;
+    }
+    default:
+        owner->error_str = TRIG_IMPOSSIBLE;
+        return -1;
+    }
+    
+    owner->need_redraw = 1;
+    twm_request_redraw();
+    return 0;
+}
+
+//This is the hot path. Nothing in here formats anything
+static int log_trig(dbg_guv *owner, dbg_log_rec const *log) {
+    trig *t = owner->mgr;
+    
+    if (t->state != TRIG_ARMED && t->state != TRIG_FIRED) return 0;
+    
+    dbg_log_rec *slot = dbg_log_reserve(&t->ring);
+    if (slot == NULL) {
+        t->state = TRIG_IDLE;
+        owner->error_str = TRIG_OOM;
+        return -1;
+    }
+    *slot = *log;
+    dbg_log_commit(&t->ring); //Renumbers it, starting from when we armed
+    
+    int prev_tlast = t->prev_tlast;
+    t->prev_tlast = log->TLAST;
+    
+    if (t->state == TRIG_FIRED) {
+        t->post_lines += dbg_log_rec_nlines(log);
+        if (--t->post_left == 0) {
+            t->state = TRIG_DONE;
+            owner->need_redraw = 1;
+            twm_request_redraw();
+        }
+        return 0;
+    }
+    
+    //Check the cheap stuff first
+    if (t->edge == TRIG_EDGE_FIRST && !prev_tlast) return 0;
+    if (t->edge == TRIG_EDGE_LAST && !log->TLAST) return 0;
+    if (t->has_cond && !filter_match(&t->cond, log)) return 0;
+    
+    if (++t->hits < t->count) return 0;
+    
+    //Fire!
+    t->fired_seq = t->ring.next_seq - 1;
+    t->post_left = t->post;
+    t->post_lines = 0;
+    t->state = (t->post > 0) ? TRIG_FIRED : TRIG_DONE;
+    owner->need_redraw = 1;
+    twm_request_redraw();
+    return 0;
+}
+
+static int lines_req_trig(dbg_guv *owner, int w, int h) {
+    trig *t = owner->mgr;
+    
+    //Once there's a window to look at, it gets the whole guv
+    if (t->state == TRIG_DONE || (t->state == TRIG_IDLE && t->ring.nrecs > 0)) {
+        return h;
+    } else {
+        return 1;
+    }
+}
+
+//Draws item. Returns number of bytes added into buf, or -1 on error.
+static int draw_fn_trig(void *item, int x, int y, int w, int h, char *buf) {
+    if (h == 0) return 0; //No space, don't draw anything
+    //Sanity check inputs
+    else if (h < 0 || w < 0) return -1;
+    
+    dbg_guv *g = item;
+    trig *t = g->mgr;
+    
+    char *buf_saved = buf;
+    
+    char const *cond = t->has_cond ? t->cond.src : "any log";
+    static char const *const edge_names[] = {"", ", first flit", ", last flit"};
+    
+    char status[256];
+    switch (t->state) {
+    case TRIG_IDLE:
+        if (t->ring.nrecs > 0) {
+            snprintf(status, sizeof(status), "Trigger (Disarmed, %d logs kept)", t->ring.nrecs);
+        } else {
+            snprintf(status, sizeof(status), "Trigger (Idle, pre %d, post %d, count %d%s)", 
+                t->pre, t->post, t->count, edge_names[t->edge]
+            );
+        }
+        break;
+    case TRIG_ARMED:
+        snprintf(status, sizeof(status), "Trigger (Armed, %d/%d hits, %u seen%s): %s", 
+            t->hits, t->count, t->ring.next_seq, edge_names[t->edge], cond
+        );
+        break;
+    case TRIG_FIRED:
+        snprintf(status, sizeof(status), "Trigger (Fired at #%u, %d/%d post): %s", 
+            t->fired_seq, t->post - t->post_left, t->post, cond
+        );
+        break;
+    case TRIG_DONE:
+        snprintf(status, sizeof(status), "Trigger (Done, fired at #%u): %s", t->fired_seq, cond);
+        break;
+    default:
+        snprintf(status, sizeof(status), "Trigger is in invalid state!");
+        break;
+    }
+    
+    int incr = cursor_pos_cmd(buf, x, y);
+    buf += incr;
+    sprintf(buf, UNDERLINE "%-*.*s" NO_UNDERLINE "%n", w, w, status, &incr);
+    buf += incr;
+    h--;
+    y++;
+    
+    //Show the window, scrolled so that the trigger is about halfway down
+    if (h > 0 && t->state != TRIG_ARMED && t->state != TRIG_FIRED) {
+        int offset = t->post_lines - h/2;
+        if (offset < 0) offset = 0;
+        incr = draw_dbg_log(&t->ring, offset, x, y, w, h, buf);
+        if (incr < 0) {
+            g->error_str = t->ring.error_str;
+            return -1;
+        }
+        buf += incr;
+    }
+    
+    return buf - buf_saved;
+}
+
+//Returns how many bytes are needed (can be an upper bound) to draw item
+//given the size
+static int draw_sz_trig(void *item, int w, int h) {
+    if (h > 0) {
+        return h*(10 + w) + 9; //Move the cursor and write w characters on
+                               //every line, plus the underline on the first
+    } else {
+        return 0;
+    }
+}
+
+static void trigger_redraw_trig(void *item) {
+    return;
+}
+
+static void cleanup_trig(dbg_guv *owner) {
+    trig *t = owner->mgr;
+    if (t) {
+        deinit_dbg_log(&t->ring);
+        free(t);
+    }
+    owner->mgr = NULL;
+}
+
+guv_operations const trig_guv_ops = {
+    .init_mgr = init_trig,
+    .got_line = got_line_trig,
+    .lines_req = lines_req_trig,
+    .cmd_receipt = NULL,
+    .log = log_trig,
+    .tx_ready = NULL,
+    .draw_ops = {
+        .draw_fn = draw_fn_trig,
+        .draw_sz = draw_sz_trig,
+        .trigger_redraw = trigger_redraw_trig
+    },
+    .cleanup_mgr = cleanup_trig
+};
+
 char const * const FIO_SUCCESS = "success";
 char const * const FIO_NONE_OPEN = "no open file";
 char const * const FIO_OVERFLOW = "buffer overflowed";
@@ -1012,3 +1915,17 @@ char const * const FIO_BAD_STATE = "unexpected signal";
 char const * const FIO_BAD_DEVELOPER = "not implemented";
 char const * const FIO_ALREADY_SENDING = "already sending";
 char const * const FIO_CARPET_PULLED = "logfile unexpectedly closed";
+char const * const FIO_BAD_WINDOW = "window must be between 1 and 64";
+char const * const FIO_WINDOW_BUSY = "injected flits are in flight";
+char const * const FIO_REORDERED = "a failed flit was overtaken, so the DUT got the file out of order (try a smaller window)";
+
+char const * const TRIG_SUCCESS = "success";
+char const * const TRIG_OOM = "out of memory";
+char const * const TRIG_NULL_ARG = "NULL argument";
+char const * const TRIG_BAD_CMD = "no such command (try arm, disarm, pre, post, count, edge or save)";
+char const * const TRIG_ALREADY_ARMED = "can't change this while armed";
+char const * const TRIG_BAD_COUNT = "count must be at least 1";
+char const * const TRIG_BAD_DEPTH = "pre and post can be at most 65536";
+char const * const TRIG_BAD_EDGE = "edge must be any, first or last";
+char const * const TRIG_EMPTY = "nothing captured yet";
+char const * const TRIG_IMPOSSIBLE = "code reached a location that Marco thought was impossible";
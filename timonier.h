@@ -28,6 +28,23 @@ extern char const * const FIO_BAD_STATE;// = "unexpected signal";
 extern char const * const FIO_BAD_DEVELOPER;// = "not implemented";
 extern char const * const FIO_ALREADY_SENDING;// = "already sending";
 extern char const * const FIO_CARPET_PULLED;// = "logfile unexpectedly closed";
+extern char const * const FIO_BAD_WINDOW;// = "window must be between 1 and 64";
+extern char const * const FIO_WINDOW_BUSY;// = "injected flits are in flight";
+extern char const * const FIO_REORDERED;// = "a failed flit was overtaken, so the DUT got the file out of order (try a smaller window)";
 extern char const * const FIO_OVERFLOW;// = "logfile buffer overflowed";
 
+//Trigger manager: logic analyzer style capture of the logs around an event
+extern guv_operations const trig_guv_ops;
+
+extern char const * const TRIG_SUCCESS;// = "success";
+extern char const * const TRIG_OOM;// = "out of memory";
+extern char const * const TRIG_NULL_ARG;// = "NULL argument";
+extern char const * const TRIG_BAD_CMD;// = "no such command (try arm, disarm, pre, post, count, edge or save)";
+extern char const * const TRIG_ALREADY_ARMED;// = "can't change this while armed";
+extern char const * const TRIG_BAD_COUNT;// = "count must be at least 1";
+extern char const * const TRIG_BAD_DEPTH;// = "pre and post can be at most 65536";
+extern char const * const TRIG_BAD_EDGE;// = "edge must be any, first or last";
+extern char const * const TRIG_EMPTY;// = "nothing captured yet";
+extern char const * const TRIG_IMPOSSIBLE;// = "code reached a location that Marco thought was impossible";
+
 #endif
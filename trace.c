@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "trace.h"
+
+char const *const TRACE_OOM = "out of memory";
+
+atomic_int trace_enabled = 0;
+
+typedef struct _trace_ring {
+    trace_rec recs[TRACE_RING_SIZE];
+    atomic_ulong head;  //Number of events ever written. Only the owner
+                        //thread changes this
+    atomic_int alive;   //Cleared when the owner thread exits
+    int tid;
+    char name[32];
+    struct _trace_ring *next;
+} trace_ring;
+
+#define X(id, name) name
+static char const *const event_names[] = {
+    TRACE_EVENT_IDENTS
+};
+#undef X
+
+//All the rings ever made. Only touched when a thread gets its ring and
+//when dumping, so a plain mutex is fine
+static trace_ring *rings = NULL;
+static int nrings = 0;
+static int next_tid = 1;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local trace_ring *my_ring = NULL;
+static _Thread_local char my_name[32] = "";
+
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+//Called by pthreads when a thread that has a ring exits
+static void release_ring(void *arg) {
+    trace_ring *r = arg;
+    atomic_store(&r->alive, 0);
+}
+
+static void make_ring_key() {
+    pthread_key_create(&ring_key, release_ring);
+}
+
+//Finds this thread a ring. Returns NULL if out of memory
+static trace_ring *claim_ring() {
+    pthread_once(&ring_key_once, make_ring_key);
+
+    pthread_mutex_lock(&rings_mutex);
+
+    trace_ring *r = NULL;
+    if (nrings < TRACE_MAX_THREADS) {
+        r = malloc(sizeof(trace_ring));
+        if (r != NULL) {
+            r->next = rings;
+            rings = r;
+            nrings++;
+        }
+    } else {
+        //Take over a dead thread's ring. Its events are lost
+        for (r = rings; r != NULL; r = r->next) {
+            if (!atomic_load(&r->alive)) break;
+        }
+    }
+
+    if (r != NULL) {
+        atomic_store(&r->head, 0);
+        atomic_store(&r->alive, 1);
+        r->tid = next_tid++;
+        snprintf(r->name, sizeof(r->name), "%s", my_name[0] ? my_name : "thread");
+        pthread_setspecific(ring_key, r);
+    }
+
+    pthread_mutex_unlock(&rings_mutex);
+    return r;
+}
+
+//Records one event in this thread's ring. Use TRACE() instead, so that
+//nothing happens when tracing is off
+void trace_emit(trace_event_id id, trace_phase ph, uint32_t arg) {
+    trace_ring *r = my_ring;
+    if (r == NULL) {
+        r = claim_ring();
+        if (r == NULL) return; //Too bad
+        my_ring = r;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    unsigned long h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    trace_rec *t = r->recs + (h & (TRACE_RING_SIZE - 1));
+    t->ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    t->arg = arg;
+    t->id = id;
+    t->ph = ph;
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+//Turns recording on or off. Whatever is in the rings is kept either way
+void trace_set_enabled(int on) {
+    atomic_store(&trace_enabled, on != 0);
+}
+
+//Sets the name this thread shows up as in the trace. Cheap enough to call
+//whether or not tracing is on
+void trace_thread_name(char const *name) {
+    snprintf(my_name, sizeof(my_name), "%s", name);
+    if (my_ring != NULL) {
+        pthread_mutex_lock(&rings_mutex);
+        snprintf(my_ring->name, sizeof(my_ring->name), "%s", name);
+        pthread_mutex_unlock(&rings_mutex);
+    }
+}
+
+//Copies out the events in r that are safe to look at. Returns how many
+//there were, or -1 if out of memory
+static long copy_ring(trace_ring *r, trace_rec **dest) {
+    unsigned long before = atomic_load_explicit(&r->head, memory_order_acquire);
+    unsigned long n = (before < TRACE_RING_SIZE) ? before : TRACE_RING_SIZE;
+
+    *dest = malloc(n * sizeof(trace_rec) + 1);
+    if (*dest == NULL) return -1;
+
+    unsigned long i;
+    for (i = 0; i < n; i++) {
+        (*dest)[i] = r->recs[(before - n + i) & (TRACE_RING_SIZE - 1)];
+    }
+
+    //The owner might have kept going while we copied. Anything it could
+    //have written over (including the one it might be writing right now)
+    //gets thrown away
+    unsigned long after = atomic_load_explicit(&r->head, memory_order_acquire);
+    unsigned long skip = 0;
+    if (after >= TRACE_RING_SIZE && after - TRACE_RING_SIZE + 1 > before - n) {
+        skip = after - TRACE_RING_SIZE + 1 - (before - n);
+        if (skip > n) skip = n;
+    }
+    memmove(*dest, *dest + skip, (n - skip) * sizeof(trace_rec));
+    return n - skip;
+}
+
+//Writes every ring to path as Chrome trace JSON. Returns the number of
+//events written, or -1 on error (and sets *error_str)
+int trace_dump(char const *path, char const **error_str) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        *error_str = strerror(errno);
+        return -1;
+    }
+
+    pthread_mutex_lock(&rings_mutex);
+
+    //Grab everything first so that the timestamps can start at zero
+    trace_rec *copies[TRACE_MAX_THREADS];
+    long counts[TRACE_MAX_THREADS];
+    trace_ring *r;
+    int i = 0;
+    uint64_t t0 = UINT64_MAX;
+    for (r = rings; r != NULL; r = r->next, i++) {
+        counts[i] = copy_ring(r, copies + i);
+        if (counts[i] < 0) {
+            int j;
+            for (j = 0; j < i; j++) free(copies[j]);
+            pthread_mutex_unlock(&rings_mutex);
+            fclose(fp);
+            *error_str = TRACE_OOM;
+            return -1;
+        }
+        if (counts[i] > 0 && copies[i][0].ns < t0) t0 = copies[i][0].ns;
+    }
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    int first = 1;
+    int total = 0;
+    for (r = rings, i = 0; r != NULL; r = r->next, i++) {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            first ? "" : ",\n", r->tid, r->name
+        );
+        first = 0;
+
+        long j;
+        for (j = 0; j < counts[i]; j++) {
+            trace_rec const *t = copies[i] + j;
+            char const *name = (t->id < TR_NUM_EVENTS) ? event_names[t->id] : "?";
+            double ts = (t->ns - t0) / 1e3;
+
+            if (t->ph == TRACE_COUNTER) {
+                fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%u}}",
+                    name, ts, r->tid, t->arg
+                );
+            } else if (t->ph == TRACE_INSTANT) {
+                fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"arg\":%u}}",
+                    name, ts, r->tid, t->arg
+                );
+            } else {
+                fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"arg\":%u}}",
+                    name, t->ph, ts, r->tid, t->arg
+                );
+            }
+            total++;
+        }
+        free(copies[i]);
+    }
+    fprintf(fp, "\n]}\n");
+
+    pthread_mutex_unlock(&rings_mutex);
+
+    if (fclose(fp) != 0) {
+        *error_str = strerror(errno);
+        return -1;
+    }
+
+    return total;
+}
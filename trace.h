@@ -0,0 +1,79 @@
+#ifndef TRACE_H
+#define TRACE_H 1
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+//Opt-in event tracing. Each thread that records something gets its own
+//ring of {timestamp, event id, arg}, which only that thread ever writes
+//to, so recording never takes a lock. When tracing is off, a TRACE() is
+//just a relaxed load and a branch. The rings can be dumped as Chrome trace
+//JSON, which chrome://tracing and Perfetto both open.
+
+#define TRACE_RING_SIZE 65536 //Events per thread. Must be a power of two
+#define TRACE_MAX_THREADS 16  //After this, new threads reuse the rings of
+                              //threads that have exited
+
+//The trick here is the same as for DBG_GUV_REG_IDENTS: one list gives us
+//both the enum and the names that show up in the trace
+#define TRACE_EVENT_IDENTS \
+    X(TR_FPGA_READ,      "fpga_read_cb"),\
+    X(TR_FPGA_WAKE,      "fpga_wake_cb"),\
+    X(TR_FPGA_WRITE,     "fpga_write_cb"),\
+    X(TR_STDIN,          "handle_stdin_cb"),\
+    X(TR_DRAW,           "draw_cb"),\
+    X(TR_IO_READ,        "io_thread_read"),\
+    X(TR_FIO_FILE_RD,    "fio_file_rd_ev"),\
+    X(TR_FIO_FILE_WR,    "fio_file_wr_ev"),\
+    X(TR_FIO_SEND_TIMER, "fio_send_timer_cb"),\
+    X(TR_SENDFILE_STATE, "sendfile_state")
+
+#define X(id, name) id
+typedef enum _trace_event_id {
+    TRACE_EVENT_IDENTS,
+    TR_NUM_EVENTS
+} trace_event_id;
+#undef X
+
+//These are the Chrome trace phase letters
+typedef enum _trace_phase {
+    TRACE_BEGIN = 'B',
+    TRACE_END = 'E',
+    TRACE_INSTANT = 'i',
+    TRACE_COUNTER = 'C'
+} trace_phase;
+
+typedef struct _trace_rec {
+    uint64_t ns; //CLOCK_MONOTONIC, same as dbg_log_rec.ns
+    uint32_t arg;
+    uint16_t id;
+    uint8_t ph;
+} trace_rec;
+
+extern atomic_int trace_enabled;
+
+//Records one event in this thread's ring. Use TRACE() instead, so that
+//nothing happens when tracing is off
+void trace_emit(trace_event_id id, trace_phase ph, uint32_t arg);
+
+#define TRACE(id, ph, arg) do { \
+    if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) trace_emit(id, ph, arg); \
+} while (0)
+
+//Turns recording on or off. Whatever is in the rings is kept either way
+void trace_set_enabled(int on);
+
+//Sets the name this thread shows up as in the trace. Cheap enough to call
+//whether or not tracing is on
+void trace_thread_name(char const *name);
+
+//Writes every ring to path as Chrome trace JSON. Returns the number of
+//events written, or -1 on error (and sets *error_str)
+int trace_dump(char const *path, char const **error_str);
+
+//////////////////////////////////////////////////
+//Error codes, which double as printable strings//
+//////////////////////////////////////////////////
+extern char const *const TRACE_OOM; // = "out of memory";
+
+#endif
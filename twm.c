@@ -9,344 +9,8 @@
 #include "textio.h"
 #include "twm.h"
 
-//Here's the key idea: twm nodes also know how to draw themselves
-int draw_fn_twm_node(void *item, int x, int y, int w, int h, char *buf) {
-    twm_node *t = (twm_node *)item;
-    
-    //Sanity check inputs
-    if (t == NULL) {
-        return -2; //This is all we can do
-    }
-    
-    if (w < 0 || h < 0) {
-        t->error_str = TWM_BAD_SZ;
-        return -1;
-    }
-    
-    if (x < 0 || y < 0) {
-        t->error_str = TWM_BAD_POS;
-        return -1;
-    }
-    
-    //Draw this node
-    char *buf_saved = buf; //Keep track of original position so we can calculate size
-    
-    //Unfortunately, at this point, we don't know yet if any children will
-    //want to draw themselves. So, we pre-emptively add the command to turn
-    //on highlighting if we are the focused node...
-    if (t->has_focus) {
-        *buf++ = '\e'; *buf++ = '['; *buf++ = '1'; *buf++ = 'm'; //Turn on highlight mode
-    }
-    //...and the technique will be to "undo" that if nothing was drawn.
-    int child_drawn = 0;
-    if (t->type == TWM_LEAF) {
-        //Check if a proper draw fn is given
-        if (t->draw_ops.draw_fn == NULL) {
-            t->error_str = TWM_NULL_DRAW_FN;
-            return -1;
-        }
-        //Return bytes consumed by the TWM_LEAF node
-        int child_sz = t->draw_ops.draw_fn(t->item, x, y, w, h, buf);
-        if (child_sz < 0) {
-            t->error_str = TWM_LEAF_DRAW_ERR;
-        } else if (child_sz > 0) {
-            child_drawn = 1;
-        }
-        buf += child_sz;
-        
-        if (!child_drawn) {
-            //Nothing to add, return early. This fixes a major performance
-            //bug where we were always sending commands to turn highlighting
-            //on and back off, even without drawing children
-            t->error_str = TWM_SUCC;
-            return 0;
-        }
-        
-        if (t->has_focus) {
-            *buf++ = '\e'; *buf++ = '['; *buf++ = 'm'; //Restore original mode
-        }
-        return buf - buf_saved;
-    } else if (t->type == TWM_HORZ) {        
-        //In a perfect world, the width (minus the columns needed for drawing
-        //separating borders) is an exact multiple of the number of children.
-        //However, here we're forced to keep track of how much error we have
-        int N = w - (t->num_children - 1);
-        int D = t->num_children;
-        int quot = N / D;
-        int rem = N % D;
-        
-        //This is how many "fractional columns" are available.
-        int err = rem;
-        
-        //Keep track of where we're drawing the children
-        int child_x = x;
-        
-        //Draw children.        
-        int i;
-        for (i = 0; i < t->num_children; i++) {
-            int child_width = quot;
-            if (err >= D) {
-                child_width++;
-                err -= D;
-            }
-            int child_sz = draw_fn_twm_node(t->children[i], child_x, y, child_width, h, buf);
-            if (child_sz < 0) {
-                //Propagate error upwards
-                t->error_str = t->children[i]->error_str;
-                return child_sz;
-            } else if (child_sz > 0) {
-                child_drawn = 1;
-            }
-            buf += child_sz;
-            err += rem;
-            child_x += child_width; //Advance past end of child we just drew
-            
-            //Now, if this node is set to redraw, draw borders between this 
-            //child and the next, provided we're not on the last child
-            if (t->need_redraw && i != t->num_children - 1) {
-                int incr = cursor_pos_cmd(buf, child_x, y);
-                buf += incr;
-                *buf++ = '|';
-                
-                int j;
-                for (j = 1; j < h; j++) {
-                    *buf++ = '\e'; *buf++ = '['; *buf++ = 'B'; //Move cursor down
-                    *buf++ = '\e'; *buf++ = '['; *buf++ = 'D'; //Move cursor to the left
-                    *buf++ = '|'; //Draw border line
-                }
-            }
-            child_x++; //Advance past border line
-        }
-        
-        if (!child_drawn && !t->need_redraw) {
-            //Nothing to add, return early. This fixes a major performance
-            //bug where we were always sending commands to turn highlighting
-            //on and back off, even without drawing children
-            t->error_str = TWM_SUCC;
-            return 0;
-        }
-        
-        if (t->has_focus) {
-            *buf++ = '\e'; *buf++ = '['; *buf++ = 'm'; //Restore original mode
-        }
-        
-        t->need_redraw = 0;
-        
-        t->error_str = TWM_SUCC;
-        return buf - buf_saved;
-    } else if (t->type == TWM_VERT) {        
-        //In a perfect world, the width (minus the columns needed for drawing
-        //separating borders) is an exact multiple of the number of children.
-        //However, here we're forced to keep track of how much error we have
-        int N = h - (t->num_children - 1);
-        int D = t->num_children;
-        int quot = N / D;
-        int rem = N % D;
-        
-        //This is how many "fractional columns" are available.
-        int err = rem;
-        
-        //Keep track of where we're drawing the children
-        int child_y = y;
-        
-        //Draw children.        
-        int i;
-        for (i = 0; i < t->num_children; i++) {
-            int child_height = quot;
-            if (err >= D) {
-                child_height++;
-                err -= D;
-            }
-            int child_sz = draw_fn_twm_node(t->children[i], x, child_y, w, child_height, buf);
-            if (child_sz < 0) {
-                //Propagate error upwards
-                t->error_str = t->children[i]->error_str;
-                return child_sz;
-            } else if (child_sz > 0) {
-                child_drawn = 1;
-            }
-            buf += child_sz;
-            
-            err += rem;
-            
-            child_y += child_height; //Advance past end of child we just drew
-            
-            //Now, if this node is set to redraw, draw borders between this 
-            //child and the next, provided we're not on the last child
-            if (t->need_redraw && i != t->num_children - 1) {
-                int incr = cursor_pos_cmd(buf, x, child_y);
-                buf += incr;
-                
-                int j;
-                for (j = 0; j < w; j++) {
-                    *buf++ = '-'; //Draw border line
-                }
-            }
-            child_y++; //Advance past border line
-        }
-        
-        if (!child_drawn && !t->need_redraw) {
-            //Nothing to add, return early. This fixes a major performance
-            //bug where we were always sending commands to turn highlighting
-            //on and back off, even without drawing children
-            t->error_str = TWM_SUCC;
-            return 0;
-        }
-        
-        if (t->has_focus && t->need_redraw) {
-            *buf++ = '\e'; *buf++ = '['; *buf++ = 'm'; //Restore original mode
-        }
-        
-        t->need_redraw = 0;
-        
-        t->error_str = TWM_SUCC;
-        return buf - buf_saved;
-    }
-    
-    t->error_str = TWM_BAD_NODE_TYPE;
-    return -1;
-}
-
-int draw_sz_twm_node(void *item, int w, int h) {
-    twm_node *t = (twm_node *)item;
-    
-    //Sanity check inputs
-    if (t == NULL) {
-        return -2; //This is all we can do
-    }
-    
-    if (w < 0 || h < 0) {
-        t->error_str = TWM_BAD_SZ;
-        return -1;
-    }
-    
-    int total_sz = 0;
-        
-    //Calculate size
-    if (t->type == TWM_LEAF) {
-        //Check if a valid size function was given
-        if (t->draw_ops.draw_sz == NULL) {
-            t->error_str = TWM_NULL_DRAW_SZ;
-            return -1;
-        }
-        //Simply return the amount of space needed by the contained drawable
-        int child_sz = t->draw_ops.draw_sz(t->item, w, h);
-        if (child_sz < 0) {
-            t->error_str = TWM_LEAF_SZ_ERR;
-        } else if (child_sz > 0 && t->has_focus) {
-            total_sz += 7; //Extra characters needed to turn on highlight and
-                           //ten turn it off afterwards
-        }
-        return child_sz;
-    } else if (t->type == TWM_HORZ) {
-        //In a perfect world, the width (minus the columns needed for drawing
-        //separating borders) is an exact multiple of the number of children.
-        //However, here we're forced to keep track of how much error we have
-        int N = w - (t->num_children - 1);
-        int D = t->num_children;
-        int quot = N / D;
-        int rem = N % D;
-        
-        //This is how many "fractional columns" are available.
-        int err = rem;
-        
-        //Tally up size needed by all the children
-        int child_drawn = 0;
-        int i;
-        for (i = 0; i < t->num_children; i++) {
-            int child_width = quot;
-            if (err >= D) {
-                child_width++;
-                err -= D;
-            }
-            int child_sz = draw_sz_twm_node(t->children[i], child_width, h);
-            if (child_sz < 0) {
-                //Propagate error upwards
-                t->error_str = t->children[i]->error_str;
-                return child_sz;
-            } else if (child_sz > 0) {
-                child_drawn = 1;
-            }
-            total_sz += child_sz;
-            err += rem;
-        }
-        
-        //Now add in size we need for drawing the borders, provided this 
-        //node needs a redraw
-
-        int border_sz = 0;   //Size needed for a single border line
-        if (t->need_redraw) {
-            border_sz += 10; //Upper bound of bytes needed to place the cursor at the top of the line
-            border_sz += 1;  //The first '|' character of the border
-            border_sz += 7*(h-1); //Each succeeding '|' requires 6 bytes to move the cursor to the right place, then one more for the '|' character
-        }
-        
-        total_sz += (t->num_children - 1) * border_sz;
-        
-        if (child_drawn && t->has_focus) {
-            total_sz += 7; //Extra characters needed to turn on highlight and
-                           //then turn it off afterwards
-        }
-        
-        t->error_str = TWM_SUCC;
-        return total_sz;
-    } else if (t->type == TWM_VERT) {        
-        //In a perfect world, the height (minus the rows needed for drawing
-        //separating borders) is an exact multiple of the number of children.
-        //However, here we're forced to keep track of how much error we have
-        int N = h - (t->num_children - 1);
-        int D = t->num_children;
-        int quot = N / D;
-        int rem = N % D;
-        
-        //This is how many "fractional columns" are available.
-        int err = rem;
-        
-        //Tally up size needed by all the children
-        int child_drawn = 0;
-        int i;
-        for (i = 0; i < t->num_children; i++) {
-            int child_height = quot;
-            if (err >= D) {
-                child_height++;
-                err -= D;
-            }
-            int child_sz = draw_sz_twm_node(t->children[i], w, child_height);
-            if (child_sz < 0) {
-                //Propagate error upwards
-                t->error_str = t->children[i]->error_str;
-                return child_sz;
-            } else if (child_sz > 0) {
-                child_drawn = 1;
-            }
-            total_sz += child_sz;
-            err += rem;
-        }
-        
-        //Now add in size we need for drawing the borders, provided we need
-        //to redraw this node
-        
-        int border_sz = 0;   //Size needed for a single border line
-        if (t->need_redraw) {
-            border_sz += 10; //Upper bound of bytes needed to place the cursor at the left of the line
-            border_sz += w;  //Number of '-' characters on this line
-        }
-        
-        total_sz += (t->num_children - 1) * border_sz;
-        
-        if (child_drawn && t->has_focus) {
-            total_sz += 7; //Extra characters needed to turn on highlight and
-                           //ten turn it off afterwards
-        }
-        
-        t->error_str = TWM_SUCC;
-        return total_sz;
-    }
-    
-    //Code should never get here
-    t->error_str = TWM_BAD_NODE_TYPE;
-    return -1;
-}
+static twm_redraw_hook *redraw_hook = NULL;
+static int redraw_requested = 0; //Cleared by twm_draw_tree
 
 void trigger_redraw_twm_node(void *item) {
     twm_node *t = (twm_node *)item;
@@ -362,17 +26,41 @@ static twm_node* construct_leaf_twm_node(void *item, draw_operations draw_ops) {
     ret->item = item;
     ret->draw_ops = draw_ops;
     ret->num_children = 0; //Maybe this will come in handy? 
+    ret->weight = 1;
     
     ret->error_str = TWM_SUCC;
     return ret;
 }
 
+//Makes sure t has room for n children. Returns 0 on success, or -1 if out
+//of memory (and t is left as it was)
+static int twm_node_reserve(twm_node *t, int n) {
+    if (n <= t->children_cap) return 0;
+    
+    int cap = (t->children_cap > 0) ? t->children_cap : 4;
+    while (cap < n) cap *= 2;
+    
+    twm_node **children = realloc(t->children, cap * sizeof(twm_node*));
+    if (children == NULL) return -1;
+    
+    t->children = children;
+    t->children_cap = cap;
+    return 0;
+}
+
 static twm_node* construct_twm_node(twm_node_type type) {
     twm_node *ret = calloc(1, sizeof(twm_node));
     if (!ret) return NULL;
     
     ret->type = type;
     ret->num_children = 0; //Maybe this will come in handy?
+    ret->weight = 1;
+    
+    //Every stacked node has at least two children at some point
+    if (twm_node_reserve(ret, 2) < 0) {
+        free(ret);
+        return NULL;
+    }
     
     ret->error_str = TWM_SUCC;
     return ret;
@@ -384,6 +72,7 @@ static void destroy_twm_node(twm_node *t) {
     if (t == NULL) return;
     
     if (t->type == TWM_LEAF && t->draw_ops.exit != NULL) t->draw_ops.exit(t->item);
+    free(t->children);
     free(t);
 }
 
@@ -399,7 +88,7 @@ static void free_twm_node_tree(twm_node *head) {
         for (i = 0; i < head->num_children; i++) {
             free_twm_node_tree(head->children[i]);
         }
-        free(head);
+        destroy_twm_node(head);
         return;
     }
 }
@@ -411,6 +100,8 @@ int redraw_twm_node_tree(twm_node *t) {
         return -2; //This is all we can do
     }
     
+    twm_request_redraw();
+    
     if (t->type == TWM_LEAF) {
         //Check if a trigger redraw function was given
         if (t->draw_ops.trigger_redraw == NULL) {
@@ -477,8 +168,10 @@ draw_operations const empty_ops = {
 //Returns a new twm_tree on success, NULL on error
 twm_tree* new_twm_tree() {
     twm_tree *ret = calloc(1, sizeof(twm_tree));
+    if (ret == NULL) return NULL;
     
     //The head and focus pointers are already set to NULL
+    ret->layout_dirty = 1;
     ret->error_str = TWM_SUCC;
     return ret;
 }
@@ -488,6 +181,11 @@ void del_twm_tree(twm_tree *t) {
     if (t == NULL) return;
     
     free_twm_node_tree(t->head);
+    del_cellgrid(t->grid);
+    free(t->out);
+    free(t->leaves);
+    free(t->splits);
+    free(t->dirty);
     
     free(t);
 }
@@ -719,6 +417,10 @@ int twm_tree_move_focus(twm_tree *t, twm_dir dir) {
 
 //Follows usual error-return technique. Also makes sure to set redraws
 //where necessary. DOES NOT FREE MEMORY HELD BY parent->children[ind]!
+//However, parent itself is freed if this leaves it with no children, and
+//a parent left with one child takes that child's place (and the child is
+//freed), so don't hang on to any pointers below parent's parent. If the
+//focus was on a node that goes away, it moves to whatever took its place
 static int twm_remove_node(twm_tree *t, twm_node *parent, int ind) {
     //Sanity check inputs
     if (t == NULL) {
@@ -758,9 +460,15 @@ static int twm_remove_node(twm_tree *t, twm_node *parent, int ind) {
         parent->item = tmp->item;
         parent->draw_ops = tmp->draw_ops;
         if (tmp->type != TWM_LEAF) {
+            //Just take tmp's whole child list
+            free(parent->children);
+            parent->children = tmp->children;
             parent->num_children = tmp->num_children;
+            parent->children_cap = tmp->children_cap;
+            tmp->children = NULL;
+            tmp->num_children = 0;
+            tmp->children_cap = 0;
             for (i = 0; i < parent->num_children; i++) {
-                parent->children[i] = tmp->children[i];
                 parent->children[i]->parent = parent; //That's a mouthful...
             }
         } else {
@@ -769,7 +477,10 @@ static int twm_remove_node(twm_tree *t, twm_node *parent, int ind) {
         
         tmp->type = TWM_UNINITIALIZED;
         
-        if (t->focus == tmp) t->focus = parent;
+        if (t->focus == tmp) {
+            t->focus = parent;
+            parent->has_focus = 1;
+        }
         
         destroy_twm_node(tmp);
         
@@ -780,11 +491,16 @@ static int twm_remove_node(twm_tree *t, twm_node *parent, int ind) {
         //Recursively remove the parent
         twm_node *grandparent = parent->parent;
         if (grandparent == NULL) {
-            //Trying to delete the whole tree
-            t->error_str = TWM_ILLEGAL_DELETE; //TODO: this isn't really an error, 
-            //Basically, it's legal to delete the whole tree, but for some reason I'm scared to just
-            //have the code do that. I'm not sure why
-            return -1;
+            //That was the last window, so now the tree is empty
+            if (t->head != parent) {
+                t->error_str = TWM_INVALID_TREE;
+                return -1;
+            }
+            destroy_twm_node(parent);
+            t->head = NULL;
+            t->focus = NULL;
+            t->error_str = TWM_SUCC;
+            return 0;
         }
         
         int parent_ind = twm_node_indexof(parent, grandparent);
@@ -794,10 +510,19 @@ static int twm_remove_node(twm_tree *t, twm_node *parent, int ind) {
             return -1;
         }
         
+        if (t->focus == parent) {
+            parent->has_focus = 0;
+            t->focus = grandparent;
+            grandparent->has_focus = 1;
+        }
+        
         int rc = twm_remove_node(t, grandparent, parent_ind);
         if (rc < 0) {
             return -1; //t->error_str already set
         }
+        
+        //Nothing points at parent anymore
+        destroy_twm_node(parent);
     } else {
         int rc = redraw_twm_node_tree(parent);
         if (rc < 0) {
@@ -847,6 +572,10 @@ static int twm_insert_node(twm_tree *t, twm_node *src, twm_node *dst, int dst_in
         }
         
         //Take this node and make it a TWM_LEAF child of a TWM_HORZ node
+        if (twm_node_reserve(dst, 2) < 0) {
+            t->error_str = TWM_OOM;
+            return -1;
+        }
         twm_node *to_add = construct_leaf_twm_node(dst->item, dst->draw_ops);
         if (to_add == NULL) {
             t->error_str = TWM_OOM;
@@ -865,8 +594,8 @@ static int twm_insert_node(twm_tree *t, twm_node *src, twm_node *dst, int dst_in
     }
     
     //Now we can write the general function
-    if (dst->num_children == MAX_CHILDREN) {
-        t->error_str = TWM_FULL_PARENT;
+    if (twm_node_reserve(dst, dst->num_children + 1) < 0) {
+        t->error_str = TWM_OOM;
         return -1;
     }
     
@@ -1004,6 +733,8 @@ int twm_tree_add_window(twm_tree *t, void *item, draw_operations draw_ops) {
         return -2; //This is all we can do
     }
     
+    t->layout_dirty = 1;
+    
     //Allocate the new node
     twm_node *to_add = construct_leaf_twm_node(item, draw_ops);
     if (to_add == NULL) {
@@ -1087,6 +818,8 @@ int twm_tree_remove_focused(twm_tree *t) {
         return -2;
     }
     
+    t->layout_dirty = 1;
+    
     if (t->focus == NULL) {
         //Nothing to do
         return 0;
@@ -1123,9 +856,12 @@ int twm_tree_remove_focused(twm_tree *t) {
     if (parent->num_children == 1) {
         twm_node *grandparent = parent->parent;
         if (grandparent == NULL) {
-            //I don't know what this means for us, so return an error
-            t->error_str = TWM_BAD_DEVELOPER;
-            return -1;
+            //This is the last window, so the tree ends up empty
+            free_twm_node_tree(t->head);
+            t->head = NULL;
+            t->focus = NULL;
+            t->error_str = TWM_SUCC;
+            return 0;
         }
         
         int parent_ind = twm_node_indexof(parent, grandparent);
@@ -1146,25 +882,22 @@ int twm_tree_remove_focused(twm_tree *t) {
         next_focus = parent->children[ind];
     }
     
-    //We have found a suitable node to focus on. Delete the old one
+    //We have found a suitable node to focus on. Move the focus there 
+    //before deleting the old one: next_focus might get merged into its 
+    //parent, and twm_remove_node will only move the focus along with it
+    //if it knows about it
+    twm_node *old_focus = t->focus;
+    t->focus = next_focus;
+    t->focus->has_focus = 1;
+    
+    //This also takes care of redrawing everything that moved
     int rc = twm_remove_node(t, parent, focus_ind);
     if (rc < 0) {
         return -1; //twm_remove_node has already set the error code
     }
     
     //Release resources from deleted subtree
-    free_twm_node_tree(t->focus);
-    
-    //Make sure to set focus and redraw
-    t->focus = next_focus;
-    t->focus->has_focus = 1;
-    
-    rc = redraw_twm_node_tree(parent);
-    if (rc < 0) {
-        //Propagate error code
-        t->error_str = parent->error_str;
-        return -1;
-    }
+    free_twm_node_tree(old_focus);
     
     //Success
     t->error_str = TWM_SUCC;
@@ -1179,6 +912,8 @@ int twm_tree_move_focused_node(twm_tree *t, twm_dir dir) {
         return -2; //This is all we can do
     }
     
+    t->layout_dirty = 1;
+    
     if (t->focus == NULL) {
         //No focus; nothing to do
         t->error_str = TWM_SUCC;
@@ -1310,6 +1045,11 @@ int twm_tree_move_focused_node(twm_tree *t, twm_dir dir) {
     
     //First, remove the focused node from where it used to be
     twm_node *parent = t->focus->parent;
+    if (parent == t->head && parent->num_children == 1) {
+        //It's the only window, so it's already as far as it can go
+        t->error_str = TWM_SUCC;
+        return 0;
+    }
     int focus_ind = twm_node_indexof(t->focus, parent);
     if (focus_ind < 0) {
         //Propagate error code
@@ -1411,6 +1151,10 @@ static int wrap_leaf(twm_node *t) {
     }
     
     //Take this node and make it a TWM_LEAF child of a TWM_HORZ node
+    if (twm_node_reserve(t, 2) < 0) {
+        t->error_str = TWM_OOM;
+        return -1;
+    }
     twm_node *to_add = construct_leaf_twm_node(t->item, t->draw_ops);
     if (to_add == NULL) {
         t->error_str = TWM_OOM;
@@ -1438,6 +1182,8 @@ int twm_set_stack_dir_focused(twm_tree *t, twm_node_type type) {
         t->error_str = TWM_BAD_NODE_TYPE;
         return -1;
     }
+    
+    t->layout_dirty = 1;
     if (t->focus == NULL) {
         //No focus; nothing to do
         t->error_str = TWM_SUCC;
@@ -1521,13 +1267,419 @@ int twm_toggle_stack_dir_focused(twm_tree *t) {
     return -1;
 }
 
-//write()s the data described by t into fd, given the target screen size
-//and coordinates. Follows usual error return technique
+//Sets the weight and minimum size (see twm_node) of the focused node. 
+//Returns -1 on error and sets t->error_str (or returns -2 if t was NULL)
+int twm_set_weight_focused(twm_tree *t, int weight, int min_sz) {
+    if (t == NULL) {
+        return -2; //This is all we can do
+    }
+    if (weight < 1 || min_sz < 0) {
+        t->error_str = TWM_BAD_SZ;
+        return -1;
+    }
+    
+    if (t->focus == NULL) {
+        t->error_str = TWM_NO_FOCUS;
+        return -1;
+    }
+    
+    t->focus->weight = weight;
+    t->focus->min_sz = min_sz;
+    t->layout_dirty = 1;
+    
+    //All of the focused node's siblings might have moved too
+    twm_node *moved = (t->focus->parent != NULL) ? t->focus->parent : t->focus;
+    int rc = redraw_twm_node_tree(moved);
+    if (rc < 0) {
+        //Propagate error
+        t->error_str = moved->error_str;
+        return -1;
+    }
+    
+    t->error_str = TWM_SUCC;
+    return 0;
+}
+
+//Checks the subtree at t for broken links and for violations of the tree
+//invariant. Returns 0 if all is well, or an OR of the TWM_INV_* bits
+int check_tree_invariants(twm_node *t) {
+    if (t == NULL) return 0;
+    
+    int ret = 0;
+    if (t->weight < 1 || t->min_sz < 0) ret |= TWM_INV_BAD_WEIGHT;
+    
+    if (t->type == TWM_LEAF) return ret;
+    if (t->type != TWM_HORZ && t->type != TWM_VERT) return ret | TWM_INV_BAD_TYPE;
+    
+    if (t->num_children == 0) ret |= TWM_INV_EMPTY_SPLIT;
+    
+    int i;
+    for (i = 0; i < t->num_children; i++) {
+        twm_node *c = t->children[i];
+        if (c == NULL) {
+            ret |= TWM_INV_NULL_CHILD;
+            continue;
+        }
+        if (c->parent != t) ret |= TWM_INV_BAD_PARENT;
+        if (t->num_children == 1 && c->type != TWM_LEAF) ret |= TWM_INV_ONLY_CHILD;
+        ret |= check_tree_invariants(c);
+    }
+    
+    return ret;
+}
+
+//Number of nodes in the subtree at t
+static int twm_node_count(twm_node *t) {
+    if (t == NULL) return 0;
+    int ret = 1;
+    int i;
+    for (i = 0; i < t->num_children; i++) ret += twm_node_count(t->children[i]);
+    return ret;
+}
+
+//Saves the rect of every node under t, and appends them to the tree's 
+//lists. Returns 0 on success, or -1 on error (and sets tree->error_str)
+static int twm_layout_node(twm_tree *tree, twm_node *t, int x, int y, int w, int h) {
+    if (t == NULL) {
+        tree->error_str = TWM_INVALID_TREE;
+        return -1;
+    }
+    
+    if (w < 0 || h < 0) {
+        tree->error_str = TWM_BAD_SZ;
+        return -1;
+    }
+    
+    t->x = x;
+    t->y = y;
+    t->w = w;
+    t->h = h;
+    
+    if (t->type == TWM_LEAF) {
+        tree->leaves[tree->num_leaves++] = t;
+        return 0;
+    } else if (t->type != TWM_HORZ && t->type != TWM_VERT) {
+        tree->error_str = TWM_BAD_NODE_TYPE;
+        return -1;
+    }
+    
+    if (t->num_children == 0) {
+        tree->error_str = TWM_INVALID_TREE;
+        return -1;
+    }
+    tree->splits[tree->num_splits++] = t;
+    
+    int n = t->num_children;
+    int start = (t->type == TWM_HORZ) ? x : y;
+    int end = start + ((t->type == TWM_HORZ) ? w : h);
+    
+    //Space left over once the borders are taken out. If there are more 
+    //children than fit, the ones at the end get squashed to nothing
+    int avail = end - start - (n - 1);
+    if (avail < 0) avail = 0;
+    
+    //Anyone whose weighted share of A would be less than their min_sz gets
+    //exactly min_sz, and everyone else splits what's left (A) by weight
+    //(W is the total weight of everyone else). Taking someone out like 
+    //that can only make the others' shares smaller, so this settles in at
+    //most n rounds
+    long long tot_w = 0;
+    int i;
+    for (i = 0; i < n; i++) tot_w += t->children[i]->weight;
+    
+    long long A = avail, W = tot_w;
+    int use_min = 1;
+    while (1) {
+        long long next_A = avail, next_W = 0;
+        for (i = 0; i < n; i++) {
+            twm_node *c = t->children[i];
+            if ((long long) c->min_sz * W > A * c->weight) next_A -= c->min_sz;
+            else next_W += c->weight;
+        }
+        
+        if (next_A < 0) {
+            //There isn't room for all the minimums, so forget about them
+            use_min = 0;
+            A = avail;
+            W = tot_w;
+            break;
+        } else if (next_A == A && next_W == W) {
+            break;
+        }
+        
+        A = next_A;
+        W = next_W;
+    }
+    
+    //Rounding each share separately would lose (or gain) a few cells, so
+    //instead each child ends where its running total of weight says. With
+    //equal weights, the extra cells go to the children at the end
+    long long cum_w = 0;
+    int given = 0;
+    int pos = start;
+    for (i = 0; i < n; i++) {
+        twm_node *c = t->children[i];
+        int sz;
+        if (use_min && (long long) c->min_sz * W > A * c->weight) {
+            sz = c->min_sz;
+        } else {
+            cum_w += c->weight;
+            int upto = A * cum_w / W;
+            sz = upto - given;
+            given = upto;
+        }
+        
+        if (pos > end) pos = end;
+        if (sz > end - pos) sz = end - pos;
+        
+        int rc;
+        if (t->type == TWM_HORZ) {
+            rc = twm_layout_node(tree, t->children[i], pos, y, sz, h);
+        } else {
+            rc = twm_layout_node(tree, t->children[i], x, pos, w, sz);
+        }
+        if (rc < 0) return -1; //tree->error_str already set
+        
+        pos += sz + 1; //Skip the border line
+    }
+    
+    return 0;
+}
+
+//Works out where everything goes, and rebuilds the lists of leaves and 
+//splits. Returns 0 on success, or -1 on error (and sets t->error_str)
+static int twm_layout(twm_tree *t, int x, int y, int w, int h) {
+    int n = twm_node_count(t->head);
+    if (n > t->lists_cap) {
+        twm_node **leaves = realloc(t->leaves, n * sizeof(twm_node*));
+        if (leaves != NULL) t->leaves = leaves;
+        twm_node **splits = realloc(t->splits, n * sizeof(twm_node*));
+        if (splits != NULL) t->splits = splits;
+        twm_node **dirty = realloc(t->dirty, n * sizeof(twm_node*));
+        if (dirty != NULL) t->dirty = dirty;
+        
+        if (leaves == NULL || splits == NULL || dirty == NULL) {
+            t->error_str = TWM_OOM;
+            return -1;
+        }
+        t->lists_cap = n;
+    }
+    
+    t->num_leaves = 0;
+    t->num_splits = 0;
+    t->num_dirty = 0;
+    if (twm_layout_node(t, t->head, x, y, w, h) < 0) {
+        //Don't leave half a layout lying around
+        t->num_leaves = 0;
+        t->num_splits = 0;
+        return -1; //t->error_str already set
+    }
+    
+    t->lx = x;
+    t->ly = y;
+    t->lw = w;
+    t->lh = h;
+    t->layout_dirty = 0;
+    return 0;
+}
+
+//Nonzero if t or one of its ancestors has the focus (and so should be
+//highlighted)
+static int twm_node_highlighted(twm_node const *t) {
+    for (; t != NULL; t = t->parent) {
+        if (t->has_focus) return 1;
+    }
+    return 0;
+}
+
+//Asks every leaf if it has something to draw, and remembers the ones that
+//do in the dirty list. Returns how many bytes are needed (can be an upper
+//bound) to draw the frame, or -1 on error (and sets t->error_str)
+static int twm_draw_sz_lists(twm_tree *t) {
+    int total_sz = 0;
+    t->num_dirty = 0;
+    
+    int i;
+    for (i = 0; i < t->num_leaves; i++) {
+        twm_node *l = t->leaves[i];
+        
+        //Squashed to nothing, either because there were too many windows
+        //to fit or the screen is tiny. It'll get redrawn if it ever gets
+        //some room back
+        if (l->w <= 0 || l->h <= 0) continue;
+        
+        //Check if a valid size function was given
+        if (l->draw_ops.draw_sz == NULL) {
+            t->error_str = TWM_NULL_DRAW_SZ;
+            return -1;
+        }
+        int child_sz = l->draw_ops.draw_sz(l->item, l->w, l->h);
+        if (child_sz < 0) {
+            t->error_str = TWM_LEAF_SZ_ERR;
+            return -1;
+        } else if (child_sz > 0) {
+            t->dirty[t->num_dirty++] = l;
+            total_sz += child_sz;
+            total_sz += 7; //In case it needs highlighting on and off
+        }
+    }
+    
+    //Borders are only drawn for splits that need a redraw
+    for (i = 0; i < t->num_splits; i++) {
+        twm_node *s = t->splits[i];
+        if (!s->need_redraw) continue;
+        
+        int border_sz;
+        if (s->type == TWM_HORZ) {
+            border_sz = 10;         //Upper bound of bytes needed to place the cursor at the top of the line
+            border_sz += 1;         //The first '|' character of the border
+            border_sz += 7*(s->h-1); //Each succeeding '|' requires 6 bytes to move the cursor to the right place, then one more for the '|' character
+        } else {
+            border_sz = 10;         //Upper bound of bytes needed to place the cursor at the left of the line
+            border_sz += s->w;      //Number of '-' characters on this line
+        }
+        total_sz += (s->num_children - 1) * border_sz + 7;
+    }
+    
+    return total_sz;
+}
+
+//Draws the border lines between the children of split node s into buf.
+//Returns the number of bytes added
+static int twm_draw_borders(twm_node *s, char *buf) {
+    char *buf_saved = buf;
+    
+    //A HORZ border always draws its first '|', which would land on whatever
+    //is below a squashed-flat split (probably its parent's border)
+    if (s->w <= 0 || s->h <= 0) return 0;
+    
+    int hl = twm_node_highlighted(s);
+    if (hl) {
+        *buf++ = '\e'; *buf++ = '['; *buf++ = '1'; *buf++ = 'm'; //Turn on highlight mode
+    }
+    
+    int i;
+    for (i = 0; i < s->num_children - 1; i++) {
+        twm_node *c = s->children[i];
+        if (s->type == TWM_HORZ) {
+            //Past here, the children didn't fit and are squashed to nothing
+            if (c->x + c->w >= s->x + s->w) break;
+            buf += cursor_pos_cmd(buf, c->x + c->w, s->y);
+            *buf++ = '|';
+            
+            int j;
+            for (j = 1; j < s->h; j++) {
+                *buf++ = '\e'; *buf++ = '['; *buf++ = 'B'; //Move cursor down
+                *buf++ = '\e'; *buf++ = '['; *buf++ = 'D'; //Move cursor to the left
+                *buf++ = '|'; //Draw border line
+            }
+        } else {
+            if (c->y + c->h >= s->y + s->h) break;
+            buf += cursor_pos_cmd(buf, s->x, c->y + c->h);
+            
+            int j;
+            for (j = 0; j < s->w; j++) {
+                *buf++ = '-'; //Draw border line
+            }
+        }
+    }
+    
+    if (hl) {
+        *buf++ = '\e'; *buf++ = '['; *buf++ = 'm'; //Restore original mode
+    }
+    
+    return buf - buf_saved;
+}
+
+//Draws everything that twm_draw_sz_lists found to be dirty into buf. 
+//Returns number of bytes added, or -1 on error (and sets t->error_str)
+static int twm_draw_fn_lists(twm_tree *t, char *buf) {
+    char *buf_saved = buf;
+    
+    int i;
+    for (i = 0; i < t->num_dirty; i++) {
+        twm_node *l = t->dirty[i];
+        
+        //Check if a proper draw fn is given
+        if (l->draw_ops.draw_fn == NULL) {
+            t->error_str = TWM_NULL_DRAW_FN;
+            return -1;
+        }
+        
+        int hl = twm_node_highlighted(l);
+        char *start = buf;
+        if (hl) {
+            *buf++ = '\e'; *buf++ = '['; *buf++ = '1'; *buf++ = 'm'; //Turn on highlight mode
+        }
+        
+        int child_sz = l->draw_ops.draw_fn(l->item, l->x, l->y, l->w, l->h, buf);
+        if (child_sz < 0) {
+            t->error_str = TWM_LEAF_DRAW_ERR;
+            return -1;
+        } else if (child_sz == 0) {
+            //Don't bother with highlighting if nothing was drawn
+            buf = start;
+            continue;
+        }
+        buf += child_sz;
+        
+        if (hl) {
+            *buf++ = '\e'; *buf++ = '['; *buf++ = 'm'; //Restore original mode
+        }
+    }
+    
+    for (i = 0; i < t->num_splits; i++) {
+        twm_node *s = t->splits[i];
+        if (!s->need_redraw) continue;
+        
+        buf += twm_draw_borders(s, buf);
+        s->need_redraw = 0;
+    }
+    
+    return buf - buf_saved;
+}
+
+//Makes sure t->out can hold at least sz bytes. Whatever was in there is
+//lost. Returns 0 on success, or -1 if out of memory (and sets t->error_str)
+static int twm_reserve_out(twm_tree *t, int sz) {
+    if (sz <= t->out_cap) return 0;
+    
+    //Grow by at least double, so that a slowly growing screen doesn't 
+    //cause a realloc every frame
+    int cap = t->out_cap * 2;
+    if (cap < sz) cap = sz;
+    
+    char *out = realloc(t->out, cap);
+    if (out == NULL) {
+        t->error_str = TWM_OOM;
+        return -1;
+    }
+    t->out = out;
+    t->out_cap = cap;
+    return 0;
+}
+
+//Draws t for the given screen size and coordinates, and starts write()ing
+//it into fd (see twm_flush). Returns the size of the frame, 0 if there was
+//nothing to draw, or -1 on error (and sets t->error_str). Returns -2 if t
+//is NULL. If the last frame still hasn't been sent, this draws nothing 
+//and returns 0. At most one frame is ever in flight; whatever changes in 
+//the meantime goes out in one go in the next frame
 int twm_draw_tree(int fd, twm_tree *t, int x, int y, int w, int h) {
     if (t == NULL) {
         return -2;
     }
     
+    if (t->out_pos < t->out_len) {
+        //Still busy with the last frame. We owe the screen a redraw, which
+        //twm_flush will ask for once it's done
+        redraw_requested = 1;
+        return 0;
+    }
+    
+    //Anything that asks for a redraw from here on needs another frame
+    redraw_requested = 0;
+    
     if (x < 0 || y < 0) {
         t->error_str = TWM_BAD_POS;
         return -1;
@@ -1543,34 +1695,113 @@ int twm_draw_tree(int fd, twm_tree *t, int x, int y, int w, int h) {
         return 0;
     }
     
-    int bytes_needed = draw_sz_twm_node(t->head, w, h);
+    //Only work out where everything goes if something moved
+    if (t->layout_dirty || x != t->lx || y != t->ly || w != t->lw || h != t->lh) {
+        if (twm_layout(t, x, y, w, h) < 0) {
+            return -1; //t->error_str already set
+        }
+    }
+    
+    int bytes_needed = twm_draw_sz_lists(t);
     if (bytes_needed < 0) {
-        //Propagate error string
-        t->error_str = t->head->error_str;
-        return -1;
+        return -1; //t->error_str already set
     } else if (bytes_needed == 0) {
         return 0; //Nothing to do
     }
     
-    char *buf = malloc(bytes_needed);
-    int len = draw_fn_twm_node(t->head, x, y, w, h, buf);
+    //Make sure the off-screen grid covers the area we're drawing. If it
+    //moved or changed size, the terminal needs a full repaint anyway
+    if (t->grid == NULL) {
+        t->grid = new_cellgrid(x, y, w, h);
+        if (t->grid == NULL) {
+            t->error_str = TWM_OOM;
+            return -1;
+        }
+    } else if (t->grid->x != x || t->grid->y != y || t->grid->w != w || t->grid->h != h) {
+        int rc = cellgrid_resize(t->grid, x, y, w, h);
+        if (rc < 0) {
+            t->error_str = t->grid->error_str;
+            return -1;
+        }
+    }
     
+    if (twm_reserve_out(t, bytes_needed) < 0) {
+        return -1; //t->error_str already set
+    }
+    int len = twm_draw_fn_lists(t, t->out);
     if (len < 0) {
-        free(buf);
-        //Propagate error string
-        t->error_str = t->head->error_str;
         return -1; //t->error_str already set
     }
     
-    //TODO: should this be in a while loop in case we can't send it all at
-    //once?
-    int rc = write(fd, buf, len);
+    //Play the drawables' output into the grid, then only send what
+    //actually changed on the screen. Once it's in the grid we don't need
+    //the drawables' output anymore, so the diff can reuse the buffer
+    cellgrid_feed(t->grid, t->out, len);
+    
+    int diff_sz = cellgrid_diff_sz(t->grid);
+    if (diff_sz == 0) {
+        return 0; //Nothing to do
+    }
+    
+    if (twm_reserve_out(t, diff_sz) < 0) {
+        //The grid thinks this frame is on the screen, but it never will be
+        cellgrid_invalidate(t->grid);
+        return -1; //t->error_str already set
+    }
+    t->out_len = cellgrid_diff(t->grid, t->out);
+    t->out_pos = 0;
+    
+    int rc = twm_flush(fd, t);
     if (rc < 0) {
-        t->error_str = strerror(errno);
+        return -1; //t->error_str already set
+    }
+    
+    return t->out_len;
+}
+
+//write()s as much of the frame in flight as fd will take. Give it a 
+//non-blocking fd and call it again when fd is writable. Returns the number
+//of bytes still waiting (0 once the frame is all out), or -1 on error (and
+//sets t->error_str). Returns -2 if t is NULL. If anything asked for a 
+//redraw while the frame was in flight, this calls the redraw hook once
+//it's done
+int twm_flush(int fd, twm_tree *t) {
+    if (t == NULL) {
+        return -2;
+    }
+    
+    while (t->out_pos < t->out_len) {
+        int rc = write(fd, t->out + t->out_pos, t->out_len - t->out_pos);
+        if (rc < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            
+            //Give up on this frame. Who knows what's on the screen now, so
+            //the next frame has to paint everything
+            t->error_str = strerror(errno);
+            t->out_pos = t->out_len = 0;
+            cellgrid_invalidate(t->grid);
+            return -1;
+        }
+        t->out_pos += rc;
+    }
+    
+    int left = t->out_len - t->out_pos;
+    if (left == 0) {
+        t->out_pos = t->out_len = 0;
+        
+        //Now we can catch up on whatever happened in the meantime
+        if (redraw_requested && redraw_hook != NULL) redraw_hook(0);
     }
     
-    free(buf);
-    return rc;
+    t->error_str = TWM_SUCC;
+    return left;
+}
+
+//Number of bytes in the frame in flight that haven't been written yet
+int twm_tree_pending(twm_tree *t) {
+    if (t == NULL) return 0;
+    return t->out_len - t->out_pos;
 }
 
 char const* twm_tree_strerror(twm_tree *t) {
@@ -1731,6 +1962,8 @@ int twm_tree_remove_item(twm_tree *t, void *item) {
         return -2; //This is all we can do
     }
     
+    t->layout_dirty = 1;
+    
     //If we happen to be focused on the node we wish to delete, run our
     //special function that also computes a sane node to focus on after this
     //one is deleted.
@@ -1836,6 +2069,8 @@ int twm_tree_redraw(twm_tree *t) {
         return -2; //This is all we can do
     }
     
+    t->layout_dirty = 1;
+    
     if (t->head == NULL) {
         t->error_str = TWM_NO_WINDOWS;
         return -1;
@@ -1848,10 +2083,34 @@ int twm_tree_redraw(twm_tree *t) {
         return -1;
     }
     
+    //We might be here because the terminal got resized or messed up, so
+    //don't trust what we think is on the screen
+    cellgrid_invalidate(t->grid);
+    
     t->error_str = TWM_SUCC;
     return 0;
 }
 
+//Pass NULL to remove the hook
+void twm_set_redraw_hook(twm_redraw_hook *fn) {
+    redraw_hook = fn;
+    redraw_requested = 0;
+}
+
+//Asks for a frame as soon as possible. This gets called for every log
+//that comes in, so keep it cheap
+void twm_request_redraw() {
+    if (redraw_requested || redraw_hook == NULL) return;
+    redraw_requested = 1;
+    redraw_hook(0);
+}
+
+//Asks for a frame after delay_ns. Dropped if a frame is already on its way
+void twm_request_redraw_in(uint64_t delay_ns) {
+    if (redraw_requested || redraw_hook == NULL) return;
+    redraw_hook(delay_ns);
+}
+
 //////////////////////////////////////////////////
 //Error codes, which double as printable strings//
 //////////////////////////////////////////////////
@@ -1863,7 +2122,6 @@ char const *const TWM_LEAF_TRIG_REDRAW_ERR = "TWM_LEAF node redraw trigger faile
 char const *const TWM_BAD_NODE_TYPE = "invalid node type (uninitialized memory?)";
 char const *const TWM_BAD_SZ = "bad node size";
 char const *const TWM_BAD_POS = "bad node position";
-char const *const TWM_FULL_PARENT = "too many children";
 char const *const TWM_NULL_DRAW_FN = "window has no draw function";
 char const *const TWM_NULL_DRAW_SZ = "window has no size-finding function";
 char const *const TWM_NULL_TRIG_REDRAW = "window has no redraw trigger function";
@@ -1,6 +1,9 @@
 #ifndef TWM_H
 #define TWM_H 1
 
+#include <stdint.h>
+#include "cellgrid.h"
+
 //////////////////////////////////////////////////
 //Error codes, which double as printable strings//
 //////////////////////////////////////////////////
@@ -12,7 +15,6 @@ extern char const *const TWM_LEAF_TRIG_REDRAW_ERR; // = "TWM_LEAF node redraw tr
 extern char const *const TWM_BAD_NODE_TYPE; // = "invalid node type (uninitialized memory?)";
 extern char const *const TWM_BAD_SZ; // = "bad node size";
 extern char const *const TWM_BAD_POS; // = "bad node position";q
-extern char const *const TWM_FULL_PARENT; // = "too many children";
 extern char const *const TWM_NULL_DRAW_FN; // = "window has no draw function";
 extern char const *const TWM_NULL_DRAW_SZ; // = "window has no size-finding function";
 extern char const *const TWM_NULL_TRIG_REDRAW; // = "window has no redraw trigger function";
@@ -61,7 +63,6 @@ typedef enum _twm_node_type {
 } twm_node_type;
 
 //These should be opaque structs
-#define MAX_CHILDREN 8
 typedef struct _twm_node {
     //If this is a TWM_LEAF node, then draw the item pointed to by item_to_draw
     //using the function pointed at by how_to_draw_it. Otherwise, we need 
@@ -82,9 +83,23 @@ typedef struct _twm_node {
     draw_operations draw_ops;
     
     //Otherwise, this node either contains TWM_VERTically or horizontally 
-    //stacked "windows"
-    struct _twm_node *children[MAX_CHILDREN];
+    //stacked "windows". The array grows as needed, so there's no limit on
+    //how many there can be
+    struct _twm_node **children;
     int num_children;
+    int children_cap;
+    
+    //How much of its parent's space this node gets, relative to its 
+    //siblings (new nodes get 1). It is never squeezed below min_sz rows
+    //(in a TWM_VERT parent) or columns (in a TWM_HORZ parent), unless
+    //there isn't room for everyone's minimum, in which case the minimums
+    //are ignored
+    int weight;
+    int min_sz;
+    
+    //Where this node went on the screen the last time the tree was laid
+    //out (see layout_dirty in twm_tree)
+    int x, y, w, h;
     
     //Error information
     char const *error_str;
@@ -99,15 +114,36 @@ typedef struct _twm_tree {
                      //later decide to draw borders differently around the
                      //focused window
     
+    //Everything is drawn into this off-screen grid first, and only the 
+    //cells that changed are sent to the terminal. Created on first draw
+    cellgrid *grid;
+    
+    //Output buffer, kept from frame to frame so we aren't in malloc all
+    //the time. It only ever grows. If the terminal couldn't take a whole
+    //frame, what's left of it is between out_pos and out_len
+    char *out;
+    int out_cap;
+    int out_len;
+    int out_pos;
+    
+    //Layout cache. Working out where everything goes only happens when 
+    //the shape of the tree or the screen area changes; the functions that
+    //do that set layout_dirty. The rest of the time, a frame just goes
+    //down these flat lists of leaves and of HORZ/VERT nodes
+    int layout_dirty;
+    int lx, ly, lw, lh; //Screen area the layout was done for
+    struct _twm_node **leaves;
+    int num_leaves;
+    struct _twm_node **splits;
+    int num_splits;
+    struct _twm_node **dirty; //Leaves with something to draw this frame
+    int num_dirty;
+    int lists_cap; //All three lists have room for this many nodes
+    
     //Error informaiton
     char const *error_str;
 } twm_tree;
 
-//Here's the key idea: twm nodes also know how to draw themselves
-int draw_fn_twm_node(void *item, int x, int y, int w, int h, char *buf);
-
-int draw_sz_twm_node(void *item, int w, int h);
-
 void trigger_redraw_twm_node(void *item);
 
 extern draw_operations const empty_ops;
@@ -152,10 +188,29 @@ int twm_set_stack_dir_focused(twm_tree *t, twm_node_type type);
 //t->error_str (or returns -2 if t was NULL)
 int twm_toggle_stack_dir_focused(twm_tree *t);
 
-//write()s the data described by t into fd, given the target screen size
-//and coordinates. Follows usual error return technique
+//Sets the weight and minimum size (see twm_node) of the focused node. 
+//Returns -1 on error and sets t->error_str (or returns -2 if t was NULL)
+int twm_set_weight_focused(twm_tree *t, int weight, int min_sz);
+
+//Draws t for the given screen size and coordinates, and starts write()ing
+//it into fd (see twm_flush). Returns the size of the frame, 0 if there was
+//nothing to draw, or -1 on error (and sets t->error_str). Returns -2 if t
+//is NULL. If the last frame still hasn't been sent, this draws nothing 
+//and returns 0. At most one frame is ever in flight; whatever changes in 
+//the meantime goes out in one go in the next frame
 int twm_draw_tree(int fd, twm_tree *t, int x, int y, int w, int h);
 
+//write()s as much of the frame in flight as fd will take. Give it a 
+//non-blocking fd and call it again when fd is writable. Returns the number
+//of bytes still waiting (0 once the frame is all out), or -1 on error (and
+//sets t->error_str). Returns -2 if t is NULL. If anything asked for a 
+//redraw while the frame was in flight, this calls the redraw hook once
+//it's done
+int twm_flush(int fd, twm_tree *t);
+
+//Number of bytes in the frame in flight that haven't been written yet
+int twm_tree_pending(twm_tree *t);
+
 char const* twm_tree_strerror(twm_tree *t);
 
 //Each tree node stores a void pointer to the drawable item. However, we
@@ -178,4 +233,34 @@ int twm_tree_focus_item(twm_tree *t, void *item);
 //Forces entire tree to redraw. Follows usual return code convention
 int twm_tree_redraw(twm_tree *t);
 
+//Checks the subtree at t for broken links and for violations of the tree
+//invariant. Returns 0 if all is well, or an OR of these bits. Only meant
+//for debugging, so it doesn't stop at the first problem
+#define TWM_INV_NULL_CHILD  0x01 //A child pointer is NULL
+#define TWM_INV_BAD_PARENT  0x02 //A child doesn't point back at its parent
+#define TWM_INV_EMPTY_SPLIT 0x04 //A TWM_HORZ/TWM_VERT node with no children
+#define TWM_INV_ONLY_CHILD  0x08 //An only child that isn't a leaf
+#define TWM_INV_BAD_TYPE    0x10 //Uninitialized (or garbage) node type
+#define TWM_INV_BAD_WEIGHT  0x20 //weight < 1 or min_sz < 0
+int check_tree_invariants(twm_node *t);
+
+//Nothing polls the tree. Instead, whenever something (on the UI thread)
+//sets a need_redraw flag outside of drawing, it also calls 
+//twm_request_redraw(), which calls this hook so that whoever owns the 
+//event loop can schedule a call to twm_draw_tree. Only the first request
+//after a twm_draw_tree gets passed on, so a burst of updates costs one
+//hook call and one frame. delay_ns is how long the frame is allowed to
+//wait; the hook can make it wait longer (e.g. to cap the frame rate)
+typedef void twm_redraw_hook(uint64_t delay_ns);
+
+//Pass NULL to remove the hook
+void twm_set_redraw_hook(twm_redraw_hook *fn);
+
+//Asks for a frame as soon as possible
+void twm_request_redraw();
+
+//Asks for a frame after delay_ns, for things that change on their own 
+//over time (like rates). Dropped if a frame is already on its way
+void twm_request_redraw_in(uint64_t delay_ns);
+
 #endif
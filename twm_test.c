@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include "twm.h"
+#include "textio.h"
+
+//Random stress test for the TWM. We add, remove and move windows (and
+//shuffle focus, stacking directions, weights and the screen size) at
+//random, and after every operation we check:
+//
+//  - check_tree_invariants() comes back clean
+//  - The focus is on a window, and the leaf list has exactly the windows
+//    we think are open
+//  - Every leaf is on the screen, and no two leaves overlap
+//  - If a split has room for all its children's min_sz, they all get it
+//
+//The tree is drawn (to /dev/null) after every operation too, so that the
+//layout is actually recomputed. Exits with 0 if everything held up.
+
+//Some of the code we link against writes errors here
+msg_win *err_log = NULL;
+
+//Cheap and deterministic, so a failing seed can be rerun
+static uint32_t rng_state;
+static uint32_t rng() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+//A window that just fills itself with one character
+typedef struct _box {
+    char c;
+    int need_redraw;
+    int alive;
+} box;
+
+static int draw_fn_box(void *item, int x, int y, int w, int h, char *buf) {
+    box *b = (box*) item;
+    if (!b->need_redraw) return 0;
+
+    char *buf_saved = buf;
+    int i;
+    for (i = 0; i < h; i++) {
+        buf += cursor_pos_cmd(buf, x, y + i);
+        memset(buf, b->c, w);
+        buf += w;
+    }
+
+    b->need_redraw = 0;
+    return buf - buf_saved;
+}
+
+static int draw_sz_box(void *item, int w, int h) {
+    box *b = (box*) item;
+    return b->need_redraw ? h*(12 + w) + 1 : 0;
+}
+
+static void trigger_redraw_box(void *item) {
+    ((box*) item)->need_redraw = 1;
+}
+
+static void exit_box(void *item) {
+    ((box*) item)->alive = 0;
+}
+
+static draw_operations box_ops = {
+    draw_fn_box,
+    draw_sz_box,
+    trigger_redraw_box,
+    exit_box
+};
+
+#define TWM_TEST_MAX_BOXES 16384 //Boxes are never reused
+#define TWM_TEST_MAX_W 340
+#define TWM_TEST_MAX_H 160
+
+static box boxes[TWM_TEST_MAX_BOXES];
+static unsigned char covered[TWM_TEST_MAX_W * TWM_TEST_MAX_H];
+
+//Checks the layout from the last draw. Returns the number of problems
+static int check_geometry(twm_tree *t, int W, int H, int it) {
+    int bad = 0;
+    memset(covered, 0, W * H);
+
+    int i;
+    for (i = 0; i < t->num_leaves; i++) {
+        twm_node *l = t->leaves[i];
+        if (l->w < 0 || l->h < 0 || l->x < 1 || l->y < 1 || l->x + l->w > W + 1 || l->y + l->h > H + 1) {
+            printf("op %d: leaf off the screen at %d,%d (%dx%d)\n", it, l->x, l->y, l->w, l->h);
+            bad++;
+            continue;
+        }
+
+        int x, y;
+        for (y = l->y; y < l->y + l->h; y++) {
+            for (x = l->x; x < l->x + l->w; x++) {
+                if (covered[(y-1)*W + x-1]++) {
+                    printf("op %d: leaves overlap at %d,%d\n", it, x, y);
+                    return bad + 1; //No point in reporting every cell
+                }
+            }
+        }
+    }
+
+    for (i = 0; i < t->num_splits; i++) {
+        twm_node *s = t->splits[i];
+        int len = (s->type == TWM_HORZ) ? s->w : s->h;
+        int min_total = s->num_children - 1; //Borders
+        int j;
+        for (j = 0; j < s->num_children; j++) min_total += s->children[j]->min_sz;
+        if (min_total > len) continue; //Someone has to lose
+
+        for (j = 0; j < s->num_children; j++) {
+            twm_node *c = s->children[j];
+            int sz = (s->type == TWM_HORZ) ? c->w : c->h;
+            if (sz < c->min_sz) {
+                printf("op %d: child got %d but wanted at least %d\n", it, sz, c->min_sz);
+                bad++;
+            }
+        }
+    }
+
+    return bad;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 4) {
+        fprintf(stderr, "Usage: twm_test [SEED] [MAX_WINDOWS] [OPS]\n");
+        return -1;
+    }
+
+    unsigned seed = 1;
+    int max_windows = 600;
+    int num_ops = 20000;
+
+    if (argc > 1 && sscanf(argv[1], "%u", &seed) != 1) {
+        fprintf(stderr, "Could not parse seed [%s]\n", argv[1]);
+        return -1;
+    }
+    if (argc > 2 && (sscanf(argv[2], "%d", &max_windows) != 1 || max_windows < 1)) {
+        fprintf(stderr, "Could not parse window count [%s]\n", argv[2]);
+        return -1;
+    }
+    if (argc > 3 && (sscanf(argv[3], "%d", &num_ops) != 1 || num_ops < 1)) {
+        fprintf(stderr, "Could not parse op count [%s]\n", argv[3]);
+        return -1;
+    }
+    rng_state = seed ? seed : 1; //xorshift gets stuck on 0
+
+    int fd = open("/dev/null", O_WRONLY);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+
+    twm_tree *t = new_twm_tree();
+    if (t == NULL) {
+        fprintf(stderr, "Could not allocate twm_tree\n");
+        return -1;
+    }
+
+    int W = 200, H = 60;
+    int num_boxes = 0, num_alive = 0, most_alive = 0;
+    //Removing a focused split takes its whole subtree with it, so left to
+    //itself the tree stays small. Until it first fills up, turn most
+    //removals into adds
+    int growing = 1;
+    int bad = 0;
+    int it;
+    for (it = 0; it < num_ops && bad == 0; it++) {
+        int op = rng() % 20;
+        if (growing && op >= 7 && op < 10 && rng() % 4 != 0) op = 0;
+        int rc = 0;
+
+        if (op < 7) {
+            if (num_alive < max_windows && num_boxes < TWM_TEST_MAX_BOXES) {
+                box *b = boxes + num_boxes++;
+                b->c = 'A' + num_boxes % 26;
+                b->need_redraw = 1;
+                b->alive = 1;
+                rc = twm_tree_add_window(t, b, box_ops);
+            }
+        } else if (op < 9) {
+            if (t->focus != NULL) rc = twm_tree_remove_focused(t);
+        } else if (op < 10) {
+            if (num_boxes > 0) {
+                box *b = boxes + rng() % num_boxes;
+                if (b->alive) rc = twm_tree_remove_item(t, b);
+            }
+        } else if (op < 13) {
+            rc = twm_tree_move_focused_node(t, rng() % 4);
+        } else if (op < 16) {
+            rc = twm_tree_move_focus(t, rng() % 6);
+        } else if (op < 17) {
+            rc = twm_toggle_stack_dir_focused(t);
+        } else if (op < 18) {
+            rc = twm_set_weight_focused(t, 1 + rng() % 5, (rng() % 3) ? 0 : rng() % 15);
+        } else if (op < 19) {
+            W = 40 + rng() % (TWM_TEST_MAX_W - 40 + 1);
+            H = 10 + rng() % (TWM_TEST_MAX_H - 10 + 1);
+            rc = twm_tree_redraw(t);
+        } else {
+            int i;
+            for (i = 0; i < num_boxes; i++) {
+                if (boxes[i].alive && rng() % 3 == 0) boxes[i].need_redraw = 1;
+            }
+        }
+
+        //Some of these are allowed to fail (e.g. moving off the edge), but
+        //they should never break the tree
+        if (rc < 0 && t->error_str == TWM_INVALID_TREE) {
+            printf("op %d (%d): %s\n", it, op, t->error_str);
+            bad++;
+            break;
+        }
+
+        num_alive = 0;
+        int i;
+        for (i = 0; i < num_boxes; i++) num_alive += boxes[i].alive;
+        if (num_alive > most_alive) most_alive = num_alive;
+        if (num_alive == max_windows) growing = 0;
+
+        int inv = check_tree_invariants(t->head);
+        if (inv != 0) {
+            printf("op %d (%d): invariants broken (0x%x)\n", it, op, inv);
+            bad++;
+            break;
+        }
+
+        if (t->head == NULL) {
+            if (num_alive != 0) {
+                printf("op %d (%d): empty tree but %d windows open\n", it, op, num_alive);
+                bad++;
+            }
+            continue;
+        }
+
+        if (t->focus == NULL || !t->focus->has_focus) {
+            printf("op %d (%d): lost the focus\n", it, op);
+            bad++;
+            break;
+        }
+
+        if (twm_draw_tree(fd, t, 1, 1, W, H) < 0) {
+            printf("op %d (%d): could not draw tree: %s\n", it, op, t->error_str);
+            bad++;
+            break;
+        }
+
+        if (t->num_leaves != num_alive) {
+            printf("op %d (%d): %d leaves but %d windows open\n", it, op, t->num_leaves, num_alive);
+            bad++;
+            break;
+        }
+
+        bad += check_geometry(t, W, H, it);
+    }
+
+    printf("seed %u: %d ops, up to %d windows, %s\n", seed, it, most_alive, bad ? "FAILED" : "ok");
+
+    del_twm_tree(t);
+    return bad ? -1 : 0;
+}